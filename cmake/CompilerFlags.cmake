@@ -19,7 +19,11 @@ macro(_NORMALIZE_COMPILER_FLAGS VAR FLAGS)
     unset(_INTERNAL_VAR)
 endmacro(_NORMALIZE_COMPILER_FLAGS var flags)
 
-check_cxx_compiler_flag(-march=native NATIVE_C_FLAG_SUPPORTED)
+if(LLAMA_NATIVE)
+    check_cxx_compiler_flag(-march=native NATIVE_C_FLAG_SUPPORTED)
+else()
+    set(NATIVE_C_FLAG_SUPPORTED FALSE)
+endif(LLAMA_NATIVE)
 
 if (EXISTS ${COMPILER_FLAG_VARS_FILE_PATH})
     include(${COMPILER_FLAG_VARS_FILE_PATH})
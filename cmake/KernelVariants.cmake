@@ -0,0 +1,50 @@
+include(CheckCCompilerFlag)
+
+# On x86 the hot ggml kernels (lib/ggml-kernels.c) are compiled once per instruction set and ggml_init picks the
+# best variant the CPU supports, so one binary runs well on every host. Unless LLAMA_NATIVE asks for -march=native,
+# the ops left in ggml.c are compiled for SSE4.2, the baseline of the sse4 variant, since their vector helpers are
+# scalar below SSE3, and the rest of the code for the x86 baseline. Other architectures and MSVC only build the
+# base variant, which uses the flags of the library.
+
+if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64|i[3-6]86|x86)$" AND NOT MSVC)
+    check_c_compiler_flag("-mavx512vnni" C_FLAG_SUPPORTED_mavx512vnni)
+    if(C_FLAG_SUPPORTED_mavx512vnni)
+        set(GGML_X86_KERNEL_VARIANTS TRUE)
+    else()
+        message(STATUS "The compiler does not support AVX-512 VNNI; building the ggml kernels for the host only")
+    endif(C_FLAG_SUPPORTED_mavx512vnni)
+endif()
+
+if(GGML_X86_KERNEL_VARIANTS)
+    option(LLAMA_NATIVE "Compile for the CPU of the build host (-march=native)" OFF)
+else()
+    option(LLAMA_NATIVE "Compile for the CPU of the build host (-march=native)" ON)
+endif(GGML_X86_KERNEL_VARIANTS)
+
+set(GGML_KERNELS_SOURCE "${CMAKE_CURRENT_SOURCE_DIR}/lib/ggml-kernels.c")
+
+macro(_ADD_GGML_KERNEL_VARIANT target name flags)
+    add_library(${target}_${name} OBJECT ${GGML_KERNELS_SOURCE})
+    set_target_properties(${target}_${name} PROPERTIES POSITION_INDEPENDENT_CODE ON)
+    target_compile_definitions(${target}_${name} PRIVATE GGML_KERNEL_VARIANT=${name})
+    target_compile_options(${target}_${name} PRIVATE ${flags})
+    target_sources(${target} PRIVATE $<TARGET_OBJECTS:${target}_${name}>)
+    message(STATUS "ggml kernel variant '${name}': ${flags}")
+endmacro(_ADD_GGML_KERNEL_VARIANT)
+
+function(add_ggml_kernels target)
+    if(GGML_X86_KERNEL_VARIANTS AND NOT LLAMA_NATIVE)
+        get_target_property(GGML_LIBRARY_SOURCES ${target} SOURCES)
+        set_source_files_properties(${GGML_LIBRARY_SOURCES} PROPERTIES COMPILE_OPTIONS "-msse4.2")
+    endif()
+
+    # the base variant is compiled with the flags of the library
+    target_sources(${target} PRIVATE ${GGML_KERNELS_SOURCE})
+
+    if(GGML_X86_KERNEL_VARIANTS)
+        target_compile_definitions(${target} PRIVATE GGML_KERNEL_VARIANTS)
+        _ADD_GGML_KERNEL_VARIANT(${target} sse4   "-msse4.2")
+        _ADD_GGML_KERNEL_VARIANT(${target} avx2   "-mavx2;-mfma;-mf16c")
+        _ADD_GGML_KERNEL_VARIANT(${target} avx512 "-mavx512f;-mavx512bw;-mavx512vl;-mavx512vnni;-mavx2;-mfma;-mf16c")
+    endif(GGML_X86_KERNEL_VARIANTS)
+endfunction(add_ggml_kernels)
@@ -0,0 +1,398 @@
+#if !defined(FAST_LLAMA_ASYNC_FILE_READER_HPP)
+#define FAST_LLAMA_ASYNC_FILE_READER_HPP
+
+#include "macro.hpp"
+#include "concurrency/utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __has_include
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #include <fcntl.h>
+        #if defined(__linux__) && __has_include(<linux/io_uring.h>)
+            #include <linux/io_uring.h>
+            #include <sys/mman.h>
+            #include <sys/stat.h>
+            #include <sys/syscall.h>
+            #define FAST_LLAMA_IO_URING
+        #endif
+    #endif
+#endif
+
+namespace fastllama {
+
+    namespace detail {
+    #if defined(FAST_LLAMA_IO_URING)
+        // The submission and completion rings of an io_uring, set up with the system calls so that liburing is not
+        // needed. Only one thread uses it.
+        struct IoUring {
+            IoUring() noexcept = default;
+            IoUring(IoUring const&) = delete;
+            IoUring& operator=(IoUring const&) = delete;
+            ~IoUring() noexcept { reset(); }
+
+            auto init(unsigned entries) noexcept -> bool {
+                io_uring_params p{};
+                m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+                if (m_fd < 0) return false;
+
+                m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+                m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+                auto const single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (single_mmap) m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+
+                m_sq_ptr = map(m_sq_size, IORING_OFF_SQ_RING);
+                m_cq_ptr = single_mmap ? m_sq_ptr : map(m_cq_size, IORING_OFF_CQ_RING);
+                m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+                m_sqes = static_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+                if (!m_sq_ptr || !m_cq_ptr || !m_sqes) {
+                    reset();
+                    return false;
+                }
+
+                auto const sq = static_cast<char*>(m_sq_ptr);
+                m_sq_head  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+                m_sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+                m_sq_mask  = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+                m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+                auto const cq = static_cast<char*>(m_cq_ptr);
+                m_cq_head  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+                m_cq_tail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+                m_cq_mask  = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+                m_cqes     = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+                m_entries = p.sq_entries;
+                return true;
+            }
+
+            // At most this many reads may be in flight; the completion ring is at least as large
+            constexpr auto capacity() const noexcept -> unsigned { return m_entries; }
+
+            // Queues a read; false if the submission ring is full
+            auto push_read(int fd, void* dst, std::size_t size, std::uint64_t offset, std::uint64_t user_data) noexcept -> bool {
+                auto const tail = *m_sq_tail;
+                if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_entries) return false;
+
+                auto const index = tail & m_sq_mask;
+                auto& sqe = m_sqes[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode    = IORING_OP_READ;
+                sqe.fd        = fd;
+                sqe.addr      = reinterpret_cast<std::uint64_t>(dst);
+                sqe.len       = static_cast<std::uint32_t>(size);
+                sqe.off       = offset;
+                sqe.user_data = user_data;
+                m_sq_array[index] = index;
+
+                __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+                ++m_to_submit;
+                return true;
+            }
+
+            // Submits the queued reads and waits until at least `min_complete` of the reads have completed
+            auto submit_and_wait(unsigned min_complete) noexcept -> bool {
+                for(;;) {
+                    auto const res = syscall(__NR_io_uring_enter, m_fd, m_to_submit, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    if (res >= 0) {
+                        m_to_submit -= static_cast<unsigned>(res);
+                        return true;
+                    }
+                    if (errno != EINTR) return false;
+                }
+            }
+
+            // Calls `fn(user_data, res)` for every completed read and returns how many there were
+            template<typename Fn>
+            auto reap(Fn&& fn) -> unsigned {
+                auto head = *m_cq_head;
+                auto const tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+                auto count = 0u;
+                for(; head != tail; ++head, ++count) {
+                    auto const& cqe = m_cqes[head & m_cq_mask];
+                    fn(cqe.user_data, cqe.res);
+                }
+                __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+                return count;
+            }
+
+        private:
+            auto map(std::size_t size, off_t offset) noexcept -> void* {
+                auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+                return ptr == MAP_FAILED ? nullptr : ptr;
+            }
+
+            void reset() noexcept {
+                if (m_sqes) munmap(m_sqes, m_sqes_size);
+                if (m_cq_ptr && m_cq_ptr != m_sq_ptr) munmap(m_cq_ptr, m_cq_size);
+                if (m_sq_ptr) munmap(m_sq_ptr, m_sq_size);
+                if (m_fd >= 0) close(m_fd);
+                m_sqes = nullptr;
+                m_sq_ptr = m_cq_ptr = nullptr;
+                m_fd = -1;
+            }
+
+        private:
+            int             m_fd{-1};
+            unsigned        m_entries{};
+            unsigned        m_to_submit{};
+            void*           m_sq_ptr{nullptr};
+            void*           m_cq_ptr{nullptr};
+            std::size_t     m_sq_size{};
+            std::size_t     m_cq_size{};
+            std::size_t     m_sqes_size{};
+            io_uring_sqe*   m_sqes{nullptr};
+            unsigned*       m_sq_head{nullptr};
+            unsigned*       m_sq_tail{nullptr};
+            unsigned*       m_sq_array{nullptr};
+            unsigned        m_sq_mask{};
+            unsigned*       m_cq_head{nullptr};
+            unsigned*       m_cq_tail{nullptr};
+            unsigned        m_cq_mask{};
+            io_uring_cqe*   m_cqes{nullptr};
+        };
+    #endif
+    } // namespace detail
+
+    // Reads many parts of files straight into their destinations at once: as a deep queue of large reads with io_uring
+    // on Linux, otherwise with pread on the threads of a pool. With `direct_io`, the parts of the reads that meet the
+    // alignment O_DIRECT needs bypass the page cache; the rest, and any read O_DIRECT refuses, are buffered.
+    struct AsyncFileReader {
+    #if defined(_POSIX_VERSION)
+        static constexpr bool SUPPORTED = true;
+    #else
+        static constexpr bool SUPPORTED = false;
+    #endif
+
+        struct Options {
+            std::size_t     chunk_size{8 * 1024 * 1024}; // Largest single read
+            unsigned        queue_depth{64}; // Reads in flight with io_uring
+            std::size_t     n_threads{1}; // Threads of the pread fallback
+            bool            direct_io{false};
+        };
+
+        AsyncFileReader(Options options) noexcept
+            : m_options(options)
+        {}
+
+        AsyncFileReader(AsyncFileReader const&) = delete;
+        AsyncFileReader& operator=(AsyncFileReader const&) = delete;
+
+        ~AsyncFileReader() noexcept {
+        #if defined(_POSIX_VERSION)
+            for(auto const& file : m_files) {
+                if (file.fd >= 0) close(file.fd);
+                if (file.direct_fd >= 0) close(file.direct_fd);
+            }
+        #endif
+        }
+
+        // Returns the index of the file to pass to `read`, or -1 if it can't be opened
+        auto open(std::string_view path) -> int {
+        #if defined(_POSIX_VERSION)
+            auto const p = std::string(path);
+            auto file = File{};
+            file.fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file.fd < 0) return -1;
+
+            #if defined(O_DIRECT)
+                if (m_options.direct_io && direct_io_alignment(file.fd, &file.mem_align, &file.offset_align)) {
+                    file.direct_fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+                }
+            #endif
+
+            m_files.push_back(file);
+            return static_cast<int>(m_files.size() - 1);
+        #else
+            (void)path;
+            return -1;
+        #endif
+        }
+
+        // Queues a read of `size` bytes at `offset` of the file into `dst`; nothing is read before `run`
+        void read(int file, void* dst, std::size_t size, std::uint64_t offset) {
+            auto const& f = m_files[static_cast<std::size_t>(file)];
+            auto const d = static_cast<std::uint8_t*>(dst);
+            m_total_size += size;
+
+            if (f.direct_fd >= 0) {
+                // O_DIRECT from the first aligned offset to the last one, if the memory is aligned there as well
+                auto const head = (f.offset_align - offset % f.offset_align) % f.offset_align;
+                auto const body = head < size ? (size - head) / f.offset_align * f.offset_align : 0;
+                if (body > 0 && reinterpret_cast<std::uintptr_t>(d + head) % f.mem_align == 0) {
+                    add_chunks(file, false, d, head, offset);
+                    add_chunks(file, true, d + head, body, offset + head);
+                    add_chunks(file, false, d + head + body, size - head - body, offset + head + body);
+                    return;
+                }
+            }
+            add_chunks(file, false, d, size, offset);
+        }
+
+        // Reads everything queued, in the order of the files, and calls `on_progress(bytes done)` as the reads complete
+        template<typename Fn>
+        auto run(Fn&& on_progress) -> bool {
+            std::sort(m_chunks.begin(), m_chunks.end(), [](Chunk const& l, Chunk const& r) {
+                return l.file != r.file ? l.file < r.file : l.offset < r.offset;
+            });
+
+            if (m_chunks.empty()) return true;
+
+        #if defined(FAST_LLAMA_IO_URING)
+            {
+                detail::IoUring ring;
+                if (ring.init(m_options.queue_depth)) {
+                    m_backend = "io_uring";
+                    return run_io_uring(ring, on_progress);
+                }
+            }
+        #endif
+
+            m_backend = "pread";
+            return run_pread(on_progress);
+        }
+
+        constexpr auto total_size() const noexcept -> std::size_t { return m_total_size; }
+        constexpr auto direct_size() const noexcept -> std::size_t { return m_direct_size; }
+
+        // "io_uring" or "pread" after `run`
+        constexpr auto backend() const noexcept -> std::string_view { return m_backend; }
+
+    private:
+        struct File {
+            int             fd{-1};
+            int             direct_fd{-1};
+            std::size_t     mem_align{1};
+            std::size_t     offset_align{1};
+        };
+
+        struct Chunk {
+            int             file;
+            bool            direct;
+            std::uint8_t*   dst;
+            std::size_t     size;
+            std::uint64_t   offset;
+        };
+
+        void add_chunks(int file, bool direct, std::uint8_t* dst, std::size_t size, std::uint64_t offset) {
+            for(auto pos = std::size_t{}; pos < size; pos += m_options.chunk_size) {
+                m_chunks.push_back(Chunk{ file, direct, dst + pos, std::min(m_options.chunk_size, size - pos), offset + pos });
+            }
+            if (direct) m_direct_size += size;
+        }
+
+    #if defined(_POSIX_VERSION)
+        // The alignments of the memory and of the file offsets O_DIRECT needs; false if the file can't use it
+        static auto direct_io_alignment([[maybe_unused]] int fd, std::size_t* mem_align, std::size_t* offset_align) noexcept -> bool {
+        #if defined(STATX_DIOALIGN)
+            struct statx stx{};
+            if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)) {
+                if (stx.stx_dio_offset_align == 0) return false;
+                *mem_align = std::max<std::size_t>(stx.stx_dio_mem_align, 1);
+                *offset_align = stx.stx_dio_offset_align;
+                return true;
+            }
+        #endif
+            // Pages are aligned enough for every file system
+            *mem_align = *offset_align = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            return true;
+        }
+
+        static auto pread_all(int fd, std::uint8_t* dst, std::size_t size, std::uint64_t offset) noexcept -> bool {
+            while (size > 0) {
+                auto const n = ::pread(fd, dst, size, static_cast<off_t>(offset));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                dst += n;
+                size -= static_cast<std::size_t>(n);
+                offset += static_cast<std::uint64_t>(n);
+            }
+            return true;
+        }
+
+        // Reads the rest of a chunk from `done` on; what O_DIRECT refuses is read through the page cache
+        auto read_chunk(Chunk const& c, std::size_t done = 0) const noexcept -> bool {
+            auto const& f = m_files[static_cast<std::size_t>(c.file)];
+            if (c.direct && done == 0 && pread_all(f.direct_fd, c.dst, c.size, c.offset)) return true;
+            return pread_all(f.fd, c.dst + done, c.size - done, c.offset + done);
+        }
+    #endif
+
+    #if defined(FAST_LLAMA_IO_URING)
+        template<typename Fn>
+        auto run_io_uring(detail::IoUring& ring, Fn&& on_progress) -> bool {
+            auto next = std::size_t{};
+            auto in_flight = std::size_t{};
+            auto done_size = std::size_t{};
+            auto ok = true;
+
+            while (next < m_chunks.size() || in_flight > 0) {
+                for(; next < m_chunks.size() && in_flight < ring.capacity(); ++next, ++in_flight) {
+                    auto const& c = m_chunks[next];
+                    auto const& f = m_files[static_cast<std::size_t>(c.file)];
+                    if (!ring.push_read(c.direct ? f.direct_fd : f.fd, c.dst, c.size, c.offset, next)) break;
+                }
+
+                // The reads in flight write to the destinations until they complete, so there is no giving up here
+                FAST_LLAMA_ASSERT(ring.submit_and_wait(1), "io_uring_enter failed");
+
+                in_flight -= ring.reap([&](std::uint64_t index, int res) {
+                    auto const& c = m_chunks[index];
+                    // Short reads are finished, and failed ones redone, with pread
+                    if (res < 0 || static_cast<std::size_t>(res) != c.size) {
+                        ok = read_chunk(c, res > 0 ? static_cast<std::size_t>(res) : 0) && ok;
+                    }
+                    done_size += c.size;
+                });
+
+                on_progress(done_size);
+            }
+            return ok;
+        }
+    #endif
+
+        template<typename Fn>
+        auto run_pread(Fn&& on_progress) -> bool {
+        #if defined(_POSIX_VERSION)
+            std::atomic<std::size_t> done_size{0};
+            std::atomic<bool> ok{true};
+
+            auto worker = [&](parallel::Block block) {
+                for(auto i = block.start; i < block.end; ++i) {
+                    auto const& c = m_chunks[i];
+                    if (!read_chunk(c)) ok.store(false, std::memory_order_relaxed);
+                    on_progress(done_size.fetch_add(c.size, std::memory_order_relaxed) + c.size);
+                }
+            };
+
+            auto thread_pool = ThreadPool(std::max<std::size_t>(m_options.n_threads, 1));
+            thread_pool.start();
+
+            parallel::for_(thread_pool, parallel::Range{ 0, m_chunks.size(), 1 }, std::move(worker));
+
+            return ok.load();
+        #else
+            (void)on_progress;
+            return false;
+        #endif
+        }
+
+    private:
+        Options             m_options;
+        std::vector<File>   m_files;
+        std::vector<Chunk>  m_chunks;
+        std::size_t         m_total_size{};
+        std::size_t         m_direct_size{};
+        std::string_view    m_backend{"none"};
+    };
+
+} // namespace fastllama
+
+#endif // FAST_LLAMA_ASYNC_FILE_READER_HPP
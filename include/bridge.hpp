@@ -10,8 +10,21 @@
 #include "ring_buffer.hpp"
 #include "token_buffer.hpp"
 #include <optional>
+#include <memory>
+
+namespace fastllama {
+
+    auto sample_top_p_top_k(
+        Model const& model,
+        Span<float> logits,
+        RingBuffer<typename Vocab::id_type> const & last_n_tokens,
+        double repeat_penalty,
+        int top_k,
+        double top_p,
+        double temp,
+        std::mt19937 & rng
+    ) -> typename Vocab::id_type;
 
-namespace fastllama {    
     struct FastLlama {
         using token_id_t = typename Vocab::id_type;
 
@@ -24,15 +37,25 @@ namespace fastllama {
             int             n_ctx{512};
             int             n_threads{1};
             int             n_batch{16};
+            int             n_spin{GGML_DEFAULT_N_SPIN};
             std::uint32_t   n_load_parallel_blocks{1};
+            std::uint32_t   n_prefetch_layers{1}; // layers paged in ahead of the one being evaluated with `use_layer_paging`
+            ggml_type       kv_cache_type{GGML_TYPE_F32}; // F32, F16 or Q8_0
+            ggml_numa_strategy numa{GGML_NUMA_DISABLED}; // interleave or partition the weights over the NUMA nodes and pin the threads to them
             bool            is_old_model{false};
             bool            embedding_eval_enabled{false};
             bool            should_get_all_logits{false};
             bool            use_mmap{false};
             bool            use_mlock{false};
             bool            use_parallel_loading{false};
+            bool            use_flash_attn{false};
+            bool            repack_weights{false}; // interleave the q4_0 matrices by 4 rows, cached next to the model
+            bool            use_direct_io{false}; // read the weights with O_DIRECT when not using mmap
+            bool            use_layer_paging{false}; // map the weights and page them in layer by layer, for models larger than the memory
+            bool            use_huge_pages{false}; // back the weights, kv cache and eval buffers with huge pages where available
             std::size_t     last_n_tokens{64};
             std::size_t     allocate_extra_mem{};
+            std::size_t     prefix_cache_size{}; // tokens of prompt prefixes whose memory is kept for new sessions; zero disables it
             Logger          logger{};
 
             constexpr Params& set_seed(int in_seed) noexcept { this->seed = in_seed; return *this; }
@@ -40,17 +63,32 @@ namespace fastllama {
             constexpr Params& set_number_of_contexts(int ctx) noexcept { this->n_ctx = ctx; return *this; }
             constexpr Params& set_number_of_threads(int threads) noexcept { this->n_threads = threads; return *this; }
             constexpr Params& set_number_of_batches(int batches) noexcept { this->n_batch = batches; return *this; }
+            constexpr Params& set_spin_count(int count) noexcept { this->n_spin = count; return *this; }
+            constexpr Params& set_kv_cache_type(ggml_type type) noexcept { this->kv_cache_type = type; return *this; }
+            constexpr Params& set_numa(ggml_numa_strategy strategy) noexcept { this->numa = strategy; return *this; }
             constexpr Params& set_is_old_model(bool flag) noexcept { this->is_old_model = flag; return *this; }
             constexpr Params& set_embedding_eval_enabled(bool flag) noexcept { this->embedding_eval_enabled = flag; return *this; }
             constexpr Params& set_should_get_all_logits(bool flag) noexcept { this->should_get_all_logits = flag; return *this; }
             constexpr Params& set_allocate_extra_mem(std::size_t allocate_extra_mem) noexcept { this->allocate_extra_mem = allocate_extra_mem; return *this; }
+            constexpr Params& set_prefix_cache_size(std::size_t n_tokens) noexcept { this->prefix_cache_size = n_tokens; return *this; }
             constexpr Params& set_use_mmap(bool flag) noexcept { this->use_mmap = flag; return *this; }
             constexpr Params& set_use_mlock(bool flag) noexcept { this->use_mlock = flag; return *this; }
             constexpr Params& set_use_parallel_loading(bool flag) noexcept { this->use_parallel_loading = flag; return *this; }
+            constexpr Params& set_use_flash_attn(bool flag) noexcept { this->use_flash_attn = flag; return *this; }
+            constexpr Params& set_repack_weights(bool flag) noexcept { this->repack_weights = flag; return *this; }
+            constexpr Params& set_use_direct_io(bool flag) noexcept { this->use_direct_io = flag; return *this; }
+            constexpr Params& set_use_layer_paging(bool flag) noexcept { this->use_layer_paging = flag; return *this; }
+            constexpr Params& set_use_huge_pages(bool flag) noexcept { this->use_huge_pages = flag; return *this; }
+            constexpr Params& set_n_prefetch_layers(std::uint32_t n_layers) noexcept { this->n_prefetch_layers = n_layers; return *this; }
             constexpr Params& set_n_parallel_load_blocks(std::uint32_t n_load_parallel_blocks) noexcept { this->n_load_parallel_blocks = n_load_parallel_blocks; return *this; }
             Params& set_logger(Logger in_logger) noexcept { this->logger = std::move(in_logger); return *this; }
 
+            // Loads the model from `filepath` and creates the first session of it.
             std::optional<FastLlama> build(std::string_view const& filepath);
+            // Creates a new session of an already loaded model. The model wide parameters (the context size,
+            // memory mapping, locking, parallel loading, repacking, direct I/O, layer paging, huge pages, NUMA and the prefix cache) and the logger are the ones the
+            // model was loaded with.
+            std::optional<FastLlama> build(std::shared_ptr<Model> model);
         };
 
         // FastLlama(std::string_view model_id, std::string_view const& filepath, int n_threads = 8, int n_ctx = 512, std::size_t last_n_size = 64, int seed = 0, int keep = 64);
@@ -59,7 +97,7 @@ namespace fastllama {
         FastLlama(FastLlama &&) noexcept = default;
         FastLlama& operator=(FastLlama const&) = delete;
         FastLlama& operator=(FastLlama &&) noexcept = default;
-        ~FastLlama() { m_model.unload(); }
+        ~FastLlama() = default;
 
         bool ingest(std::string prompt, bool is_system_prompt = false);
         bool generate(
@@ -81,18 +119,34 @@ namespace fastllama {
 
         static Params builder() noexcept { return {}; }
 
-        constexpr Logger const& get_logger() const noexcept { return m_model.logger; }
+        Logger const& get_logger() const noexcept { return m_model->logger; }
         bool save_state(std::string_view filepath) const noexcept;
         bool load_state(std::string_view filepath) noexcept;
 
-        bool attach_lora(std::string_view filepath) noexcept { return m_model.attach_lora(filepath); }
-        bool detach_lora() noexcept { return m_model.detach_lora(); }
+        // The loaded weights. Pass it to `Params::build` to create another session that shares them.
+        std::shared_ptr<Model> const& get_model() const noexcept { return m_model; }
+
+        // LoRA adapters modify the weights in place, so they cannot be changed while other sessions share the model.
+        bool attach_lora(std::string_view filepath) noexcept;
+        bool detach_lora() noexcept;
 
-        bool is_lora_attached() const noexcept { return !m_model.attached_lora_path.empty(); }
+        bool is_lora_attached() const noexcept { return !m_model->attached_lora_path.empty(); }
+
+        // Speculative decoding: while generating, `draft` proposes `n_draft` tokens that this model verifies in a
+        // single eval. The draft must use the same vocabulary and at least the same context size; it can be shared
+        // with other sessions. A null draft or zero tokens disables it.
+        bool set_draft_model(std::shared_ptr<Model> draft, std::size_t n_draft);
 
         bool reset() noexcept;
     private:
         auto recycle_embed_if_exceeds_context() -> bool;
+        // Evaluates the pending tokens and appends them to the memory
+        bool eval_embd();
+        // Drafts tokens and verifies them with the model. On success `tokens` holds the accepted tokens followed
+        // by one token sampled by the model; all but the last are already in the memory.
+        bool speculate(std::vector<token_id_t>& tokens, float top_k, float top_p, float temp, float repeat_penalty);
+        // Removes the last `n_unused` speculated tokens from the memory, so the memory ends where the output did
+        void drop_speculated_tokens(std::vector<token_id_t> const& tokens, std::size_t n_unused);
 
         FastLlama() = default;
 
@@ -105,12 +159,26 @@ namespace fastllama {
         size_t m_mem_per_token{};
         std::string m_model_name;
         std::mt19937 m_rng;
-        Model m_model;
+        std::shared_ptr<Model> m_model;
+        ModelState m_state;
         std::vector<token_id_t> m_embd;
         RingBuffer<token_id_t> m_last_n_tokens{64};
         std::vector<float> m_logits;
         std::vector<token_id_t> m_system_prompt;
         TokenBufferPartialState m_token_buffer_state;
+
+        // Tokens in the memory; they are known only while its size is `n_past`, which is not the case after loading a state
+        std::vector<token_id_t> m_context_tokens;
+
+        std::shared_ptr<Model> m_draft_model;
+        ModelState m_draft_state;
+        std::size_t m_n_draft{};
+        std::size_t m_draft_past{};     // tokens of `m_context_tokens` in the memory of the draft
+        std::vector<float> m_draft_logits;
+        std::size_t m_draft_mem_per_token{};
+        std::size_t m_n_drafted{};      // statistics of the current `generate`
+        std::size_t m_n_accepted{};
+        std::size_t m_n_verify_evals{};
     };
 
 } // namespace fastllama
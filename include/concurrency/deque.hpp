@@ -7,6 +7,7 @@
 #include <atomic>
 #include <vector>
 #include <optional>
+#include <utility>
 
 // This implementation is the work stealing queue described in the paper, 
 // "Correct and Efficient Work-Stealing for Weak Memory Models,"
@@ -11,6 +11,10 @@
 #include "mmap.hpp"
 #include "uninitialized_buffer.hpp"
 #include "concurrency/utils.hpp"
+#include "async_file_reader.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 
 namespace fastllama {
 
@@ -222,7 +226,7 @@ namespace fastllama {
                     return false;
                 }
 
-                if (!(shard.type >= GGML_TYPE_F32 && shard.type <= GGML_TYPE_Q4_3)) {
+                if (!(shard.type >= GGML_TYPE_F32 && shard.type <= GGML_TYPE_Q5_0)) {
                     logger->log_err(__func__, "unrecognized tensor type '", shard.type, "'\n");
                     return false;
                 }
@@ -355,7 +359,7 @@ namespace fastllama {
         }
 
         auto write_tensor(TensorLoader & tensor, ggml_type new_type, const void * new_data, size_t new_size) -> bool {
-            FAST_LLAMA_ASSERT(new_type >= GGML_TYPE_F32 && new_type <= GGML_TYPE_Q4_3, "invalid tensor type");
+            FAST_LLAMA_ASSERT(new_type >= GGML_TYPE_F32 && new_type <= GGML_TYPE_Q5_0, "invalid tensor type");
 
             writer.write_u32(tensor.extents.size());
             writer.write_u32(tensor.name.size());
@@ -374,9 +378,121 @@ namespace fastllama {
 
     };
 
+    // The repacked data of the tensors of a model, so that the rows are interleaved only on the first load. It is
+    // only used with model files of the same sizes and modification times as the ones it was written from.
+    struct RepackCache {
+        static constexpr std::uint32_t magic   = 0x67677270; // 'ggrp'
+        static constexpr std::uint32_t version = 1;
+
+        struct Entry {
+            std::size_t offset;
+            std::size_t size;
+        };
+
+        BinaryFileReader                                reader;
+        std::unordered_map<std::string, Entry>          entries;
+
+        RepackCache(std::string_view path) noexcept
+            : reader(path)
+        {}
+
+        // Stamp of the model files: the size and modification time of each of them
+        static auto make_stamp(std::vector<FileLoader> const& file_loaders) -> std::vector<std::uint64_t> {
+            std::vector<std::uint64_t> stamp;
+            for(auto const& fl : file_loaders) {
+                std::error_code ec;
+                auto const time = std::filesystem::last_write_time(std::string(fl.reader.path()), ec);
+                stamp.push_back(static_cast<std::uint64_t>(fl.reader.size()));
+                stamp.push_back(ec ? 0ul : static_cast<std::uint64_t>(time.time_since_epoch().count()));
+            }
+            return stamp;
+        }
+
+        // Reads the table of contents; false if the cache is missing, broken or made from other model files
+        auto open(std::vector<std::uint64_t> const& stamp) -> bool {
+            if (!reader) return false;
+
+            std::uint32_t header[3]{};
+            if (!reader.read(header, 3) || header[0] != magic || header[1] != version || header[2] != stamp.size()) return false;
+
+            std::vector<std::uint64_t> cache_stamp(stamp.size());
+            if (!reader.read(cache_stamp.data(), cache_stamp.size()) || cache_stamp != stamp) return false;
+
+            std::uint32_t n_tensors{};
+            if (!reader.read(&n_tensors)) return false;
+
+            for(auto i = 0u; i < n_tensors; ++i) {
+                std::uint32_t name_len{};
+                std::uint64_t size{};
+                if (!reader.read(&name_len) || name_len > 512) return false;
+                std::string name(name_len, '\0');
+                if (!reader.read(name.data(), name_len) || !reader.read(&size)) return false;
+
+                reader.seek(-reader.tell() & 31);
+                auto const offset = reader.tell();
+                if (offset + size > reader.size()) return false;
+
+                entries[std::move(name)] = Entry{ offset, static_cast<std::size_t>(size) };
+                reader.seek(size, BinaryFileReader::SeekReference::Current);
+            }
+            return true;
+        }
+
+        auto has(TensorLoader const& tl) const -> bool {
+            auto it = entries.find(tl.name);
+            return it != entries.end() && it->second.size == tl.size;
+        }
+
+        auto read(TensorLoader& tl) -> bool {
+            auto const& entry = entries.at(tl.name);
+            return reader.read_at_offset(tl.data, entry.size, entry.offset);
+        }
+
+        static auto write(std::string_view path, std::vector<std::uint64_t> const& stamp, TensorsMapping const& tensors_map) -> bool {
+            auto const tmp_path = std::string(path) + ".tmp";
+            {
+                auto writer = BinaryFileWriter(tmp_path);
+                if (!writer) return false;
+
+                std::uint32_t n_tensors{};
+                for(auto const& tl : tensors_map.tensors) n_tensors += tl.repack;
+
+                std::uint32_t const header[3] = { magic, version, static_cast<std::uint32_t>(stamp.size()) };
+                auto ok = writer.write(header, 3) && writer.write(stamp.data(), stamp.size()) && writer.write(&n_tensors);
+
+                for(auto const& tl : tensors_map.tensors) {
+                    if (!ok) break;
+                    if (!tl.repack) continue;
+
+                    auto const size = static_cast<std::uint64_t>(tl.size);
+                    ok = writer.write_string(tl.name) && writer.write(&size);
+
+                    char const zeros[32]{};
+                    ok = ok && writer.write(zeros, 1, -writer.tell() & 31) && writer.write(tl.data, tl.size);
+                }
+
+                if (!ok) {
+                    std::remove(tmp_path.c_str());
+                    return false;
+                }
+            }
+            return std::rename(tmp_path.c_str(), std::string(path).c_str()) == 0;
+        }
+    };
+
     struct ModelLoader {
         bool                            is_load_failed{false};
         bool                            use_mmap{false};
+        // Interleave the q4_0 matrices asked for with `get_tensor(..., can_repack = true)` into q4_0x4 and keep them
+        // in `repack_cache_path`
+        bool                            repack_weights{false};
+        std::string                     repack_cache_path{};
+        // Read around the page cache with O_DIRECT where the alignment allows it in `async_load_all_data`
+        bool                            use_direct_io{false};
+        // Map the file without reading it in; the weights are paged in as they are used
+        bool                            page_lazily{false};
+        // Ask for the mapping to be backed by huge pages where the filesystem allows it
+        bool                            use_huge_pages{false};
         std::vector<FileLoader>         file_loaders;
         TensorsMapping                  tensors_map;
         std::size_t                     num_of_ggml_tensors_created{};
@@ -462,7 +578,7 @@ namespace fastllama {
             return true;
         }
 
-        auto get_tensor(std::string_view name, std::vector<std::uint32_t> const& es) noexcept -> ggml_tensor* {
+        auto get_tensor(std::string_view name, std::vector<std::uint32_t> const& es, bool can_repack = false) noexcept -> ggml_tensor* {
             auto it = tensors_map.tensor_names.find(name.data());
 
             if (it == tensors_map.tensor_names.end()) {
@@ -476,6 +592,8 @@ namespace fastllama {
                 return nullptr;
             }
 
+            tensor_loader.repack = can_repack && repack_weights && tensor_loader.type == GGML_TYPE_Q4_0 && es.size() == 2 && es[1] % 4 == 0;
+
             return get_tensor_for(tensor_loader);
         }
 
@@ -483,7 +601,7 @@ namespace fastllama {
             ggml_tensor* tensor{nullptr};
 
             if (tl.extents.size() == 2) {
-                tensor = ggml_new_tensor_2d(mem_ctx, tl.type, tl.extents[0], tl.extents[1]);
+                tensor = ggml_new_tensor_2d(mem_ctx, tl.repack ? GGML_TYPE_Q4_0X4 : tl.type, tl.extents[0], tl.extents[1]);
             } else {
                 FAST_LLAMA_ASSERT(tl.extents.size() == 1, "invalid tensor rank");
                 tensor = ggml_new_tensor_1d(mem_ctx, tl.type, tl.extents[0]);
@@ -515,7 +633,7 @@ namespace fastllama {
             std::size_t data_size = total_size_needed_for_the_tensors();
             
             if (use_mmap) {
-                mmapped_file.reset(new MMappedFile(&file_loaders[0].reader));
+                mmapped_file.reset(new MMappedFile(&file_loaders[0].reader, !page_lazily, use_huge_pages));
                 if (!lmlock) {
                     // Don't call the callback since the actual loading will be lazy
                     // and we can't measure it.
@@ -525,6 +643,8 @@ namespace fastllama {
                 }
             }
 
+            auto repack_cache = open_repack_cache();
+
             std::size_t done_size{};
             for(auto& tl : tensors_map.tensors) {
                 if (call_progress_callback) {
@@ -533,7 +653,7 @@ namespace fastllama {
 
                 FAST_LLAMA_ASSERT(tl.tensor, "tensor not created");
                 tl.data = static_cast<std::uint8_t*>(tl.tensor->data);
-                load_data_for(tl);
+                load_data_for(tl, repack_cache.get());
                 tl.tensor->data = reinterpret_cast<void*>(tl.data);
                 done_size += tl.size;
 
@@ -545,13 +665,15 @@ namespace fastllama {
             if (call_progress_callback) {
                 logger->progress(ProgressTag::Init, data_size, data_size);
             }
+
+            if (!repack_cache) write_repack_cache();
         }
 
         void parallel_load_all_data(MemoryLock* lmlock, int n_thread, std::uint32_t block_size) {
             std::size_t data_size = total_size_needed_for_the_tensors();
             
             if (use_mmap) {
-                mmapped_file.reset(new MMappedFile(&file_loaders[0].reader));
+                mmapped_file.reset(new MMappedFile(&file_loaders[0].reader, !page_lazily, use_huge_pages));
                 if (!lmlock) {
                     // Don't call the callback since the actual loading will be lazy
                     // and we can't measure it.
@@ -561,6 +683,8 @@ namespace fastllama {
                 }
             }
 
+            auto repack_cache = open_repack_cache();
+
             std::atomic<std::size_t> done_size{0};
 
             auto worker = [&](parallel::Block block) {
@@ -570,7 +694,7 @@ namespace fastllama {
                     auto& tl = tensors_map.tensors[i];
                     FAST_LLAMA_ASSERT(tl.tensor, "tensor not created");
                     tl.data = static_cast<std::uint8_t*>(tl.tensor->data);
-                    load_data_for(tl);
+                    load_data_for(tl, repack_cache.get());
                     tl.tensor->data = reinterpret_cast<void*>(tl.data);
                     done_size.fetch_add(tl.size, std::memory_order_acquire);
                 }
@@ -584,6 +708,153 @@ namespace fastllama {
             if (call_progress_callback) {
                 logger->progress(ProgressTag::Init, data_size, data_size);
             }
+
+            if (!repack_cache) write_repack_cache();
+        }
+
+        // Reads the tensors without mmap as a deep queue of large reads straight into their buffers, repacking and
+        // reshaping the ones that need it once the reads are done
+        void async_load_all_data(std::size_t n_thread) {
+            FAST_LLAMA_ASSERT(!use_mmap, "the async loader does not map the files");
+
+            auto const data_size = total_size_needed_for_the_tensors();
+            auto repack_cache = open_repack_cache();
+
+            auto options = AsyncFileReader::Options{};
+            options.n_threads = n_thread;
+            options.direct_io = use_direct_io;
+            auto reader = AsyncFileReader(options);
+
+            std::vector<int> files;
+            for(auto const& fl : file_loaders) {
+                files.push_back(reader.open(fl.reader.path()));
+                if (files.back() < 0) {
+                    logger->log_err(__func__, "failed to open '", fl.reader.path(), "'\n");
+                    is_load_failed = true;
+                    return;
+                }
+            }
+
+            auto const cache_file = repack_cache ? reader.open(repack_cache_path) : -1;
+            if (repack_cache && cache_file < 0) {
+                logger->log_err(__func__, "failed to open '", repack_cache_path, "'\n");
+                is_load_failed = true;
+                return;
+            }
+
+            // The tensors split by columns are read and reshaped one by one afterwards
+            std::vector<TensorLoader*> deferred;
+
+            for(auto& tl : tensors_map.tensors) {
+                FAST_LLAMA_ASSERT(tl.tensor, "tensor not created");
+                tl.data = static_cast<std::uint8_t*>(tl.tensor->data);
+
+                if (tl.repack && repack_cache) {
+                    auto const& entry = repack_cache->entries.at(tl.name);
+                    reader.read(cache_file, tl.data, entry.size, entry.offset);
+                } else if (tl.split_type == SplitType::ByColumns) {
+                    deferred.push_back(&tl);
+                } else {
+                    std::size_t offset{};
+                    for(auto const& shard : tl.shards) {
+                        reader.read(files[shard.file_idx], tl.data + offset, shard.size, shard.file_off);
+                        offset += shard.size;
+                    }
+                    FAST_LLAMA_ASSERT(offset == tl.size, "invalid tensor size");
+                }
+            }
+
+            auto const start = std::chrono::steady_clock::now();
+
+            auto const ok = reader.run([this, data_size](std::size_t done_size) {
+                if (call_progress_callback) logger->progress(ProgressTag::Init, done_size, data_size);
+            });
+
+            if (!ok) {
+                logger->log_err(__func__, "failed to read the tensors\n");
+                is_load_failed = true;
+                return;
+            }
+
+            auto const secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            char size_buff[32];
+            char rate_buff[64];
+            auto const rate = static_cast<double>(reader.total_size()) / std::max(secs, 1e-9) / 1e9;
+            logger->log(__func__, "read ", humanize_size(size_buff, reader.total_size()), format_str(rate_buff, " in %.2f s (%.2f GB/s)", secs, rate),
+                " with ", reader.backend(), reader.direct_size() ? " and O_DIRECT" : "", "\n");
+
+            for(auto& tl : tensors_map.tensors) {
+                if (tl.repack && !repack_cache && tl.split_type != SplitType::ByColumns) repack_data_for(tl);
+            }
+
+            for(auto* tl : deferred) {
+                load_data_for(*tl, repack_cache.get());
+            }
+
+            if (call_progress_callback) {
+                logger->progress(ProgressTag::Init, data_size, data_size);
+            }
+
+            if (!repack_cache) write_repack_cache();
+        }
+
+        // Loads a tensor to be repacked from the cache if it has it, or from the model files followed by the repacking
+        void load_data_for(TensorLoader& tl, RepackCache* repack_cache) {
+            if (!tl.repack) {
+                load_data_for(tl);
+            } else if (repack_cache) {
+                FAST_LLAMA_ASSERT(repack_cache->read(tl), "failed to read repacked data");
+            } else {
+                load_data_for(tl);
+                repack_data_for(tl);
+            }
+        }
+
+        // Interleaves the rows of a loaded q4_0 tensor in place, 4 at a time
+        static void repack_data_for(TensorLoader& tl) {
+            auto const n_per_row = static_cast<int>(tl.extents[0]);
+            auto const row_size = tl.size / tl.extents[1];
+
+            auto tmp = UninitializedBuffer(4 * row_size);
+            for(auto i = 0ul; i < tl.extents[1]; i += 4) {
+                std::memcpy(tmp.data(), tl.data + i * row_size, 4 * row_size);
+                ggml_repack_q4_0x4(tmp.data(), tl.data + i * row_size, 4, n_per_row);
+            }
+        }
+
+        auto has_tensors_to_repack() const noexcept -> bool {
+            return std::any_of(tensors_map.tensors.begin(), tensors_map.tensors.end(), [](auto const& tl) { return tl.repack; });
+        }
+
+        // Returns the repack cache if it has every tensor to repack, otherwise they are repacked while loading
+        auto open_repack_cache() -> std::unique_ptr<RepackCache> {
+            if (!has_tensors_to_repack()) return nullptr;
+
+            auto cache = std::make_unique<RepackCache>(repack_cache_path);
+            if (!cache->open(RepackCache::make_stamp(file_loaders))) {
+                logger->log(__func__, "no repacked weights in '", repack_cache_path, "'; repacking while loading\n");
+                return nullptr;
+            }
+
+            for(auto const& tl : tensors_map.tensors) {
+                if (tl.repack && !cache->has(tl)) {
+                    logger->log(__func__, "'", repack_cache_path, "' does not have '", tl.name, "'; repacking while loading\n");
+                    return nullptr;
+                }
+            }
+
+            logger->log(__func__, "reading the repacked weights from '", repack_cache_path, "'\n");
+            return cache;
+        }
+
+        void write_repack_cache() {
+            if (!has_tensors_to_repack()) return;
+
+            if (!RepackCache::write(repack_cache_path, RepackCache::make_stamp(file_loaders), tensors_map)) {
+                logger->log_warn(__func__, "failed to write the repacked weights to '", repack_cache_path, "'\n");
+                return;
+            }
+            logger->log(__func__, "wrote the repacked weights to '", repack_cache_path, "'\n");
         }
 
         void load_lora_adapter_for(TensorLoader& tl) {
@@ -183,6 +183,7 @@ extern "C" {
 #define GGML_MAX_CONTEXTS      64
 #define GGML_MAX_OPT           4
 #define GGML_DEFAULT_N_THREADS 4
+#define GGML_DEFAULT_N_SPIN    65536
 
 #ifdef __ARM_NEON
 // we use the built-in 16-bit float type
@@ -207,6 +208,8 @@ enum ggml_type {
     GGML_TYPE_Q4_2 = 4,
     GGML_TYPE_Q4_3 = 5,
     GGML_TYPE_Q8_0 = 6,
+    GGML_TYPE_Q5_0 = 7,
+    GGML_TYPE_Q4_0X4 = 8, // q4_0 with the blocks of 4 rows interleaved, see ggml_repack_q4_0x4
     GGML_TYPE_I8,
     GGML_TYPE_I16,
     GGML_TYPE_I32,
@@ -236,8 +239,10 @@ enum ggml_op {
     GGML_OP_SILU,
     GGML_OP_NORM, // normalize
     GGML_OP_RMS_NORM,
+    GGML_OP_RMS_NORM_MUL,
 
     GGML_OP_MUL_MAT,
+    GGML_OP_MUL_MAT_SWIGLU,
 
     GGML_OP_SCALE,
     GGML_OP_CPY,
@@ -259,6 +264,8 @@ enum ggml_op {
     GGML_OP_MAP_UNARY,
     GGML_OP_MAP_BINARY,
 
+    GGML_OP_CALLBACK,
+
     GGML_OP_COUNT,
 };
 
@@ -366,6 +373,12 @@ bool ggml_is_quantized(enum ggml_type type);
 struct ggml_context * ggml_init(struct ggml_init_params params);
 void ggml_free(struct ggml_context * ctx);
 
+// a context for measuring a graph: its tensors get no data, and ggml_used_mem() counts the memory the graph would take
+// in a context from ggml_init(), including the work buffer reserved with ggml_graph_alloc_work()
+// a scratch buffer set with a size but no data measures the scratch memory: ggml_set_scratch() returns its offset
+// mem_size only needs to hold the tensor objects and the parameters of the ops
+struct ggml_context * ggml_init_measure(size_t mem_size);
+
 size_t ggml_used_mem(const struct ggml_context * ctx);
 
 size_t ggml_set_scratch(struct ggml_context * ctx, struct ggml_scratch scratch);
@@ -520,6 +533,12 @@ struct ggml_tensor * ggml_rms_norm(
         struct ggml_context * ctx,
         struct ggml_tensor  * a);
 
+// rms_norm(a) scaled by the vector b along the rows, in one pass
+struct ggml_tensor * ggml_rms_norm_mul(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b);
+
 // A: m rows, n columns
 // B: p rows, n columns (i.e. we transpose it internally)
 // result is m columns, p rows
@@ -528,6 +547,15 @@ struct ggml_tensor * ggml_mul_mat(
         struct ggml_tensor  * a,
         struct ggml_tensor  * b);
 
+// silu(a*c) * (b*c), the gated feed-forward of LLaMA
+// a and b: matrices of the same shape and type, c: F32 matrix
+// the products are gated per tile of rows, without storing them
+struct ggml_tensor * ggml_mul_mat_swiglu(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c);
+
 //
 // operations on tensors without backpropagation
 //
@@ -640,6 +668,20 @@ struct ggml_tensor * ggml_rope(
         int                   n_dims,
         int                   mode);
 
+// ggml_rope with the cos and sin read from a table filled by ggml_rope_table,
+// which needs a row for every position of a
+struct ggml_tensor * ggml_rope_cached(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        int                   n_past,
+        int                   n_dims,
+        int                   mode,
+        struct ggml_tensor  * table);
+
+// fills the F32 table [n_dims, n_pos] with the interleaved cos and sin of the RoPE angles of
+// the dimension pairs of positions 0 .. n_pos - 1
+void ggml_rope_table(struct ggml_tensor * table);
+
 // padding = 1
 // TODO: we don't support extra parameters for now
 //       that's why we are hard-coding the stride, padding, and dilation
@@ -654,6 +696,10 @@ struct ggml_tensor * ggml_conv_1d_2s(
         struct ggml_tensor  * a,
         struct ggml_tensor  * b);
 
+// soft_max(k*q/sqrt(D))*v without the score matrix
+// q: [D, N, H], k: [D, M, H], v: [M, D, H] (transposed), result: [D, N, H]
+// with F32 q, k can be F32, F16 or Q8_0 and v F32 or F16
+// if masked, query i only attends to the first M - N + i + 1 keys
 struct ggml_tensor * ggml_flash_attn(
         struct ggml_context * ctx,
         struct ggml_tensor  * q,
@@ -684,6 +730,17 @@ struct ggml_tensor * ggml_map_binary_f32(
         struct ggml_tensor          * b,
         const  ggml_binary_op_f32_t fun);
 
+// calls fun(userdata) once, on a single thread, when the node is computed
+// the result is a view of a, so the nodes that use it are computed after the call
+// meant for side effects outside of the graph, such as paging in the weights of the next nodes
+typedef void (*ggml_callback_t)(void *);
+
+struct ggml_tensor * ggml_callback(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        ggml_callback_t       fun,
+        void                * userdata);
+
 //
 // automatic differentiation
 //
@@ -700,6 +757,47 @@ struct ggml_cgraph ggml_build_backward(struct ggml_context * ctx, struct ggml_cg
 void ggml_graph_compute(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
 void ggml_graph_reset  (struct ggml_cgraph * cgraph);
 
+// allocates the work buffer of the graph in ctx for the current shapes of its nodes
+// a graph that is computed many times with patched shapes can reserve the buffer for its largest shape up front
+void ggml_graph_alloc_work(struct ggml_context * ctx, struct ggml_cgraph * cgraph);
+
+// long-lived worker threads that are reused by every ggml_graph_compute_with_pool() call
+// a pool can only compute one graph at a time
+// at the barriers between the graph nodes, a waiting thread spins for n_spin iterations before it goes to sleep
+// (n_spin < 0 never sleeps, 0 sleeps right away)
+struct ggml_threadpool;
+
+struct ggml_threadpool * ggml_threadpool_new (int n_threads, int n_spin);
+void                     ggml_threadpool_free(struct ggml_threadpool * pool);
+
+int ggml_threadpool_n_threads(const struct ggml_threadpool * pool);
+
+// same as ggml_graph_compute(), but the graph runs on the parked workers of the pool
+// cgraph->n_threads is clamped to the size of the pool; if pool is NULL, it falls back to ggml_graph_compute()
+void ggml_graph_compute_with_pool(struct ggml_context * ctx, struct ggml_cgraph * cgraph, struct ggml_threadpool * pool);
+
+// NUMA
+// once enabled, the workers of every ggml_threadpool are split between the nodes in contiguous blocks (the first
+// threads on node 0, the next ones on node 1, ...) and pinned to the cpus of their node; the thread that submits
+// a graph runs on node 0 while the graph is computed
+enum ggml_numa_strategy {
+    GGML_NUMA_DISABLED   = 0,
+    GGML_NUMA_INTERLEAVE = 1, // the pages of the weights go round-robin over the nodes
+    GGML_NUMA_PARTITION  = 2, // the rows of each matrix are split between the nodes, and the threads of a node multiply the rows on it
+};
+
+// discovers the nodes with cpus this process may run on and selects the strategy for the whole process
+// returns false and leaves NUMA disabled if there is a single node or the platform is not supported
+bool ggml_numa_init(enum ggml_numa_strategy strategy);
+
+// number of nodes in use; 1 when NUMA is disabled
+int ggml_numa_n_nodes(void);
+
+// binds the pages of the tensor data to the nodes given by the strategy, moving the pages that are already in memory
+// with GGML_NUMA_PARTITION, the rows of node k of a matrix are the ones the threads of node k multiply when the
+// number of threads is a multiple of the number of nodes; vectors are interleaved
+bool ggml_numa_place(const struct ggml_tensor * tensor);
+
 // print info and performance information for the graph
 void ggml_graph_print(const struct ggml_cgraph * cgraph);
 
@@ -813,9 +911,16 @@ size_t ggml_quantize_q4_0(const float * src, void * dst, int n, int k, int64_t *
 size_t ggml_quantize_q4_1(const float * src, void * dst, int n, int k, int64_t * hist);
 size_t ggml_quantize_q4_2(const float * src, void * dst, int n, int k, int64_t * hist);
 size_t ggml_quantize_q4_3(const float * src, void * dst, int n, int k, int64_t * hist);
+size_t ggml_quantize_q5_0(const float * src, void * dst, int n, int k, int64_t * hist);
+size_t ggml_quantize_q8_0(const float * src, void * dst, int n, int k, int64_t * hist);
 
 size_t ggml_quantize_chunk(enum ggml_type type, const float * src, void * dst, int start, int n, int64_t * hist);
 
+// Interleaves the blocks of every 4 consecutive q4_0 rows of k elements into q4_0x4 blocks of the same size, so
+// that the matrix products unpack and multiply 4 rows at a time. nrows must be a multiple of 4 and src and dst
+// must not overlap. A q4_0x4 tensor can only be src0 of mul_mat and mul_mat_swiglu.
+void ggml_repack_q4_0x4(const void * src, void * dst, int nrows, int k);
+
 //
 // system info
 //
@@ -836,6 +941,9 @@ int ggml_cpu_has_cublas(void);
 int ggml_cpu_has_sse3(void);
 int ggml_cpu_has_vsx(void);
 
+// name of the kernel variant ggml_init selected for this CPU: base, sse4, avx2 or avx512
+const char * ggml_cpu_kernels(void);
+
 
 //
 // Internal types and functions exposed for tests and benchmarks
@@ -9,6 +9,9 @@
 #include <thread>
 #include <unordered_map>
 #include <algorithm>
+#include <utility>
+#include <limits>
+#include <mutex>
 #include "logger.hpp"
 #include "span.hpp"
 #include "file_writer.hpp"
@@ -16,6 +19,7 @@
 #include "file_reader.hpp"
 #include "uninitialized_buffer.hpp"
 #include "tensor/mem_context.hpp"
+#include "tensor/compute_pool.hpp"
 #include "tensor/utils.hpp"
 
 namespace fastllama {
@@ -28,6 +32,8 @@ namespace fastllama {
         MOSTLY_Q4_1_SOME_F16 = 4, // tok_embeddings.weight and output.weight are F16
         MOSTLY_Q4_2 = 5,  // except 1d tensors
         MOSTLY_Q4_3 = 6,  // except 1d tensors
+        MOSTLY_Q8_0 = 7,  // except 1d tensors
+        MOSTLY_Q5_0 = 8,  // except 1d tensors
         SIZE
     };
 
@@ -66,6 +72,32 @@ namespace fastllama {
         ggml_tensor * w3;
     };
 
+    // Pages the weights of the layers of a mapped model in and out while it is evaluated, so that a model larger
+    // than the memory runs at the speed of the disk instead of thrashing. The eval graph calls `on_layer_start`
+    // before each layer, which asks for the layer `n_prefetch` ahead (wrapping around to the first layers of the
+    // next eval) and drops the previous one.
+    struct LayerPager {
+        struct Hint {
+            LayerPager const*   pager;
+            std::size_t         layer;
+        };
+
+        LayerPager(MMappedFile const* mapping, std::vector<Layer> layers, std::size_t n_prefetch);
+        LayerPager(LayerPager const&) = delete;
+        LayerPager& operator=(LayerPager const&) = delete;
+
+        static void on_layer_start(void* hint) noexcept;
+
+        // Asks for the weights of the layer to be read in, or lets them go
+        void page_in(std::size_t il) const noexcept;
+        void page_out(std::size_t il) const noexcept;
+
+        MMappedFile const*  mapping;
+        std::vector<Layer>  layers;
+        std::vector<Hint>   hints;
+        std::size_t         n_prefetch;
+    };
+
     struct LoraAdapterParams {
         std::uint32_t r{1};
         std::uint32_t alpha{1};
@@ -108,12 +140,34 @@ namespace fastllama {
         bool save_state(BinaryFileWriter& writer, Logger const& logger) const noexcept;
         bool load_state(BinaryFileReader& reader, Logger const& logger) noexcept;
 
+        // Drops the tokens at positions [n_keep, n_keep + n_discard) and moves the following tokens up to `n_past`
+        // down by `n_discard` positions. The moved keys are rotated back by `n_discard` positions.
+        bool shift(HyperParams const& params, std::size_t n_keep, std::size_t n_discard, std::size_t n_past, int n_threads, Logger const& logger);
+
+        // Size of the keys and values of the first `n_tokens` positions when they are packed by `copy_prefix_to`:
+        // the keys of every layer followed by the values of every layer, `n_tokens` positions each.
+        std::size_t prefix_size(HyperParams const& params, std::size_t n_tokens) const noexcept;
+        void copy_prefix_to(HyperParams const& params, std::size_t n_tokens, char* dst) const noexcept;
+        // Fills the first `n_tokens` positions from a buffer packed with `src_tokens >= n_tokens` positions.
+        void copy_prefix_from(HyperParams const& params, std::size_t n_tokens, char const* src, std::size_t src_tokens) noexcept;
+
+        // F32, F16 or Q8_0. Values of a Q8_0 cache are kept in F16: they are stored transposed,
+        // so every new token writes a single element of each row and cannot fill whole blocks.
         ggml_type memory_type{ GGML_TYPE_F32 };
 
+        constexpr ggml_type key_type() const noexcept { return memory_type; }
+        constexpr ggml_type value_type() const noexcept { return memory_type == GGML_TYPE_Q8_0 ? GGML_TYPE_F16 : memory_type; }
+
+        // Page size asked for the memory; see `HugePages`
+        HugePages huge_pages{ HugePages::None };
+
         // key + value memory
         ggml_tensor * k;
         ggml_tensor * v;
 
+        // cos and sin of the RoPE angles of every position, [n_embd/n_head, n_ctx]; see `ggml_rope_table`
+        ggml_tensor * rope;
+
         MemContext ctx;
 
         UninitializedBuffer buffer;
@@ -121,63 +175,203 @@ namespace fastllama {
         std::size_t number_of_tokens_in_cache{};
     };
 
+    // Keys and values of recently evaluated prompts. A session that starts with a cached prefix copies its
+    // memory instead of evaluating it, since the memory of the tokens at the start of the context depends only
+    // on those tokens. It is shared by the sessions of a model; the capacity is in tokens and zero disables it.
+    struct PrefixCache {
+        using token_id_t = typename Vocab::id_type;
+
+        // Copies the longest cached prefix of `tokens` into `kv` and returns its length.
+        std::size_t restore(HyperParams const& params, Span<token_id_t> tokens, KVCacheBuffer& kv);
+        // Stores the first `tokens.size()` positions of `kv`, which hold the memory of `tokens`.
+        void store(HyperParams const& params, Span<token_id_t> tokens, KVCacheBuffer const& kv);
+        void clear();
+
+        void set_capacity(std::size_t n_tokens);
+        std::size_t capacity() const;
+        bool enabled() const { return capacity() != 0; }
+
+    private:
+        struct Entry {
+            std::vector<token_id_t> tokens;
+            ggml_type               memory_type;
+            std::vector<char>       data;
+            std::uint64_t           last_used;
+        };
+
+        void evict(std::size_t n_tokens);
+
+    private:
+        mutable std::mutex  m_mutex;
+        std::vector<Entry>  m_entries;
+        std::size_t         m_capacity{};
+        std::size_t         m_size{};       // tokens held by the entries
+        std::uint64_t       m_clock{};
+    };
+
+    // Nodes of the single token graph that depend on `n_past`
+    struct DecodeLayerNodes {
+        ggml_tensor* q_rope;
+        ggml_tensor* k_rope;
+        ggml_tensor* k_store;
+        ggml_tensor* k_store_cpy;
+        ggml_tensor* v_store;
+        ggml_tensor* v_store_cpy;
+        ggml_tensor* k_view;
+        ggml_tensor* k_reshape;
+        ggml_tensor* k;
+        ggml_tensor* kq;
+        ggml_tensor* kq_scaled;
+        ggml_tensor* kq_masked;
+        ggml_tensor* kq_soft_max;  // nullptr with flash attention
+        ggml_tensor* v;
+    };
+
+    // Graph for single token evaluation. It is built once for the largest `n_past`, so its tensors and
+    // work buffer are big enough for every position, and before each decode step only the KV cache views,
+    // the RoPE positions and the attention shapes are patched.
+    struct DecodeGraph {
+        DecodeGraph() noexcept = default;
+        DecodeGraph(DecodeGraph const&) = delete;
+        DecodeGraph(DecodeGraph&& other) noexcept
+            : buffer(std::move(other.buffer))
+            , ctx(std::exchange(other.ctx, nullptr))
+            , graph(other.graph)
+            , embd(other.embd)
+            , logits(other.logits)
+            , embeddings(other.embeddings)
+            , layers(std::move(other.layers))
+            , n_threads(other.n_threads)
+            , is_valid(std::exchange(other.is_valid, false))
+        {}
+        DecodeGraph& operator=(DecodeGraph const&) = delete;
+        DecodeGraph& operator=(DecodeGraph&& other) noexcept {
+            if (this == &other) return *this;
+            free();
+            buffer = std::move(other.buffer);
+            ctx = std::exchange(other.ctx, nullptr);
+            graph = other.graph;
+            embd = other.embd;
+            logits = other.logits;
+            embeddings = other.embeddings;
+            layers = std::move(other.layers);
+            n_threads = other.n_threads;
+            is_valid = std::exchange(other.is_valid, false);
+            return *this;
+        }
+
+        void free() noexcept {
+            if (ctx) ggml_free(ctx);
+            ctx = nullptr;
+            buffer.free();
+            layers.clear();
+            is_valid = false;
+        }
+
+        ~DecodeGraph() noexcept {
+            free();
+        }
+
+        UninitializedBuffer buffer;
+        ggml_context* ctx{nullptr};
+        ggml_cgraph graph{};
+
+        ggml_tensor* embd{nullptr};
+        ggml_tensor* logits{nullptr};
+        ggml_tensor* embeddings{nullptr};
+
+        std::vector<DecodeLayerNodes> layers;
+
+        int n_threads{};
+        bool is_valid{false};
+    };
+
+    struct ModelState;
+
+    // Sizes of the eval buffers of a session, measured by building its largest eval graphs without computing them
+    struct EvalMemoryPlan {
+        std::size_t                 compute{};  // graph objects, the tensors outside of the scratch buffers and the work buffer
+        std::vector<std::size_t>    scratch{};  // peak use of each scratch buffer
+    };
+
+    // Tokens of one sequence in an eval graph: `n_tokens` consecutive tokens of the graph input are
+    // evaluated at positions [n_past, n_past + n_tokens) against the key/value memory `kv`.
+    struct GraphSequence {
+        KVCacheBuffer*  kv;
+        std::int64_t    n_past;
+        std::int64_t    n_tokens;
+    };
+
+    // Weights of a loaded model. They are not modified by an eval, so a single model can be shared by
+    // any number of sessions; everything that changes while evaluating lives in `ModelState`.
     struct Model {
         using vocab_id = typename Vocab::id_type;
 
         static constexpr std::size_t max_number_of_scratch_buffer = 16;
-    #ifdef LLAMA_USE_SCRATCH
-        static constexpr bool use_scratch_buffer = true;
-    #else
+    #ifdef LLAMA_NO_SCRATCH
         static constexpr bool use_scratch_buffer = false;
+    #else
+        static constexpr bool use_scratch_buffer = true;
     #endif
 
+        // One sequence of `eval_batch`
+        struct BatchSequence {
+            ModelState*         state;      // key/value memory of the sequence
+            std::size_t         n_past;
+            Span<vocab_id>      tokens;
+            std::vector<float>* logits;     // logits of the last token, or of every token if `state->should_put_all_logits`
+        };
+
         bool load(std::string_view filepath);
         auto unload() -> void;
         auto eval(
+            ModelState&                     state,
             std::size_t                     n_past,
             Span<vocab_id>                  embd_inp,
             std::vector<float>&             embd_w,
             std::size_t&                    mem_per_token
-        ) -> bool;
+        ) const -> bool;
+
+        // Evaluates the tokens of several independent sequences in one forward pass, so the weights are read
+        // once for all of them. Every sequence attends only to its own key/value memory. The graph is evaluated
+        // with the buffers and threads of `state`, which are planned for up to `state.n_batch` tokens in up to
+        // `state.n_max_sequences` sequences.
+        auto eval_batch(
+            ModelState&                     state,
+            Span<BatchSequence>             seqs
+        ) const -> bool;
+
+        // Adds the eval graph of the tokens in `embd` to `gf` and returns the logits and the embeddings.
+        // The tokens of `seqs` follow each other in `embd`.
+        // If `decode` is not null, the nodes that depend on `n_past` are recorded in it.
+        auto build_graph(
+            ModelState&                     state,
+            ggml_context*                   ctx0,
+            ggml_cgraph&                    gf,
+            Span<GraphSequence>             seqs,
+            ggml_tensor*                    embd,
+            bool                            use_scratch,
+            DecodeGraph*                    decode = nullptr
+        ) const -> std::pair<ggml_tensor*, ggml_tensor*>;
+
+        bool init_decode_graph(ModelState& state) const;
+
+        // Measures the eval buffers `state` needs for evals of up to `state.n_batch` tokens, split over up to
+        // `state.n_max_sequences` sequences, at any position of the context. Nothing is computed or allocated
+        // but the graph objects, and the scratch buffers are reused by the layers as in a real eval.
+        bool plan_eval_memory(ModelState& state, EvalMemoryPlan& plan) const;
+        void set_decode_graph_past(ModelState& state, std::size_t n_past) const noexcept;
 
         auto set_threads(int in_threads) noexcept {
             this->threads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), in_threads));
         }
 
+        constexpr HugePages huge_pages() const noexcept { return use_huge_pages ? HugePages::Explicit : HugePages::None; }
+
         bool dump_vocab(std::string_view filepath);
         bool attach_lora(std::string_view filepath);
         bool detach_lora();
 
-        void use_buf([[maybe_unused]] ggml_context* in_ctx, [[maybe_unused]] int i) {
-            if constexpr (use_scratch_buffer) {
-                auto last_size = std::size_t{};
-
-                if (i == -1) {
-                    last_size = ggml_set_scratch(in_ctx, { 0, 0, nullptr });
-                } else {
-                    auto& buff = buf_scratch[i];
-                    last_size = ggml_set_scratch(in_ctx, { 0, buff.size(), buff.data() });
-                }
-
-                if (last_size > 0) buf_max_size[buf_last] = std::max(buf_max_size[buf_last], last_size);
-                
-                buf_last = i;
-            }
-        }
-
-        std::size_t get_buf_max_mem(int i) {
-            if constexpr(use_scratch_buffer) {
-                return buf_max_size[i];
-            } else {
-                return 0;
-            }
-        }
-
-        bool save_state(BinaryFileWriter& writer) const noexcept;
-        bool load_state(BinaryFileReader& reader) noexcept;
-
-        bool reset() noexcept;
-
         Logger logger{};
 
         ModelId model_id{};
@@ -191,20 +385,10 @@ namespace fastllama {
         ggml_tensor * output;
 
         std::vector<Layer> layers;
-        std::vector<float> embeddings;
 
         MemContext ctx;
         UninitializedBuffer buffer;
 
-        KVCacheBuffer kv_self{};
-
-        UninitializedBuffer buf_compute;
-        UninitializedBuffer buf_scratch[max_number_of_scratch_buffer];
-
-        int    buf_last = 0;
-        std::size_t buf_max_size[max_number_of_scratch_buffer] = { 0 };
-        std::size_t allocate_extra_mem{};
-
         MemoryLock mlock_buffer;
         MemoryLock mlock_mmap;
 
@@ -216,24 +400,106 @@ namespace fastllama {
 
         TensorsMapping tensors;
 
+        PrefixCache prefix_cache;
+
         std::string attached_lora_path{};
 
         std::unordered_map<std::string, ggml_tensor*> tensor_by_name;
 
         std::unique_ptr<MMappedFile> mapping;
+        std::unique_ptr<LayerPager> layer_pager;
 
         bool            is_valid{false};
-        bool            embeddings_eval_enable{false};
-        bool            should_put_all_logits{false};
         bool            use_mmap{false};
         bool            use_mlock{false};
         bool            load_parallel{false};
-        int             threads{ static_cast<int>(std::thread::hardware_concurrency()) };
-        int             n_batch{64};
+        bool            repack_weights{false}; // Interleave the q4_0 matrices by 4 rows (q4_0x4) for faster matrix products
+        std::string     repack_cache_path{}; // Where the repacked weights are kept between loads; '<model>.repack' when empty
+        bool            use_direct_io{false}; // Read the weights around the page cache (O_DIRECT) when not using mmap
+        bool            use_layer_paging{false}; // Map the weights without reading them in and page them layer by layer while evaluating
+        std::uint32_t   n_prefetch_layers{1}; // Layers paged in ahead of the one being evaluated with `use_layer_paging`
+        bool            use_huge_pages{false}; // Back the weights, and the kv cache and eval buffers of every session, with huge pages
+        ggml_numa_strategy numa{GGML_NUMA_DISABLED}; // Spread the weights over the NUMA nodes and pin the compute threads to them; process wide once enabled
+        int             threads{ static_cast<int>(std::thread::hardware_concurrency()) }; // Threads for loading and LoRA adapters
         std::uint32_t   n_load_parallel_blocks{1}; // Block size for parallel loading
         FileVersion     file_version{ FileVersion::GGML };
     };
 
+    // State of a single session of a model: its key/value memory and the buffers, threads and
+    // cached graph used to evaluate it.
+    struct ModelState {
+        bool init(Model const& model);
+        // Allocates everything but the key/value memory, for a state that only evaluates batches of other states
+        bool init_eval_buffers(Model const& model);
+
+        auto set_threads(int in_threads) noexcept {
+            this->threads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), in_threads));
+        }
+
+        void use_buf([[maybe_unused]] ggml_context* in_ctx, [[maybe_unused]] int i) {
+            if constexpr (Model::use_scratch_buffer) {
+                auto last_size = std::size_t{};
+
+                if (i == -1) {
+                    last_size = ggml_set_scratch(in_ctx, { 0, 0, nullptr });
+                } else if (is_planning) {
+                    // the scratch buffers are not allocated yet; the measuring context only counts their use
+                    last_size = ggml_set_scratch(in_ctx, { 0, std::numeric_limits<std::size_t>::max(), nullptr });
+                } else {
+                    auto& buff = buf_scratch[i];
+                    last_size = ggml_set_scratch(in_ctx, { 0, buff.size(), buff.data() });
+                }
+
+                if (last_size > 0) buf_max_size[buf_last] = std::max(buf_max_size[buf_last], last_size);
+                
+                buf_last = i;
+            }
+        }
+
+        std::size_t get_buf_max_mem(int i) {
+            if constexpr(Model::use_scratch_buffer) {
+                return buf_max_size[i];
+            } else {
+                return 0;
+            }
+        }
+
+        bool save_state(BinaryFileWriter& writer, Logger const& logger) const noexcept;
+        bool load_state(BinaryFileReader& reader, Logger const& logger) noexcept;
+
+        // Frees space in the context by discarding `n_discard` cached tokens after the first `n_keep` tokens,
+        // so the tokens after them can be kept without being evaluated again.
+        bool shift_kv_cache(HyperParams const& params, std::size_t n_keep, std::size_t n_discard, std::size_t n_past, Logger const& logger) noexcept;
+
+        bool reset() noexcept;
+
+        KVCacheBuffer kv_self{};
+
+        std::vector<float> embeddings;
+
+        UninitializedBuffer buf_compute;
+        UninitializedBuffer buf_scratch[Model::max_number_of_scratch_buffer];
+
+        // Worker threads shared by every graph evaluation of this session
+        ComputePool compute_pool;
+
+        // Cached graph for evaluating a single token
+        DecodeGraph decode_graph;
+
+        int    buf_last = 0;
+        std::size_t buf_max_size[Model::max_number_of_scratch_buffer] = { 0 };
+        std::size_t allocate_extra_mem{};
+        bool        is_planning{false}; // the eval graph is built in a measuring context by `Model::plan_eval_memory`
+
+        bool            embeddings_eval_enable{false};
+        bool            should_put_all_logits{false};
+        bool            use_flash_attn{false}; // attention in one fused op that reads the key/value memory in tiles
+        int             threads{ static_cast<int>(std::thread::hardware_concurrency()) };
+        int             n_batch{64};
+        std::size_t     n_max_sequences{1}; // Sequences of the batches evaluated with this state by `Model::eval_batch`
+        int             n_spin{GGML_DEFAULT_N_SPIN}; // Spin iterations of a compute thread before it sleeps at a barrier
+    };
+
     bool quantize(std::string_view in_filepath, std::string_view out_filepath, FType ftype, int threads);
 
     constexpr std::string_view to_string_view(FType ftype) noexcept {
@@ -244,6 +510,8 @@ namespace fastllama {
             case fastllama::FType::MOSTLY_Q4_1: return "mostly Q4_1";
             case fastllama::FType::MOSTLY_Q4_2: return "mostly Q4_2";
             case fastllama::FType::MOSTLY_Q4_3: return "mostly Q4_3";
+            case fastllama::FType::MOSTLY_Q8_0: return "mostly Q8_0";
+            case fastllama::FType::MOSTLY_Q5_0: return "mostly Q5_0";
             case fastllama::FType::MOSTLY_Q4_1_SOME_F16: return "mostly Q4_1, some F16";
             default: return "unknown, may not work";
         }
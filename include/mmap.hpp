@@ -4,6 +4,7 @@
 #include "macro.hpp"
 #include "utils.hpp"
 #include "file_reader.hpp"
+#include <algorithm>
 
 #ifdef __has_include
     #if __has_include(<unistd.h>)
@@ -33,13 +34,13 @@ namespace fastllama {
     #ifdef _POSIX_MAPPED_FILES
         static constexpr bool SUPPORTED = true;
 
-        MMappedFile(BinaryFileReader const* file, bool prefetch = true) noexcept
+        MMappedFile(BinaryFileReader const* file, bool prefetch = true, [[maybe_unused]] bool huge_pages = false) noexcept
             : m_size(file->size())
         {
             int fd = fileno(file->handle());
             int flags = MAP_SHARED;
             #if defined(__linux__)
-                flags |= MAP_POPULATE;
+                if (prefetch) flags |= MAP_POPULATE;
             #endif
 
             m_address = mmap(nullptr, m_size, PROT_READ, flags, fd, 0);
@@ -49,6 +50,12 @@ namespace fastllama {
                 return;
             }
 
+            #if defined(__linux__) && defined(MADV_HUGEPAGE)
+                // Only takes effect where the filesystem can back the page cache with huge pages (tmpfs with
+                // huge=advise, or read-only THP for regular files); a file on hugetlbfs is mapped on huge pages anyway.
+                if (huge_pages) madvise(m_address, m_size, MADV_HUGEPAGE);
+            #endif
+
             if (prefetch) {
                 // Advise the kernel to preload the mapped memory
                 if (madvise(m_address, m_size, MADV_WILLNEED) != 0) {
@@ -137,6 +144,41 @@ namespace fastllama {
             return static_cast<std::uint8_t*>(m_address) + offset;
         }
 
+        // Hints that the pages of [data, data + size) are needed soon, so that the kernel starts reading them in
+        void advise_will_need(void const* data, std::size_t size) const noexcept {
+        #ifdef _POSIX_MAPPED_FILES
+            advise(data, size, MADV_WILLNEED);
+        #else
+            (void)data; (void)size;
+        #endif
+        }
+
+        // Hints that the pages of [data, data + size) are not needed for a while; they are dropped from the mapping
+        // and read from the file again on the next access
+        void advise_dont_need(void const* data, std::size_t size) const noexcept {
+        #ifdef _POSIX_MAPPED_FILES
+            advise(data, size, MADV_DONTNEED);
+        #else
+            (void)data; (void)size;
+        #endif
+        }
+
+    private:
+    #ifdef _POSIX_MAPPED_FILES
+        // Advises the whole pages of the range that are in the mapping; anything outside of it is left alone
+        void advise(void const* data, std::size_t size, int advice) const noexcept {
+            auto const page_size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+            auto const begin = reinterpret_cast<std::uintptr_t>(m_address);
+            auto const end = begin + m_size;
+
+            auto const first = std::max(reinterpret_cast<std::uintptr_t>(data) & ~(page_size - 1), begin);
+            auto const last = std::min(reinterpret_cast<std::uintptr_t>(data) + size, end);
+            if (first >= last) return;
+
+            madvise(reinterpret_cast<void*>(first), last - first, advice);
+        }
+    #endif
+
     private:
         void*       m_address{nullptr};
         std::size_t m_size{0};
@@ -11,58 +11,10 @@
 
 namespace fastllama {
 
-    struct ModelIdConfig {
-        using size_type = std::size_t;
-
-        size_type mem_required_for_scratch_buff_0{};
-        size_type mem_required_for_scratch_buff_1{};
-        size_type mem_required_for_kv_self_buff{};
-        size_type mem_required_for_eval{};
-    };
-
     namespace detail {
-        using namespace ::fastllama::literals;
-        
-        using model_lookup_table_t = std::pair<std::string_view, ModelIdConfig>;
-        
-        inline static constexpr model_lookup_table_t g_models[] = {
-            model_lookup_table_t(
-                "7B",
-                ModelIdConfig {
-                    /* mem_required_for_scratch_buff_0 =    */ 512_MiB,
-                    /* mem_required_for_scratch_buff_1 =    */ 512_MiB,
-                    /* mem_required_for_kv_self_buff =      */ 1026_MiB,
-                    /* mem_required_for_eval =              */ 768_MiB,
-                }
-            ),
-            model_lookup_table_t(
-                "13B",
-                ModelIdConfig {
-                    /* mem_required_for_scratch_buff_0 =    */ 512_MiB,
-                    /* mem_required_for_scratch_buff_1 =    */ 512_MiB,
-                    /* mem_required_for_kv_self_buff =      */ 1608_MiB,
-                    /* mem_required_for_eval =              */ 1024_MiB,
-                }
-            ),
-            model_lookup_table_t(
-                "30B",
-                ModelIdConfig {
-                    /* mem_required_for_scratch_buff_0 =    */ 512_MiB,
-                    /* mem_required_for_scratch_buff_1 =    */ 512_MiB,
-                    /* mem_required_for_kv_self_buff =      */ 3124_MiB,
-                    /* mem_required_for_eval =              */ 1280_MiB,
-                }
-            ),
-            model_lookup_table_t(
-                "65B",
-                ModelIdConfig {
-                    /* mem_required_for_scratch_buff_0 =    */ 512_MiB,
-                    /* mem_required_for_scratch_buff_1 =    */ 512_MiB,
-                    /* mem_required_for_kv_self_buff =      */ 5120_MiB,
-                    /* mem_required_for_eval =              */ 1536_MiB,
-                }
-            ),
-        };
+        // Names of the known model sizes. They are only informative: the eval buffers of a session are planned
+        // from the hyperparameters of the model, see `Model::plan_eval_memory`.
+        inline static constexpr std::string_view g_models[] = { "7B", "13B", "30B", "65B" };
         inline static constexpr auto g_models_size_v = sizeof(detail::g_models) / sizeof(detail::g_models[0]);
     } // namespace detail
 
@@ -84,7 +36,7 @@ namespace fastllama {
             std::size_t i = 0ul;
             auto temp_name = std::string_view(name);
             for(auto const& m : g_models) {
-                if (m.first == temp_name) return i;
+                if (m == temp_name) return i;
                 ++i;
             }
             return i;
@@ -118,7 +70,6 @@ namespace fastllama {
 
 
         id_t id{};
-        ModelIdConfig config{};
         
         // Assumption 1: ModelId is a singleton
         // Assumption 2: It cannot be constructed outside this translation unit
@@ -143,16 +94,14 @@ namespace fastllama {
 
         constexpr static auto from_str_case_sensitive(std::string_view model_id) noexcept -> ModelId {
             for (auto const& model : detail::g_models) {
-                auto const el = model.first;
-                if (el == model_id) return ModelId{ model.first, model.second };
+                if (model == model_id) return ModelId{ model };
             }
             return ModelId{};
         }
         
         constexpr static auto from_str_case_insensitive(std::string_view model_id) noexcept -> ModelId {
             for (auto const& model : detail::g_models) {
-                auto const el = model.first;
-                if (detail::match_case_insensitive_str(el, model_id)) return ModelId{ model.first, model.second };
+                if (detail::match_case_insensitive_str(model, model_id)) return ModelId{ model };
             }
             return ModelId{};
         }
@@ -0,0 +1,145 @@
+#if !defined(FAST_LLAMA_SCHEDULER_HPP)
+#define FAST_LLAMA_SCHEDULER_HPP
+
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+#include "llama.hpp"
+#include "ring_buffer.hpp"
+#include "token_buffer.hpp"
+
+namespace fastllama {
+
+    // Serves the generation requests of many clients from one loaded model. Requests are admitted into the
+    // running batch at token boundaries, every step evaluates the next tokens of all the active requests in a
+    // single forward pass, and finished requests leave the batch right away. The steps run on a worker thread
+    // of the scheduler, which also invokes the callbacks of the requests.
+    struct Scheduler {
+        using token_id_t = typename Vocab::id_type;
+        using request_id_t = std::int64_t;
+
+        static constexpr token_id_t EOS = 2;
+
+        // How a request left the scheduler
+        enum class Status {
+            Done,           // generated its tokens, or stopped at EOS or a stop word
+            Failed,         // the prompt is too long, the evaluation failed or the scheduler stopped
+            Cancelled,
+            OutOfMemory,    // the context cannot hold the kept tokens and the next one, or no key/value memory is left
+        };
+
+        struct Params {
+            std::size_t     max_sequences{8};   // requests evaluated together; the others wait for a free slot
+            int             n_batch{64};        // tokens evaluated per step; prompts are ingested in chunks that fit
+            int             n_threads{1};
+            int             n_spin{GGML_DEFAULT_N_SPIN};
+            int             n_keep{64};         // tokens kept at the start of a request when its context is full
+            std::size_t     last_n_tokens{64};  // tokens considered by the repetition penalty
+            ggml_type       kv_cache_type{GGML_TYPE_F32}; // F32, F16 or Q8_0
+            bool            use_flash_attn{false};
+
+            constexpr Params& set_max_sequences(std::size_t n) noexcept { this->max_sequences = n; return *this; }
+            constexpr Params& set_number_of_batches(int batches) noexcept { this->n_batch = batches; return *this; }
+            constexpr Params& set_number_of_threads(int threads) noexcept { this->n_threads = threads; return *this; }
+            constexpr Params& set_spin_count(int count) noexcept { this->n_spin = count; return *this; }
+            constexpr Params& set_number_of_tokens_to_keep(int keep) noexcept { this->n_keep = keep; return *this; }
+            constexpr Params& set_last_n_tokens(std::size_t n) noexcept { this->last_n_tokens = n; return *this; }
+            constexpr Params& set_kv_cache_type(ggml_type type) noexcept { this->kv_cache_type = type; return *this; }
+            constexpr Params& set_use_flash_attn(bool flag) noexcept { this->use_flash_attn = flag; return *this; }
+        };
+
+        struct Request {
+            std::string                                 prompt;
+            std::size_t                                 num_tokens{};
+            float                                       top_k{40};
+            float                                       top_p{0.95f};
+            float                                       temp{0.8f};
+            float                                       repeat_penalty{1.f};
+            int                                         seed{};
+            std::vector<std::string>                    stop_words;
+            std::function<void(std::string const&)>     on_token;
+            // Called once when the request leaves the scheduler
+            std::function<void(Status)>                 on_done;
+        };
+
+        // Returns `nullptr` if the model is invalid or the eval buffers cannot be allocated.
+        static std::unique_ptr<Scheduler> create(std::shared_ptr<Model> model, Params params);
+
+        Scheduler(Scheduler const&) = delete;
+        Scheduler(Scheduler &&) = delete;
+        Scheduler& operator=(Scheduler const&) = delete;
+        Scheduler& operator=(Scheduler &&) = delete;
+        // Stops the worker; the requests that did not finish are reported as failed.
+        ~Scheduler();
+
+        // Queues the request and returns its id, or -1 if the scheduler is stopping.
+        request_id_t submit(Request request);
+        // Removes a waiting request, or retires an active one at the next token boundary. Returns false if
+        // there is no such request or it already left the scheduler.
+        bool cancel(request_id_t id);
+
+        Logger const& get_logger() const noexcept { return m_model->logger; }
+
+    private:
+        struct Sequence {
+            using token_buffer_t = TokenBuffer<std::function<void(std::string)>>;
+
+            request_id_t                    id;
+            Request                         request;
+            std::unique_ptr<ModelState>     state;
+            std::vector<token_id_t>         prompt;     // kept for the prefix cache
+            std::size_t                     n_past{};
+            std::size_t                     n_generated{};
+            std::vector<token_id_t>         pending;
+            RingBuffer<token_id_t>          last_n_tokens;
+            std::mt19937                    rng;
+            std::vector<float>              logits;
+            std::unique_ptr<token_buffer_t> token_buffer;
+        };
+
+        Scheduler(std::shared_ptr<Model> model, Params params);
+
+        // A request joins the batch, goes back to the queue until memory is freed, or has already left
+        enum class Admission { Active, Deferred, Left };
+
+        void run();
+        bool step();
+        Admission activate(Sequence& seq);
+        bool make_room(Sequence& seq, std::size_t n_tokens);
+        void finish(Sequence& seq, Status status);
+        void leave(Sequence& seq, Status status);
+
+    private:
+        std::shared_ptr<Model>                      m_model;
+        Params                                      m_params;
+        ModelState                                  m_eval_state;
+
+        std::vector<std::unique_ptr<Sequence>>      m_active;
+        // States of retired requests, reused by the next ones
+        std::vector<std::unique_ptr<ModelState>>    m_free_states;
+        // Set when the key/value memory of a request could not be allocated; no request is admitted until
+        // another one leaves and frees its state
+        bool                                        m_is_waiting_for_memory{false};
+
+        std::mutex                                  m_mutex;
+        std::condition_variable                     m_cv;
+        std::deque<std::unique_ptr<Sequence>>       m_waiting;
+        // Ids of the admitted requests that did not leave yet, and the ones of them that are cancelled
+        std::unordered_set<request_id_t>            m_running;
+        std::unordered_set<request_id_t>            m_cancelled;
+        request_id_t                                m_next_id{};
+        bool                                        m_stop{false};
+
+        std::thread                                 m_worker;
+    };
+
+} // namespace fastllama
+
+#endif // FAST_LLAMA_SCHEDULER_HPP
@@ -0,0 +1,63 @@
+#if !defined(FAST_LLAMA_COMPUTE_POOL_HPP)
+#define FAST_LLAMA_COMPUTE_POOL_HPP
+
+#include "ggml.h"
+#include <utility>
+
+namespace fastllama {
+
+    // Owns the ggml worker threads that evaluate the compute graphs. The threads are
+    // created once and parked between graphs instead of being spawned on every eval.
+    struct ComputePool {
+
+        ComputePool() noexcept = default;
+
+        explicit ComputePool(int n_threads, int n_spin = GGML_DEFAULT_N_SPIN) noexcept
+            : pool(ggml_threadpool_new(n_threads, n_spin))
+        {}
+
+        ComputePool(ComputePool const&) = delete;
+        ComputePool(ComputePool&& other) noexcept
+            : pool(std::exchange(other.pool, nullptr))
+        {}
+        ComputePool& operator=(ComputePool const&) = delete;
+        ComputePool& operator=(ComputePool&& other) noexcept {
+            if (this == &other) return *this;
+            free();
+            pool = std::exchange(other.pool, nullptr);
+            return *this;
+        }
+
+        ~ComputePool() noexcept {
+            free();
+        }
+
+        void free() noexcept {
+            if (pool) ggml_threadpool_free(pool);
+            pool = nullptr;
+        }
+
+        void compute(ggml_context* ctx, ggml_cgraph& graph) noexcept {
+            ggml_graph_compute_with_pool(ctx, &graph, pool);
+        }
+
+        int size() const noexcept {
+            return ggml_threadpool_n_threads(pool);
+        }
+
+        constexpr auto get() const noexcept -> ggml_threadpool* {
+            return pool;
+        }
+
+        constexpr operator bool() const noexcept {
+            return pool != nullptr;
+        }
+
+    private:
+        ggml_threadpool* pool{nullptr};
+    };
+
+} // namespace fastllama
+
+
+#endif // FAST_LLAMA_COMPUTE_POOL_HPP
@@ -3,6 +3,7 @@
 
 #include "ggml.h"
 #include "uninitialized_buffer.hpp"
+#include <utility>
 
 namespace fastllama {
     
@@ -28,10 +29,21 @@ namespace fastllama {
         {}
 
         MemContext() = default;
-        MemContext(MemContext const&) = default;
-        MemContext(MemContext&&) noexcept = default;
-        MemContext& operator=(MemContext const&) = default;
-        MemContext& operator=(MemContext&&) noexcept = default;
+        MemContext(MemContext const&) = delete;
+        MemContext& operator=(MemContext const&) = delete;
+
+        // the context is freed once, by its last owner; ggml reuses the slot of a freed context for the next one
+        MemContext(MemContext&& other) noexcept
+            : ctx(std::exchange(other.ctx, nullptr))
+        {}
+
+        MemContext& operator=(MemContext&& other) noexcept {
+            if (this != &other) {
+                free();
+                ctx = std::exchange(other.ctx, nullptr);
+            }
+            return *this;
+        }
 
         void free() noexcept {
             if (ctx) ggml_free(ctx);
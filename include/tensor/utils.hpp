@@ -62,6 +62,7 @@ namespace fastllama {
         std::size_t                 size{0};
         ggml_tensor*                tensor{nullptr};
         std::uint8_t*               data{nullptr};
+        bool                        repack{false}; // q4_0 rows interleaved into q4_0x4 after loading
 
         TensorLoader(std::string_view name)
             : name(name)
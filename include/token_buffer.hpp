@@ -80,6 +80,10 @@ namespace fastllama {
             return std::make_tuple( false, std::string_view{}, std::string_view{} );
         }
 
+        bool empty() const noexcept {
+            return m_buffer.empty();
+        }
+
         void clear() {
             m_buffer.clear();
             m_num_of_chars_in_unicode_buffer = 0;
@@ -2,13 +2,47 @@
 #define FAST_LLAMA_UNINITIALIZED_BUFFER_HPP
 
 #include <memory>
+#include <cstdlib>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
 
 namespace fastllama {
 
+    // Page size backing a buffer. As a request, `Explicit` falls back to `Transparent` when no huge pages are
+    // reserved (vm.nr_hugepages), and `Transparent` to `None` when the kernel has no transparent huge pages.
+    enum class HugePages : std::uint8_t {
+        None,        // whatever the allocator gives, usually 4 KiB pages
+        Transparent, // 2 MiB aligned anonymous mapping advised with MADV_HUGEPAGE
+        Explicit,    // mapping from the huge page pool (MAP_HUGETLB)
+    };
+
+    constexpr std::string_view to_string_view(HugePages pages) noexcept {
+        switch(pages) {
+            case HugePages::None: return "4 KiB pages";
+            case HugePages::Transparent: return "transparent huge pages";
+            case HugePages::Explicit: return "explicit huge pages";
+        }
+        return "unknown";
+    }
+
     namespace detail {
         struct default_delete {
+            // Non-zero when the memory is a mapping of its own instead of a heap allocation
+            std::size_t mapped_size{0};
+
             void operator()(void* ptr) const { 
-                if (ptr) std::free(ptr);
+                if (!ptr) return;
+                #if defined(__linux__)
+                    if (mapped_size) {
+                        munmap(ptr, mapped_size);
+                        return;
+                    }
+                #endif
+                std::free(ptr);
             }
         };
     } // namespace detail
@@ -20,6 +54,7 @@ namespace fastllama {
         UninitializedBuffer(UninitializedBuffer&& other) noexcept
             : m_data(std::move(other.m_data))
             , m_size(std::move(other.m_size))
+            , m_huge_pages(other.m_huge_pages)
         {}
         UninitializedBuffer& operator=(UninitializedBuffer const& other) noexcept = delete;
         UninitializedBuffer& operator=(UninitializedBuffer&& other) noexcept = default;
@@ -33,9 +68,17 @@ namespace fastllama {
             allocate(size, alignment);
         }
 
+        // Allocates the buffer on huge pages if possible; see `HugePages`. Fewer pages mean fewer TLB misses
+        // when a large buffer is streamed through, which is what every weight, cache and compute buffer is.
+        void resize(std::size_t size, HugePages policy) {
+            if (policy == HugePages::None || !allocate_huge_pages(size, policy)) allocate(size, sizeof(max_align_t));
+        }
+
         std::uint8_t* data() noexcept { return m_data.get(); }
         std::uint8_t const* data() const noexcept { return m_data.get(); }
         constexpr std::size_t size() const noexcept { return m_size; }
+        // Page size the buffer got, which may be smaller than requested
+        constexpr HugePages huge_pages() const noexcept { return m_huge_pages; }
 
         operator bool() const noexcept { return m_data != nullptr; }
 
@@ -51,19 +94,68 @@ namespace fastllama {
         void free() noexcept {
             m_data.reset();
             m_size = 0;
+            m_huge_pages = HugePages::None;
         }
     
     private:
 
         void allocate(std::size_t size, std::size_t alignment) {
-            auto ptr = std::aligned_alloc(sizeof(max_align_t), size);
-            m_data.reset(static_cast<std::uint8_t*>(ptr));
+            // aligned_alloc takes a multiple of the alignment; the sizes of the planned eval buffers may not be one
+            constexpr auto align = sizeof(max_align_t);
+            auto ptr = std::aligned_alloc(align, (size + align - 1) / align * align);
+            m_data = decltype(m_data)(static_cast<std::uint8_t*>(ptr), detail::default_delete{});
+            m_size = size;
+            m_huge_pages = HugePages::None;
+        }
+
+        bool allocate_huge_pages([[maybe_unused]] std::size_t size, [[maybe_unused]] HugePages policy) {
+        #if defined(__linux__) && defined(MAP_HUGETLB) && defined(MADV_HUGEPAGE)
+            constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+            if (size == 0) return false;
+
+            auto const mapped_size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+            constexpr int prot = PROT_READ | PROT_WRITE;
+            constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+            m_data.reset();
+
+            if (policy == HugePages::Explicit) {
+                auto ptr = mmap(nullptr, mapped_size, prot, flags | MAP_HUGETLB, -1, 0);
+                if (ptr != MAP_FAILED) {
+                    m_data = decltype(m_data)(static_cast<std::uint8_t*>(ptr), detail::default_delete{ mapped_size });
+                    m_size = size;
+                    m_huge_pages = HugePages::Explicit;
+                    return true;
+                }
+            }
+
+            // Map an extra huge page and trim both ends so the buffer starts on a huge page boundary;
+            // the kernel only backs whole aligned 2 MiB ranges with a huge page.
+            auto ptr = mmap(nullptr, mapped_size + huge_page_size, prot, flags, -1, 0);
+            if (ptr == MAP_FAILED) return false;
+
+            auto const start = reinterpret_cast<std::uintptr_t>(ptr);
+            auto const aligned = (start + huge_page_size - 1) & ~static_cast<std::uintptr_t>(huge_page_size - 1);
+            if (aligned != start) munmap(ptr, aligned - start);
+            if (auto const tail = huge_page_size - (aligned - start); tail != 0) {
+                munmap(reinterpret_cast<void*>(aligned + mapped_size), tail);
+            }
+
+            auto const is_transparent = madvise(reinterpret_cast<void*>(aligned), mapped_size, MADV_HUGEPAGE) == 0;
+
+            m_data = decltype(m_data)(reinterpret_cast<std::uint8_t*>(aligned), detail::default_delete{ mapped_size });
             m_size = size;
+            m_huge_pages = is_transparent ? HugePages::Transparent : HugePages::None;
+            return true;
+        #else
+            return false;
+        #endif
         }
 
     private:
         std::unique_ptr<std::uint8_t, detail::default_delete>   m_data{nullptr};
         std::size_t                                             m_size{0};
+        HugePages                                               m_huge_pages{HugePages::None};
     };
 
 } // namespace fastllama
@@ -19,12 +19,34 @@ enum progress_type_tag : uint8_t {
     PROGRESS_TAG_DETACH_LORA_ADAPTER = 6,
 };
 
+enum kv_cache_type : uint8_t {
+    KV_CACHE_TYPE_F32  = 0,
+    KV_CACHE_TYPE_F16  = 1,
+    KV_CACHE_TYPE_Q8_0 = 2, // keys are stored as Q8_0 blocks, values as F16
+};
+
+enum numa_strategy : uint8_t {
+    NUMA_DISABLED   = 0,
+    NUMA_INTERLEAVE = 1, // the pages of the weights go round-robin over the nodes
+    NUMA_PARTITION  = 2, // the rows of each matrix are split between the nodes, and the threads of a node multiply the rows on it
+};
+
+enum request_status : uint8_t {
+    REQUEST_STATUS_DONE          = 0,
+    REQUEST_STATUS_FAILED        = 1, // the prompt is too long, the evaluation failed or the scheduler was freed
+    REQUEST_STATUS_CANCELLED     = 2,
+    REQUEST_STATUS_OUT_OF_MEMORY = 3, // the context cannot hold the kept tokens and the next one, or no key/value memory is left
+};
+
 typedef void(*LLAMA_LOGGER_FUNC)(char const* function_name, int function_name_size, char const* message, int message_size);
 typedef void(*LLAMA_LOGGER_RESET_FUNC)();
 typedef void(*LLAMA_LOGGER_PROGRESS_FUNC)(progress_type_tag, size_t done_size, size_t total_size);
 typedef void(*LLAMA_STREAM_FUNC)(char const* token_stream, int token_stream_size);
+typedef void(*LLAMA_SCHEDULER_STREAM_FUNC)(void* user_data, char const* token_stream, int token_stream_size);
+typedef void(*LLAMA_SCHEDULER_DONE_FUNC)(void* user_data, request_status status);
 
 struct llama_model_context;
+struct llama_scheduler;
 
 
 struct llama_logger {
@@ -49,20 +71,44 @@ struct llama_model_context_args {
     bool use_mmap;                      // if true, it will use mmap to load the model
     bool use_mlock;                     // if true, it will use mlock to lock the memory
     bool load_parallel;                 // if true, it will load the model in parallel
+    bool use_flash_attn;                // if true, attention is computed by a fused kernel that does not store the scores
+    bool repack_weights;                // if true, the q4_0 matrices are interleaved by 4 rows at load and cached in '<model>.repack'
+    bool use_direct_io;                 // if true and mmap is not used, the weights are read around the page cache (O_DIRECT)
+    bool use_layer_paging;              // if true, the weights are mapped and paged in layer by layer while evaluating (implies use_mmap)
+    bool use_huge_pages;                // if true, the weights, kv cache and eval buffers are backed by huge pages where available
+    enum kv_cache_type kv_cache_type;   // element type of the key and value cache
+    enum numa_strategy numa;            // how the weights are spread over the NUMA nodes; the compute threads are pinned to the nodes
     int seed;                           // seed for random number generator
     int n_keep;                         // number of tokens to keep in memory across memory reset
     int n_ctx;                          // number of tokens in the context
     int n_threads;                      // number of threads to use for loading and evaluating the model
     int n_batch;                        // size of a batch that will be used for evaluation
+    int n_spin;                         // number of spins of a waiting compute thread before it sleeps (negative never sleeps)
     uint32_t n_load_parallel_blocks;    // number of task that a single thread will deal
+    uint32_t n_prefetch_layers;         // number of layers paged in ahead of the one being evaluated with use_layer_paging
     size_t last_n_tokens;               // size of the buffer that will store the last n tokens
     size_t allocate_extra_mem;          // extra memory to allocate for the model
+    size_t prefix_cache_size;           // number of prompt tokens whose memory is cached for new sessions (0 disables it)
     struct llama_logger logger;         // logger that will be used for logging
 };
 
 // Creates the default context arguments to reduce the initialization complexity.
 struct llama_model_context_args llama_create_default_context_args();
 
+// Arguments to the scheduler that serves many requests from a single loaded model.
+struct llama_scheduler_args {
+    enum kv_cache_type kv_cache_type;   // element type of the key and value cache of every request
+    bool use_flash_attn;                // if true, attention is computed by a fused kernel that does not store the scores
+    size_t max_sequences;               // number of requests evaluated together; the others wait for a free slot
+    int n_batch;                        // number of tokens evaluated per step; it must be at least `max_sequences`
+    int n_threads;                      // number of threads to use for evaluating the model
+    int n_spin;                         // number of spins of a waiting compute thread before it sleeps (negative never sleeps)
+    int n_keep;                         // number of tokens kept at the start of a request when its context is full
+    size_t last_n_tokens;               // size of the buffer that will store the last n tokens of a request
+};
+
+struct llama_scheduler_args llama_create_default_scheduler_args();
+
 /**
  * @brief Creates the model context that is used for storing the state.
  * 
@@ -81,6 +127,20 @@ struct llama_model_context* llama_create_context(struct llama_model_context_args
  */
 bool llama_load_model(struct llama_model_context* model_context, char const* filepath);
 
+/**
+ * @brief Creates a new session of a loaded model. The session shares the weights of `model_context` and owns
+ *        only its key/value cache, logits, random number generator and token history, so many conversations
+ *        can be served by a single loaded model. The weights are freed when the last context using them is freed.
+ *        The model wide arguments (`n_ctx`, `use_mmap`, `use_mlock`, `load_parallel`, `n_load_parallel_blocks`, `repack_weights`,
+ *        `use_direct_io`, `use_layer_paging`, `use_huge_pages`, `numa`, `n_prefetch_layers` and `logger`) are the ones the model was loaded with, and the
+ *        stop words are copied from `model_context`.
+ * 
+ * @param model_context is a context with a loaded model; it can be a session itself.
+ * @param args is of type `llama_model_context_args` that has session construction arguments.
+ * @return struct llama_model_context* that is ready to ingest and generate. If it is unable to create the session, it will return `NULL`.
+ */
+struct llama_model_context* llama_create_session(struct llama_model_context const* model_context, struct llama_model_context_args args);
+
 /**
  * @brief Sets the stop words. It will overwrite the stop words with every call.
  * 
@@ -184,7 +244,7 @@ bool llama_save_state(struct llama_model_context* model_context, char const* fil
 bool llama_load_state(struct llama_model_context* model_context, char const* filepath);
 
 /**
- * @brief Allows to add lora adapter to the model context.
+ * @brief Allows to add lora adapter to the model context. It fails while other sessions share the model.
  * 
  * @param model_context is the context that is constructed using `llama_create_context`.
  * @param filepath is the path to the lora adapter.
@@ -194,7 +254,7 @@ bool llama_load_state(struct llama_model_context* model_context, char const* fil
 bool llama_attach_lora(struct llama_model_context* model_context, char const* filepath);
 
 /**
- * @brief Removes the lora adapter from the model context.
+ * @brief Removes the lora adapter from the model context. It fails while other sessions share the model.
  * 
  * @param model_context is the context that is constructed using `llama_create_context`.
  * @return true if it successfully removes the lora adapter.
@@ -202,6 +262,18 @@ bool llama_attach_lora(struct llama_model_context* model_context, char const* fi
  */
 bool llama_detach_lora(struct llama_model_context* model_context);
 
+/**
+ * @brief Enables speculative decoding: while generating, the draft model proposes `n_draft` tokens that the model
+ *        verifies in a single evaluation. The output is distributed as without the draft. The draft must use the
+ *        same vocabulary and at least the same context size; `draft_context` can be freed afterwards.
+ * 
+ * @param model_context is the context that is constructed using `llama_create_context`.
+ * @param draft_context is a context with a loaded draft model, or `NULL` to disable speculative decoding.
+ * @param n_draft is the number of tokens drafted per evaluation of the model; zero disables speculative decoding.
+ * @return true if it successfully sets the draft model.
+ */
+bool llama_set_draft_model(struct llama_model_context* model_context, struct llama_model_context const* draft_context, size_t n_draft);
+
 /**
  * @brief Resets the model context. It will reset the model state and the memory.
  * 
@@ -217,6 +289,67 @@ bool llama_reset_model(struct llama_model_context* model_context);
  */
 void llama_free_context(struct llama_model_context*);
 
+/**
+ * @brief Creates a continuous-batching scheduler on the model of `model_context`. The requests are evaluated
+ *        together on a worker thread of the scheduler, so the callers do not block while the model runs. The
+ *        scheduler shares the weights, so `model_context` can be freed before the scheduler.
+ * 
+ * @param model_context is a context with a loaded model.
+ * @param args is of type `llama_scheduler_args` that has scheduler construction arguments.
+ * @return struct llama_scheduler* that accepts requests. If it is unable to create the scheduler, it will return `NULL`.
+ */
+struct llama_scheduler* llama_create_scheduler(struct llama_model_context const* model_context, struct llama_scheduler_args args);
+
+/**
+ * @brief Queues a generation request. The callbacks are invoked from the worker thread of the scheduler:
+ *        `stream_fn` for every generated piece of text and `done_fn` exactly once when the request leaves the scheduler.
+ * 
+ * @param scheduler is the scheduler that is constructed using `llama_create_scheduler`.
+ * @param prompt is a C string that contains the prompt of the request.
+ * @param number_of_tokens is the maximum number of token that the model can generate.
+ * @param top_k controls the diversity by limiting the selection to the top k highest probability tokens.
+ * @param top_p filters out tokens based on cumulative probability, further refining diversity.
+ * @param temp adjusts the sampling temperature, influencing creativity and randomness.
+ * @param repeat_penalty penalizes repeated tokens to reduce redundancy in generated text.
+ * @param seed is the seed of the random number generator of the request.
+ * @param stop_words are the words that stop the generation; they can be `NULL` when `n_stop_words` is zero.
+ * @param n_stop_words is the number of stop words.
+ * @param stream_fn is the callback function that is called every time model generates a token.
+ * @param done_fn is called with the `request_status` the request left the scheduler with; it can be `NULL`.
+ * @param user_data is passed to the callbacks.
+ * @return the id of the request, or -1 if it could not be queued.
+ */
+int64_t llama_scheduler_submit(
+    struct llama_scheduler* scheduler,
+    char const* prompt,
+    size_t number_of_tokens,
+    float top_k,
+    float top_p,
+    float temp,
+    float repeat_penalty,
+    int seed,
+    char const** stop_words,
+    size_t n_stop_words,
+    LLAMA_SCHEDULER_STREAM_FUNC stream_fn,
+    LLAMA_SCHEDULER_DONE_FUNC done_fn,
+    void* user_data
+);
+
+/**
+ * @brief Cancels a request. A waiting request is removed right away and an active one at the next token.
+ * 
+ * @param scheduler is the scheduler that is constructed using `llama_create_scheduler`.
+ * @param request_id is the id returned by `llama_scheduler_submit`.
+ * @return false if there is no such request.
+ */
+bool llama_scheduler_cancel(struct llama_scheduler* scheduler, int64_t request_id);
+
+/**
+ * @brief Frees the scheduler. It waits for the current step and reports the unfinished requests as failed.
+ * 
+ */
+void llama_free_scheduler(struct llama_scheduler*);
+
 #ifdef __cplusplus
 }
 #endif
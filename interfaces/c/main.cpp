@@ -1,5 +1,6 @@
 #include "fastllama.h"
 #include "bridge.hpp"
+#include "scheduler.hpp"
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -9,6 +10,36 @@ struct llama_model_context {
     fastllama::FastLlama::Params builder{};
 };
 
+struct llama_scheduler {
+    std::unique_ptr<fastllama::Scheduler> inner;
+};
+
+inline static ggml_type to_ggml_type(kv_cache_type type) noexcept {
+    switch (type) {
+        case KV_CACHE_TYPE_F32: return GGML_TYPE_F32;
+        case KV_CACHE_TYPE_F16: return GGML_TYPE_F16;
+        case KV_CACHE_TYPE_Q8_0: return GGML_TYPE_Q8_0;
+        default: return GGML_TYPE_COUNT;
+    }
+}
+
+inline static ggml_numa_strategy to_ggml_numa_strategy(numa_strategy strategy) noexcept {
+    switch (strategy) {
+        case NUMA_INTERLEAVE: return GGML_NUMA_INTERLEAVE;
+        case NUMA_PARTITION: return GGML_NUMA_PARTITION;
+        default: return GGML_NUMA_DISABLED;
+    }
+}
+
+inline static request_status to_request_status(fastllama::Scheduler::Status status) noexcept {
+    switch (status) {
+        case fastllama::Scheduler::Status::Done: return REQUEST_STATUS_DONE;
+        case fastllama::Scheduler::Status::Cancelled: return REQUEST_STATUS_CANCELLED;
+        case fastllama::Scheduler::Status::OutOfMemory: return REQUEST_STATUS_OUT_OF_MEMORY;
+        default: return REQUEST_STATUS_FAILED;
+    }
+}
+
 inline static LLAMA_LOGGER_FUNC make_def_info_logger_func() {
     return +[](char const* func_name, int func_name_size, char const* message, int message_size) {
         printf("\x1b[32;1m[Info]:\x1b[0m \x1b[32mFunc('%.*s') %.*s\x1b[0m", func_name_size, func_name, message_size, message);
@@ -59,16 +90,26 @@ extern "C" {
         result.n_ctx = builder.n_ctx;
         result.n_keep = builder.n_keep;
         result.n_threads = builder.n_threads;
+        result.n_spin = builder.n_spin;
         result.seed = builder.seed;
         result.allocate_extra_mem = 0ul;
+        result.prefix_cache_size = builder.prefix_cache_size;
         result.embedding_eval_enabled = false;
         result.should_get_all_logits = false;
         result.load_parallel = false;
+        result.use_flash_attn = false;
+        result.repack_weights = false;
+        result.use_direct_io = false;
+        result.use_layer_paging = false;
+        result.use_huge_pages = false;
+        result.kv_cache_type = KV_CACHE_TYPE_F32;
+        result.numa = NUMA_DISABLED;
         result.n_load_parallel_blocks = 1u;
+        result.n_prefetch_layers = 1u;
         return result;
     }
 
-    struct llama_model_context* llama_create_context(struct llama_model_context_args arg) {
+    inline static fastllama::FastLlama::Params make_builder(struct llama_model_context_args const& arg) {
         using namespace fastllama;
         auto builder = FastLlama::builder();
         builder.last_n_tokens = arg.last_n_tokens;
@@ -76,14 +117,24 @@ extern "C" {
         builder.n_ctx = arg.n_ctx;
         builder.n_keep = arg.n_keep;
         builder.n_threads = arg.n_threads;
+        builder.n_spin = arg.n_spin;
         builder.seed = arg.seed;
         builder.allocate_extra_mem = arg.allocate_extra_mem;
+        builder.prefix_cache_size = arg.prefix_cache_size;
         builder.should_get_all_logits = arg.should_get_all_logits;
         builder.embedding_eval_enabled = arg.embedding_eval_enabled;
         builder.use_mmap = arg.use_mmap;
         builder.use_mlock = arg.use_mlock;
         builder.use_parallel_loading = arg.load_parallel;
         builder.n_load_parallel_blocks = arg.n_load_parallel_blocks;
+        builder.kv_cache_type = to_ggml_type(arg.kv_cache_type);
+        builder.numa = to_ggml_numa_strategy(arg.numa);
+        builder.use_flash_attn = arg.use_flash_attn;
+        builder.repack_weights = arg.repack_weights;
+        builder.use_direct_io = arg.use_direct_io;
+        builder.use_layer_paging = arg.use_layer_paging;
+        builder.use_huge_pages = arg.use_huge_pages;
+        builder.n_prefetch_layers = arg.n_prefetch_layers;
 
         auto def_logger = DefaultLogger{};
         def_logger.log = arg.logger.log;
@@ -93,6 +144,11 @@ extern "C" {
         def_logger.progress = reinterpret_cast<void(*)(fastllama::ProgressTag, std::size_t, std::size_t)>(arg.logger.progress);
         
         builder.logger = Logger(std::move(def_logger));
+        return builder;
+    }
+
+    struct llama_model_context* llama_create_context(struct llama_model_context_args arg) {
+        auto builder = make_builder(arg);
 
         auto result = new llama_model_context();
         if (result) {
@@ -134,6 +190,22 @@ extern "C" {
         return true;
     }
 
+    struct llama_model_context* llama_create_session(struct llama_model_context const* model_context, struct llama_model_context_args args) {
+        if (!is_model_valid(model_context)) return nullptr;
+
+        auto builder = make_builder(args);
+        auto maybe_session = builder.build(model_context->inner->get_model());
+        if (!maybe_session) return nullptr;
+
+        auto result = new llama_model_context();
+        if (result) {
+            result->builder = std::move(builder);
+            result->inner = std::move(maybe_session);
+            result->stop_words = model_context->stop_words;
+        }
+        return result;
+    }
+
     bool llama_set_stop_words(struct llama_model_context* model_context, char const** words, size_t len) {
         if (model_context == nullptr) {
             fprintf(stderr, "model context is not initalized. Please use `llama_create_context` to create a context.\n");
@@ -221,11 +293,101 @@ extern "C" {
         return model_context->inner->detach_lora();
     }
 
+    bool llama_set_draft_model(struct llama_model_context* model_context, struct llama_model_context const* draft_context, size_t n_draft) {
+        if (!is_model_valid(model_context)) return false;
+        if (draft_context == nullptr) return model_context->inner->set_draft_model(nullptr, 0);
+        if (!is_model_valid(draft_context)) return false;
+        return model_context->inner->set_draft_model(draft_context->inner->get_model(), n_draft);
+    }
+
     bool llama_reset_model(struct llama_model_context* model_context) {
         if (!is_model_valid(model_context)) return false;
         return model_context->inner->reset();
     }
 
+    struct llama_scheduler_args llama_create_default_scheduler_args() {
+        struct llama_scheduler_args result{};
+        auto params = fastllama::Scheduler::Params{};
+        result.kv_cache_type = KV_CACHE_TYPE_F32;
+        result.use_flash_attn = params.use_flash_attn;
+        result.max_sequences = params.max_sequences;
+        result.n_batch = params.n_batch;
+        result.n_threads = params.n_threads;
+        result.n_spin = params.n_spin;
+        result.n_keep = params.n_keep;
+        result.last_n_tokens = params.last_n_tokens;
+        return result;
+    }
+
+    struct llama_scheduler* llama_create_scheduler(struct llama_model_context const* model_context, struct llama_scheduler_args args) {
+        if (!is_model_valid(model_context)) return nullptr;
+
+        auto params = fastllama::Scheduler::Params{}
+            .set_max_sequences(args.max_sequences)
+            .set_number_of_batches(args.n_batch)
+            .set_number_of_threads(args.n_threads)
+            .set_spin_count(args.n_spin)
+            .set_number_of_tokens_to_keep(args.n_keep)
+            .set_last_n_tokens(args.last_n_tokens)
+            .set_kv_cache_type(to_ggml_type(args.kv_cache_type))
+            .set_use_flash_attn(args.use_flash_attn);
+
+        auto scheduler = fastllama::Scheduler::create(model_context->inner->get_model(), params);
+        if (!scheduler) return nullptr;
+
+        return new llama_scheduler{ std::move(scheduler) };
+    }
+
+    int64_t llama_scheduler_submit(
+        struct llama_scheduler* scheduler,
+        char const* prompt,
+        size_t number_of_tokens,
+        float top_k,
+        float top_p,
+        float temp,
+        float repeat_penalty,
+        int seed,
+        char const** stop_words,
+        size_t n_stop_words,
+        LLAMA_SCHEDULER_STREAM_FUNC stream_fn,
+        LLAMA_SCHEDULER_DONE_FUNC done_fn,
+        void* user_data
+    ) {
+        if (scheduler == nullptr) {
+            fprintf(stderr, "scheduler is not initalized. Please use `llama_create_scheduler` to create a scheduler.\n");
+            return -1;
+        }
+
+        auto request = fastllama::Scheduler::Request{};
+        request.prompt = prompt;
+        request.num_tokens = number_of_tokens;
+        request.top_k = top_k;
+        request.top_p = top_p;
+        request.temp = temp;
+        request.repeat_penalty = repeat_penalty;
+        request.seed = seed;
+        request.stop_words.assign(stop_words, stop_words + n_stop_words);
+        if (stream_fn) {
+            request.on_token = [stream_fn, user_data](std::string const& s) {
+                stream_fn(user_data, s.data(), static_cast<int>(s.size()));
+            };
+        }
+        if (done_fn) {
+            request.on_done = [done_fn, user_data](fastllama::Scheduler::Status status) { done_fn(user_data, to_request_status(status)); };
+        }
+
+        return scheduler->inner->submit(std::move(request));
+    }
+
+    bool llama_scheduler_cancel(struct llama_scheduler* scheduler, int64_t request_id) {
+        if (scheduler == nullptr) return false;
+        return scheduler->inner->cancel(request_id);
+    }
+
+    void llama_free_scheduler(struct llama_scheduler* scheduler) {
+        delete scheduler;
+    }
+
     void llama_handle_signal(int) {
         printf("Quitting the app...");
         exit(0);
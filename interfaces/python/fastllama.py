@@ -56,6 +56,34 @@ class ProgressTag(Enum):
         else:
             raise Exception(f"Unknown progress tag value: {value}")
 
+class KVCacheType(Enum):
+    """
+    Element type of the key and value cache. Q8_0 stores the keys as 8-bit blocks and the values as F16.
+    """
+    F32  = 0
+    F16  = 1
+    Q8_0 = 2
+
+class NumaStrategy(Enum):
+    """
+    How the weights are spread over the NUMA nodes. The evaluation threads are pinned to the nodes in either case.
+    INTERLEAVE places the pages round-robin over the nodes; PARTITION splits the rows of each matrix between the
+    nodes so that every thread multiplies the rows of its own node.
+    """
+    DISABLED   = 0
+    INTERLEAVE = 1
+    PARTITION  = 2
+
+class RequestStatus(Enum):
+    """
+    How a request left the Scheduler. OUT_OF_MEMORY means that its context cannot hold the kept tokens and the next
+    one, or that no key/value memory is left for it.
+    """
+    DONE          = 0
+    FAILED        = 1
+    CANCELLED     = 2
+    OUT_OF_MEMORY = 3
+
 class Logger:
     """
     Logger class for reporting messages.
@@ -139,14 +167,24 @@ class c_llama_model_context_args(ctypes.Structure):
         ('use_mmap', ctypes.c_bool),
         ('use_mlock', ctypes.c_bool),
         ('load_parallel', ctypes.c_bool),
+        ('use_flash_attn', ctypes.c_bool),
+        ('repack_weights', ctypes.c_bool),
+        ('use_direct_io', ctypes.c_bool),
+        ('use_layer_paging', ctypes.c_bool),
+        ('use_huge_pages', ctypes.c_bool),
+        ('kv_cache_type', ctypes.c_uint8),
+        ('numa', ctypes.c_uint8),
         ('seed', ctypes.c_int),
         ('n_keep', ctypes.c_int),
         ('n_ctx', ctypes.c_int),
         ('n_threads', ctypes.c_int),
         ('n_batch', ctypes.c_int),
+        ('n_spin', ctypes.c_int),
         ('n_load_parallel_blocks', ctypes.c_uint32),
+        ('n_prefetch_layers', ctypes.c_uint32),
         ('last_n_tokens', ctypes.c_size_t),
         ('allocate_extra_mem', ctypes.c_size_t),
+        ('prefix_cache_size', ctypes.c_size_t),
         ('logger', c_llama_logger)
     ]
 
@@ -158,6 +196,32 @@ class c_llama_model_context(ctypes.Structure):
 
 c_llama_model_context_ptr = ctypes.POINTER(c_llama_model_context)
 
+class c_llama_scheduler_args(ctypes.Structure):
+    """
+    C-compatible scheduler arguments structure.
+    """
+    _fields_ = [
+        ('kv_cache_type', ctypes.c_uint8),
+        ('use_flash_attn', ctypes.c_bool),
+        ('max_sequences', ctypes.c_size_t),
+        ('n_batch', ctypes.c_int),
+        ('n_threads', ctypes.c_int),
+        ('n_spin', ctypes.c_int),
+        ('n_keep', ctypes.c_int),
+        ('last_n_tokens', ctypes.c_size_t),
+    ]
+
+class c_llama_scheduler(ctypes.Structure):
+    """
+    C-compatible scheduler structure.
+    """
+    pass
+
+c_llama_scheduler_ptr = ctypes.POINTER(c_llama_scheduler)
+
+C_LLAMA_SCHEDULER_STREAM_FUNC = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int)
+C_LLAMA_SCHEDULER_DONE_FUNC = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint8)
+
 def make_c_logger_func(func: Callable[[str, str], None]) -> Any:
     """
     Creates a C-compatible logger function from a Python callable.
@@ -212,6 +276,16 @@ class Model:
         logger: Optional[Logger] = None, 
         load_parallel: bool = False,
         n_load_parallel_blocks: int = 1,
+        n_spin: Optional[int] = None,
+        kv_cache_type: Optional[KVCacheType] = None,
+        use_flash_attn: bool = False,
+        repack_weights: bool = False,
+        use_direct_io: bool = False,
+        use_layer_paging: bool = False,
+        n_prefetch_layers: int = 1,
+        use_huge_pages: bool = False,
+        numa: Optional[NumaStrategy] = None,
+        prefix_cache_size: int = 0,
         library_path: Optional[str] = None
         ):
         """
@@ -230,6 +304,16 @@ class Model:
         :param logger: Logger instance to be used for reporting messages. Default is None.
         :param load_parallel: Flag to indicate if the model should be loaded in parallel. Default is False.
         :param n_load_parallel_blocks: Number of task that each thread will handle. Default is 1.
+        :param kv_cache_type: Element type of the key and value cache (KVCacheType.F32, F16 or Q8_0). Default is None, which uses F32.
+        :param use_flash_attn: Flag to compute the attention with a fused kernel that reads the key and value cache in tiles instead of storing every attention score. Default is False.
+        :param repack_weights: Flag to interleave the 4-bit (Q4_0) weight matrices by 4 rows at load for faster matrix products. The repacked weights are kept in '<path>.repack' so later loads skip the repacking. It turns off mmap and LoRA adapters. Default is False.
+        :param use_direct_io: Flag to read the weights around the page cache (O_DIRECT) when mmap is not used, which is faster for cold loads from fast drives. Default is False.
+        :param use_layer_paging: Flag to map the weights without reading them in and page them in layer by layer while evaluating, so that models larger than the memory can run. It implies use_mmap. Default is False.
+        :param n_prefetch_layers: Number of layers paged in ahead of the one being evaluated with use_layer_paging. Default is 1.
+        :param use_huge_pages: Flag to back the weights, the key and value cache and the evaluation buffers with huge pages, which cuts TLB misses. Reserved huge pages (vm.nr_hugepages) are used when there are enough, otherwise transparent huge pages. Default is False.
+        :param numa: How the weights are spread over the NUMA nodes (NumaStrategy.INTERLEAVE or PARTITION); the evaluation threads are pinned to the nodes. It turns off mmap unless use_layer_paging is set, and applies to the whole process. PARTITION works best when num_threads is a multiple of the number of nodes. Default is None, which disables it.
+        :param n_spin: Number of spins of a waiting evaluation thread before it goes to sleep; negative never sleeps. Default is None, which uses the library default.
+        :param prefix_cache_size: Number of prompt tokens whose memory is kept, so sessions starting with a cached prefix only evaluate the rest of the prompt. Shared by every session and scheduler of the model. Default is 0, which disables it.
         :param library_path: Path to the library file. Default is the result of get_library_path('build', 'interfaces','python').
         """
 
@@ -256,6 +340,19 @@ class Model:
         ctx_args.use_mlock = use_mlock
         ctx_args.load_parallel = load_parallel
         ctx_args.n_load_parallel_blocks = n_load_parallel_blocks
+        ctx_args.prefix_cache_size = prefix_cache_size
+        if n_spin is not None:
+            ctx_args.n_spin = n_spin
+        if kv_cache_type is not None:
+            ctx_args.kv_cache_type = kv_cache_type.value
+        ctx_args.use_flash_attn = use_flash_attn
+        ctx_args.repack_weights = repack_weights
+        ctx_args.use_direct_io = use_direct_io
+        ctx_args.use_layer_paging = use_layer_paging
+        ctx_args.n_prefetch_layers = n_prefetch_layers
+        ctx_args.use_huge_pages = use_huge_pages
+        if numa is not None:
+            ctx_args.numa = numa.value
 
         if logger is not None:
             self.logger = c_llama_logger()
@@ -297,6 +394,66 @@ class Model:
         fn.argtypes = [c_llama_model_context_args]
         return fn(ctx_args)
     
+    def new_session(
+        self,
+        num_threads: int = multiprocessing.cpu_count(),
+        last_n_size: int = 64,
+        seed: int = 0,
+        tokens_to_keep: int = 200,
+        n_batch: int = 16,
+        should_get_all_logits: bool = False,
+        embedding_eval_enabled: bool = False,
+        allocate_extra_mem: int = 0,
+        n_spin: Optional[int] = None,
+        kv_cache_type: Optional[KVCacheType] = None,
+        use_flash_attn: bool = False
+        ) -> 'Model':
+        """
+        Creates a new session that shares the loaded weights of this model. The session has its own memory context,
+        logits, random number generator and token history. The context size and the logger are the ones of this model.
+
+        :param num_threads: Number of threads to use during model evaluation. Default is the number of CPU cores.
+        :param last_n_size: Number of tokens the model can remember. Default is 64.
+        :param seed: Random number seed to be used in the session. Default is 0.
+        :param tokens_to_keep: Number of tokens to keep when tokens are removed from the buffer to save memory. Default is 200.
+        :param n_batch: Size of the token batch that will be processed at a given time. Default is 16.
+        :param should_get_all_logits: Flag to indicate if all logit values should be returned. Default is False.
+        :param embedding_eval_enabled: Flag to enable embedding evaluation. Default is False.
+        :param allocate_extra_mem: Amount of extra memory to allocate. Default is 0.
+        :param n_spin: Number of spins of a waiting evaluation thread before it goes to sleep; negative never sleeps. Default is None, which uses the library default.
+        :param kv_cache_type: Element type of the key and value cache (KVCacheType.F32, F16 or Q8_0). Default is None, which uses F32.
+        :param use_flash_attn: Flag to compute the attention with a fused kernel that reads the key and value cache in tiles instead of storing every attention score. Default is False.
+        :return: Model instance of the new session.
+        """
+        ctx_args = self.__get_default_ctx_args__()
+
+        ctx_args.seed = seed
+        ctx_args.n_keep = tokens_to_keep
+        ctx_args.n_threads = num_threads
+        ctx_args.n_batch = n_batch
+        ctx_args.last_n_tokens = last_n_size
+        ctx_args.embedding_eval_enabled = embedding_eval_enabled
+        ctx_args.should_get_all_logits = should_get_all_logits
+        ctx_args.allocate_extra_mem = allocate_extra_mem
+        if n_spin is not None:
+            ctx_args.n_spin = n_spin
+        if kv_cache_type is not None:
+            ctx_args.kv_cache_type = kv_cache_type.value
+        ctx_args.use_flash_attn = use_flash_attn
+
+        fn = self.lib.llama_create_session
+        fn.restype = c_llama_model_context_ptr
+        fn.argtypes = [c_llama_model_context_ptr, c_llama_model_context_args]
+        ctx = fn(self.ctx, ctx_args)
+        if not ctx:
+            raise RuntimeError("Unable to create a session")
+
+        session = Model.__new__(Model)
+        session.lib = self.lib
+        session.ctx = ctx
+        session.is_session = True
+        return session
+
     def save_state(self, filepath: str) -> bool:
         """
         Saves the current model state to a file.
@@ -454,6 +611,21 @@ class Model:
         fn.restype = ctypes.c_bool
         return bool(fn(self.ctx))
 
+    def set_draft_model(self, draft: Optional['Model'], n_draft: int = 4) -> bool:
+        """
+        Enables speculative decoding: while generating, the draft model proposes n_draft tokens that this model verifies
+        in a single evaluation. The output is distributed as without the draft. The draft model must use the same
+        vocabulary and at least the same context size.
+
+        :param draft: Small model that shares the vocabulary, or None to disable speculative decoding.
+        :param n_draft: Number of tokens drafted per evaluation of the model. Default is 4.
+        :return: True if successful, False otherwise.
+        """
+        fn = self.lib.llama_set_draft_model
+        fn.argtypes = [c_llama_model_context_ptr, c_llama_model_context_ptr, ctypes.c_size_t]
+        fn.restype = ctypes.c_bool
+        return bool(fn(self.ctx, draft.ctx if draft is not None else None, n_draft if draft is not None else 0))
+
     def reset(self) -> bool:
         """
         Resets the model.
@@ -469,11 +641,175 @@ class Model:
         """
         Destructor for the Model class.
         """
-        signal.signal(signal.SIGINT, signal.SIG_DFL)
-        signal.siginterrupt(signal.SIGINT, False)
+        if not getattr(self, 'is_session', False):
+            signal.signal(signal.SIGINT, signal.SIG_DFL)
+            signal.siginterrupt(signal.SIGINT, False)
         lib = self.lib
         ctx = self.ctx
         free_fn = lib.llama_free_context
         free_fn.argtypes = [ctypes.POINTER(c_llama_model_context)]
         free_fn(ctx)
         pass
+
+class Scheduler:
+    """
+    Continuous-batching scheduler that serves many generation requests from one loaded model. The requests are
+    evaluated together on a native worker thread, so the Python threads that submit them do not hold the GIL
+    while the model runs. The callbacks are invoked from that worker thread.
+    """
+    def __init__(
+        self,
+        model: Model,
+        max_sequences: int = 8,
+        num_threads: int = multiprocessing.cpu_count(),
+        n_batch: int = 64,
+        tokens_to_keep: int = 64,
+        last_n_size: int = 64,
+        n_spin: Optional[int] = None,
+        kv_cache_type: Optional[KVCacheType] = None,
+        use_flash_attn: bool = False
+        ) -> None:
+        """
+        Initializes a new scheduler that shares the loaded weights of the model.
+
+        :param model: Loaded model whose weights are used by every request.
+        :param max_sequences: Number of requests evaluated together; the others wait for a free slot. Default is 8.
+        :param num_threads: Number of threads to use during model evaluation. Default is the number of CPU cores.
+        :param n_batch: Number of tokens evaluated per step; it must be at least max_sequences. Default is 64.
+        :param tokens_to_keep: Number of tokens kept at the start of a request when its context is full. Default is 64.
+        :param last_n_size: Number of tokens considered by the repetition penalty. Default is 64.
+        :param n_spin: Number of spins of a waiting evaluation thread before it goes to sleep; negative never sleeps. Default is None, which uses the library default.
+        :param kv_cache_type: Element type of the key and value cache (KVCacheType.F32, F16 or Q8_0). Default is None, which uses F32.
+        :param use_flash_attn: Flag to compute the attention with a fused kernel that reads the key and value cache in tiles instead of storing every attention score. Default is False.
+        """
+        self.lib = model.lib
+        self.sched = None
+        self.requests: dict = {}
+        self.next_key = 1 # zero would arrive as a null user data
+
+        fn = self.lib.llama_create_default_scheduler_args
+        fn.restype = c_llama_scheduler_args
+        args = fn()
+        args.max_sequences = max_sequences
+        args.n_threads = num_threads
+        args.n_batch = n_batch
+        args.n_keep = tokens_to_keep
+        args.last_n_tokens = last_n_size
+        if n_spin is not None:
+            args.n_spin = n_spin
+        if kv_cache_type is not None:
+            args.kv_cache_type = kv_cache_type.value
+        args.use_flash_attn = use_flash_attn
+
+        def stream_fn(key: ctypes.c_void_p, token: ctypes.c_char_p, len: ctypes.c_int) -> None:
+            streaming_fn, _ = self.requests[key]
+            if streaming_fn is not None:
+                streaming_fn(ctypes.string_at(token, int(len)).decode('utf-8'))
+
+        def done_fn(key: ctypes.c_void_p, status: ctypes.c_uint8) -> None:
+            _, on_done = self.requests.pop(key)
+            if on_done is not None:
+                on_done(RequestStatus(int(status)))
+
+        # the callbacks must outlive every request, so they are created once per scheduler
+        self.c_stream_fn = C_LLAMA_SCHEDULER_STREAM_FUNC(stream_fn)
+        self.c_done_fn = C_LLAMA_SCHEDULER_DONE_FUNC(done_fn)
+
+        fn = self.lib.llama_create_scheduler
+        fn.restype = c_llama_scheduler_ptr
+        fn.argtypes = [c_llama_model_context_ptr, c_llama_scheduler_args]
+        sched = fn(model.ctx, args)
+        if not sched:
+            raise RuntimeError("Unable to create a scheduler")
+        self.sched = sched
+
+    def submit(
+            self,
+            prompt: str,
+            streaming_fn: Optional[Callable[[str], None]] = None,
+            on_done: Optional[Callable[[RequestStatus], None]] = None,
+            num_tokens: int = 100,
+            top_k: int = 40,
+            top_p: float = .95,
+            temp: float = .8,
+            repeat_penalty: float = 1.0,
+            seed: int = 0,
+            stop_words: List[str] = [],
+        ) -> int:
+        """
+        Queues a generation request and returns right away.
+
+        :param prompt: The prompt of the request.
+        :param streaming_fn: Function to be called with the generated text.
+        :param on_done: Function called once when the request leaves the scheduler with the RequestStatus it left with.
+        :param num_tokens: Maximum number of tokens to be generated by the model. Default is 100.
+        :param top_k: Controls the diversity by limiting the selection to the top k highest probability tokens. Default is 40.
+        :param top_p: Filters out tokens based on cumulative probability, further refining diversity. Default is 0.95.
+        :param temp: Adjusts the sampling temperature, influencing creativity and randomness. Default is 0.8.
+        :param repeat_penalty: Penalizes repeated tokens to reduce redundancy in generated text. Default is 1.0.
+        :param seed: Random number seed of the request. Default is 0.
+        :param stop_words: List of words that will stop the request when encountered in the token buffer. Default is an empty list.
+        :return: Id of the request, or -1 if it could not be queued.
+        """
+        key = self.next_key
+        self.next_key += 1
+        self.requests[key] = (streaming_fn, on_done)
+
+        stop_words_ptr_type = (ctypes.c_char_p * len(stop_words))
+        fn = self.lib.llama_scheduler_submit
+        fn.restype = ctypes.c_int64
+        fn.argtypes = cast(List[Type[Any]], [
+            c_llama_scheduler_ptr,
+            ctypes.c_char_p,
+            ctypes.c_size_t,
+            ctypes.c_float,
+            ctypes.c_float,
+            ctypes.c_float,
+            ctypes.c_float,
+            ctypes.c_int,
+            stop_words_ptr_type,
+            ctypes.c_size_t,
+            C_LLAMA_SCHEDULER_STREAM_FUNC,
+            C_LLAMA_SCHEDULER_DONE_FUNC,
+            ctypes.c_void_p,
+        ])
+        request_id = int(fn(
+            self.sched,
+            bytes(prompt, 'utf-8'),
+            num_tokens,
+            top_k,
+            top_p,
+            temp,
+            repeat_penalty,
+            seed,
+            stop_words_ptr_type(*[bytes(s, 'utf-8') for s in stop_words]),
+            len(stop_words),
+            self.c_stream_fn,
+            self.c_done_fn,
+            key,
+        ))
+        if request_id < 0:
+            self.requests.pop(key, None)
+        return request_id
+
+    def cancel(self, request_id: int) -> bool:
+        """
+        Cancels a request. A waiting request is removed right away and an active one at the next token.
+
+        :param request_id: Id returned by submit.
+        :return: False if there is no such request.
+        """
+        fn = self.lib.llama_scheduler_cancel
+        fn.argtypes = [c_llama_scheduler_ptr, ctypes.c_int64]
+        fn.restype = ctypes.c_bool
+        return bool(fn(self.sched, request_id))
+
+    def __del__(self):
+        """
+        Destructor for the Scheduler class. The unfinished requests are reported as failed.
+        """
+        if self.sched:
+            free_fn = self.lib.llama_free_scheduler
+            free_fn.argtypes = [c_llama_scheduler_ptr]
+            free_fn(self.sched)
+            self.sched = None
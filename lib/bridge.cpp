@@ -21,27 +21,28 @@ namespace fastllama {
         logits_id.resize(static_cast<std::size_t>(top_k));
     }
 
-    auto sample_top_p_top_k(
+    // Probabilities of the tokens that can be sampled after the repetition penalty, the temperature, top-k and
+    // top-p, as pairs of probability and token. A temperature of zero keeps only the most likely token.
+    static auto sampling_distribution(
         Model const& model,
         Span<float> logits,
         RingBuffer<typename Vocab::id_type> const & last_n_tokens,
         double repeat_penalty,
         int top_k,
         double top_p,
-        double temp,
-        std::mt19937 & rng
-    ) -> typename Vocab::id_type {
-
-
+        double temp
+    ) -> std::vector<std::pair<double, typename Vocab::id_type>> {
         std::size_t n_logits = static_cast<std::size_t>(model.params.n_vocab);
         auto const plogits = logits.end() - static_cast<std::ptrdiff_t>(n_logits);
 
+        std::vector<std::pair<double, typename Vocab::id_type>> logits_id;
+
         if (temp <= 0.) {
             auto max_el  = std::max_element(plogits, logits.end());
-            return static_cast<typename Vocab::id_type>(std::distance(logits.begin(), max_el));
+            logits_id.emplace_back(1.0, static_cast<typename Vocab::id_type>(std::distance(plogits, max_el)));
+            return logits_id;
         }
 
-        std::vector<std::pair<double, typename Vocab::id_type>> logits_id;
         logits_id.resize(n_logits);
         std::unordered_set<typename Vocab::id_type> temp_toks( last_n_tokens.begin(), last_n_tokens.end() );
 
@@ -70,88 +71,130 @@ namespace fastllama {
         double maxl = logits_id[0].first;
 
         // compute probs for the top K tokens
-        std::vector<double> probs;
-        probs.resize(logits_id.size());
-
         double sum{};
 
-        auto const logits_id_size = static_cast<std::ptrdiff_t>(logits_id.size());
-        for (auto i = 0l; i < logits_id_size; i++) {
-            auto const& kv = logits_id[static_cast<std::size_t>(i)];
-            auto p = static_cast<double>(std::exp(static_cast<float>(kv.first - maxl)));
-            probs[i] = p;
-            sum += p;
+        for (auto& kv : logits_id) {
+            kv.first = static_cast<double>(std::exp(static_cast<float>(kv.first - maxl)));
+            sum += kv.first;
         }
 
         // normalize the probs
-        for (auto i = 0ul; i < probs.size(); i++) {
-            probs[i] /= sum;
+        for (auto& kv : logits_id) {
+            kv.first /= sum;
         }
 
         if (top_p < 1.0) {
             double cumsum{};
-            for (auto i = 0ul; i < probs.size(); i++) {
-                cumsum += probs[i];
+            for (auto i = 0ul; i < logits_id.size(); i++) {
+                cumsum += logits_id[i].first;
                 if (cumsum >= top_p) {
-                    probs.resize(i + 1);
                     logits_id.resize(i + 1);
+                    for (auto& kv : logits_id) kv.first /= cumsum;
                     break;
                 }
             }
 
         }
 
-        std::discrete_distribution<> dist(probs.begin(), probs.end());
-        int idx = dist(rng);
+        return logits_id;
+    }
+
+    static auto sample_from_distribution(std::vector<std::pair<double, typename Vocab::id_type>> const& probs, std::mt19937 & rng) -> typename Vocab::id_type {
+        if (probs.size() == 1) return probs[0].second;
+
+        std::vector<double> weights(probs.size());
+        std::transform(probs.begin(), probs.end(), weights.begin(), [](auto const& kv) { return kv.first; });
 
-        return logits_id[idx].second;
+        std::discrete_distribution<> dist(weights.begin(), weights.end());
+        return probs[static_cast<std::size_t>(dist(rng))].second;
+    }
+
+    auto sample_top_p_top_k(
+        Model const& model,
+        Span<float> logits,
+        RingBuffer<typename Vocab::id_type> const & last_n_tokens,
+        double repeat_penalty,
+        int top_k,
+        double top_p,
+        double temp,
+        std::mt19937 & rng
+    ) -> typename Vocab::id_type {
+        return sample_from_distribution(sampling_distribution(model, logits, last_n_tokens, repeat_penalty, top_k, top_p, temp), rng);
     }
 
     std::optional<FastLlama> FastLlama::Params::build(std::string_view const& filepath) {
-        auto temp = FastLlama();
-        temp.m_model.params.n_ctx = n_ctx;
-        temp.m_last_n_tokens = last_n_tokens;
-        temp.m_model.set_threads(n_threads);
-        temp.m_keep = n_keep;
-        temp.m_model.n_batch = n_batch;
-        temp.m_model.logger = std::move(logger);
-        temp.set_seed(seed);
-        temp.m_model.embeddings_eval_enable = embedding_eval_enabled;
-        temp.m_model.should_put_all_logits = should_get_all_logits;
-        temp.m_model.allocate_extra_mem = allocate_extra_mem;
-        temp.m_model.use_mmap = use_mmap;
-        temp.m_model.use_mlock = use_mlock;
-        temp.m_model.load_parallel = use_parallel_loading;
-        temp.m_model.n_load_parallel_blocks = n_load_parallel_blocks;
+        auto model = std::make_shared<Model>();
+        model->params.n_ctx = n_ctx;
+        model->set_threads(n_threads);
+        model->logger = std::move(logger);
+        model->use_mmap = use_mmap;
+        model->use_mlock = use_mlock;
+        model->load_parallel = use_parallel_loading;
+        model->n_load_parallel_blocks = n_load_parallel_blocks;
+        model->repack_weights = repack_weights;
+        model->use_direct_io = use_direct_io;
+        model->use_layer_paging = use_layer_paging;
+        model->n_prefetch_layers = n_prefetch_layers;
+        model->use_huge_pages = use_huge_pages;
+        model->numa = numa;
+        model->prefix_cache.set_capacity(prefix_cache_size);
 
         printf("\n\n\x1b[32m%s\x1b[0m\n\n", internal::watermark);
         fflush(stdout);
 
-        if (!temp.m_model.load(filepath)) {
-            temp.get_logger().log_err("FastLlama::Params::build", "Unable to load model\n");
+        if (!model->load(filepath)) {
+            model->logger.log_err("FastLlama::Params::build", "Unable to load model\n");
+            return std::nullopt;
+        }
+
+        return build(std::move(model));
+    }
+
+    std::optional<FastLlama> FastLlama::Params::build(std::shared_ptr<Model> model) {
+        if (!model || !model->is_valid) {
+            Logger::get_default_logger().log_err("FastLlama::Params::build", "tried to create a session of an invalid model\n");
+            return std::nullopt;
+        }
+
+        auto temp = FastLlama();
+        temp.m_model = std::move(model);
+        temp.m_last_n_tokens = last_n_tokens;
+        temp.m_keep = n_keep;
+        temp.set_seed(seed);
+        temp.m_state.set_threads(n_threads);
+        temp.m_state.n_batch = n_batch;
+        temp.m_state.n_spin = n_spin;
+        temp.m_state.kv_self.memory_type = kv_cache_type;
+        temp.m_state.embeddings_eval_enable = embedding_eval_enabled;
+        temp.m_state.should_put_all_logits = should_get_all_logits;
+        temp.m_state.use_flash_attn = use_flash_attn;
+        temp.m_state.allocate_extra_mem = allocate_extra_mem;
+
+        if (!temp.m_state.init(*temp.m_model)) {
+            temp.get_logger().log_err("FastLlama::Params::build", "Unable to create the session\n");
             return std::nullopt;
         }
 
         // token_id_t inputs[] = { 0, 1, 2, 3 };
 
-        // if (!temp.m_model.eval(0, inputs, temp.m_logits, temp.m_mem_per_token)) {
+        // if (!temp.m_model->eval(temp.m_state, 0, inputs, temp.m_logits, temp.m_mem_per_token)) {
         //     temp.get_logger().log_err("FastLlama::Params::build", "Unable to evaluate model\n");
         //     return std::nullopt;
         // }
 
-        auto const logits_size = static_cast<std::size_t>(n_ctx * (should_get_all_logits ? temp.m_model.params.n_vocab : 1));
+        auto const logits_size = static_cast<std::size_t>(temp.m_model->params.n_ctx * (should_get_all_logits ? temp.m_model->params.n_vocab : 1));
         temp.m_logits.reserve(logits_size);
 
         if (embedding_eval_enabled) {
-            temp.m_model.embeddings.reserve( static_cast<std::size_t>(temp.m_model.params.n_embd) );
+            temp.m_state.embeddings.reserve( static_cast<std::size_t>(temp.m_model->params.n_embd) );
         }
 
         return { std::move(temp) };
     }
 
     Span<float> FastLlama::get_embeddings() const noexcept {
-        if (!m_model.embeddings_eval_enable) get_logger().log_warn(__func__, "Please set the flag `embeddings_eval_enable` to true before getting the embeddings.\n");
-        return m_model.embeddings;
+        if (!m_state.embeddings_eval_enable) get_logger().log_warn(__func__, "Please set the flag `embeddings_eval_enable` to true before getting the embeddings.\n");
+        return m_state.embeddings;
     }
 
     Span<float> FastLlama::get_logits() const noexcept {
@@ -162,12 +205,42 @@ namespace fastllama {
         auto const len = m_embd.size();
         if (len == 0) return false;
 
-        if (len + n_past <= m_model.params.n_ctx) return false;
+        if (len + n_past <= m_model->params.n_ctx) return false;
+
+        // Discard the older half of the tokens after the kept prefix, or more if the pending tokens need it,
+        // and slide the rest of the cache down instead of evaluating the recycled tokens again.
+        auto const n_ctx = static_cast<std::size_t>(m_model->params.n_ctx);
+        auto const n_keep = static_cast<std::size_t>(std::min(m_keep, n_past));
+        auto const n_left = static_cast<std::size_t>(n_past) - n_keep;
+        auto const n_discard = std::max(n_left >> 1, len + static_cast<std::size_t>(n_past) - n_ctx);
+
+        if (n_discard <= n_left && m_state.shift_kv_cache(m_model->params, n_keep, n_discard, static_cast<std::size_t>(n_past), get_logger())) {
+            if (m_context_tokens.size() == static_cast<std::size_t>(n_past)) {
+                auto const first = m_context_tokens.begin() + static_cast<std::ptrdiff_t>(n_keep);
+                m_context_tokens.erase(first, first + static_cast<std::ptrdiff_t>(n_discard));
+            }
+
+            // the draft drops the same tokens, or evaluates them again if it has not reached them
+            if (m_draft_model && m_draft_past >= n_keep + n_discard && m_draft_state.shift_kv_cache(m_draft_model->params, n_keep, n_discard, m_draft_past, get_logger())) {
+                m_draft_past -= n_discard;
+            } else {
+                m_draft_past = std::min(m_draft_past, n_keep);
+            }
+
+            n_past -= static_cast<int>(n_discard);
+            return true;
+        }
 
         auto last_tokens_len = m_last_n_tokens.size();
         auto const remaining = static_cast<std::size_t>(n_past - std::min(m_keep, n_past));
         auto const last_token_begin_pos_for_remaining = (last_tokens_len - std::min(remaining >> 1, last_tokens_len));
+        if (m_context_tokens.size() == static_cast<std::size_t>(n_past) && m_keep <= n_past) {
+            m_context_tokens.resize(static_cast<std::size_t>(m_keep));
+        } else {
+            m_context_tokens.clear();
+        }
         n_past = m_keep;
+        m_draft_past = std::min(m_draft_past, m_context_tokens.size());
 
         if (last_token_begin_pos_for_remaining < m_system_prompt.size()) {
             m_embd.insert(m_embd.begin(), m_system_prompt.begin(), m_system_prompt.end());
@@ -179,58 +252,87 @@ namespace fastllama {
         return true;
     }
 
+    bool FastLlama::attach_lora(std::string_view filepath) noexcept {
+        if (m_model.use_count() > 1) {
+            get_logger().log_err(__func__, "cannot attach a LoRa adapter to a model shared by ", m_model.use_count(), " sessions\n");
+            return false;
+        }
+        return m_model->attach_lora(filepath);
+    }
+
+    bool FastLlama::detach_lora() noexcept {
+        if (m_model.use_count() > 1) {
+            get_logger().log_err(__func__, "cannot detach a LoRa adapter from a model shared by ", m_model.use_count(), " sessions\n");
+            return false;
+        }
+        return m_model->detach_lora();
+    }
+
     bool FastLlama::dump_vocab(std::string_view filepath) {
-        return m_model.dump_vocab(filepath);
+        return m_model->dump_vocab(filepath);
     }
 
     bool FastLlama::ingest(std::string prompt, bool is_system_prompt) {
-        m_model.logger.reset();
-        if (!m_model.is_valid) {
-            m_model.logger.log_err("FastLlama::ingest", "tried to ingest using invalid model");
+        get_logger().reset();
+        if (!m_model->is_valid) {
+            get_logger().log_err("FastLlama::ingest", "tried to ingest using invalid model");
             return false;
         }
 
         prompt.insert(0, 1, ' ');
 
-        auto embd_input = tokenize(m_model.vocabulary, prompt, true);
+        auto embd_input = tokenize(m_model->vocabulary, prompt, true);
 
         auto const embd_input_size = embd_input.size();
         
-        auto max_input_size = m_model.params.n_ctx - 4;
+        auto max_input_size = m_model->params.n_ctx - 4;
         if (embd_input_size > static_cast<std::size_t>(max_input_size)) {
-            m_model.logger.log_err("ingest", "prompt size(='", embd_input_size, "') exceeds maximum allowed size('", max_input_size, "')");
+            get_logger().log_err("ingest", "prompt size(='", embd_input_size, "') exceeds maximum allowed size('", max_input_size, "')");
             return false;
         }
         
         if (is_system_prompt) {
             if (m_keep < static_cast<int>(embd_input_size)) {
-                m_model.logger.log_err("ingest", "system prompt size(='", embd_input_size, "') exceeds 'n_keep'(='", m_keep, "')");
+                get_logger().log_err("ingest", "system prompt size(='", embd_input_size, "') exceeds 'n_keep'(='", m_keep, "')");
                 return false;
             }
             m_system_prompt = embd_input;
         }
 
-        auto const n_batch = m_model.n_batch;
+        auto const n_batch = m_state.n_batch;
 
-        for(auto i = 0ul; i < embd_input_size; i += static_cast<std::size_t>(n_batch)) {
+        // A fresh session copies the memory of the longest cached prefix of the prompt and evaluates only the
+        // rest. The last token is always evaluated so that the logits are the ones of the prompt.
+        auto const use_prefix_cache = n_past == 0 && m_embd.empty() && !m_state.should_put_all_logits && m_model->prefix_cache.enabled();
+        auto const n_reused = use_prefix_cache
+            ? m_model->prefix_cache.restore(m_model->params, Span<token_id_t>(embd_input.data(), embd_input_size - 1), m_state.kv_self)
+            : std::size_t{};
+
+        if (n_reused != 0) {
+            get_logger().log(__func__, "reusing ", n_reused, " cached prompt tokens\n");
+            n_past = static_cast<int>(n_reused);
+            m_context_tokens.assign(embd_input.begin(), embd_input.begin() + static_cast<std::ptrdiff_t>(n_reused));
+        }
+
+        for(auto i = n_reused; i < embd_input_size; i += static_cast<std::size_t>(n_batch)) {
             get_logger().progress(ProgressTag::Ingest, i, embd_input_size);
             auto block = std::min(static_cast<std::size_t>(n_batch), embd_input_size - i);
 
             recycle_embed_if_exceeds_context();
 
-            if (!m_embd.empty()) {
-                if (!m_model.eval(static_cast<std::size_t>(n_past), m_embd, m_logits, m_mem_per_token)) {
-                    return false;
-                }
-            }
-
-            n_past += m_embd.size();
-            m_embd.clear();
+            if (!eval_embd()) return false;
 
             std::copy_n(embd_input.begin() + static_cast<std::ptrdiff_t>(i), block, std::back_inserter(m_embd));
             std::copy_n(embd_input.begin() + static_cast<std::ptrdiff_t>(i), block, std::back_inserter(m_last_n_tokens));
         }
 
+        if (use_prefix_cache) {
+            // evaluate the last block now so the whole prompt can be cached
+            if (!eval_embd()) return false;
+
+            m_model->prefix_cache.store(m_model->params, embd_input, m_state.kv_self);
+        }
+
         get_logger().progress(ProgressTag::Ingest, embd_input_size, embd_input_size);
 
         m_last_n_tokens.clear();
@@ -246,29 +348,47 @@ namespace fastllama {
         float repeat_penalty,
         std::vector<std::string> const& stop_words
     ) {
-        m_model.logger.reset();
-        if (!m_model.is_valid) {
-            m_model.logger.log_err("FastLlama::generate", "tried to generate using invalid model");
+        get_logger().reset();
+        if (!m_model->is_valid) {
+            get_logger().log_err("FastLlama::generate", "tried to generate using invalid model");
             return false;
         }
         auto const max_token_buffer_size = std::accumulate(
             stop_words.begin(),
             stop_words.end(),
             std::size_t{},
-            [&vocab=m_model.vocabulary](auto const& max_el, auto const& el) {
+            [&vocab=m_model->vocabulary](auto const& max_el, auto const& el) {
                 return std::max(max_el, tokenize(vocab, el, false).size());
             }
         );
 
-        auto token_buffer = TokenBuffer(m_model.vocabulary, max_token_buffer_size, [&fn](auto&& s) {
+        auto token_buffer = TokenBuffer(m_model->vocabulary, max_token_buffer_size, [&fn](auto&& s) {
             fn(std::forward<decltype(s)>(s));
         });
 
         token_buffer.restore_partial_state(m_token_buffer_state);
 
-        // auto new_line_token = tokenize(m_model.vocabulary, "\n", false);
+        // auto new_line_token = tokenize(m_model->vocabulary, "\n", false);
         // auto new_line_token_id = new_line_token.front();
 
+        auto const use_draft = m_draft_model != nullptr && m_n_draft != 0;
+        m_n_drafted = m_n_accepted = m_n_verify_evals = 0;
+
+        // tokens of the last speculation round and how many of them are in the output
+        std::vector<token_id_t> speculated;
+        auto n_used = std::size_t{};
+        auto n_generated = std::size_t{};
+
+        auto const finish_speculation = [&] {
+            drop_speculated_tokens(speculated, speculated.size() - n_used);
+            if (m_n_verify_evals == 0) return;
+            auto const acceptance_rate = 100.0 * static_cast<double>(m_n_accepted) / static_cast<double>(std::max(m_n_drafted, std::size_t{1}));
+            get_logger().log(
+                "FastLlama::generate", "speculative decoding accepted ", m_n_accepted, " of ", m_n_drafted, " drafted tokens (",
+                acceptance_rate, "%); ", n_generated, " tokens in ", m_n_verify_evals, " evals of the model\n"
+            );
+        };
+
         for (auto i = 0ul; i < num_tokens; ++i) {
             auto const [is_stop_token_present, to_be_flush_substr, left_out_string] = token_buffer.are_tokens_present_in_buffer(stop_words);
             
@@ -276,41 +396,265 @@ namespace fastllama {
                 fn(std::string(to_be_flush_substr));
                 m_token_buffer_state = token_buffer.get_partial_state();
                 m_token_buffer_state.left_out_string = left_out_string;
+                finish_speculation();
                 return true;
             }
 
-            recycle_embed_if_exceeds_context();
+            // the drafts get shorter near the end of the context, so the memory is recycled at the same tokens as without them
+            if (use_draft && n_used == speculated.size()) {
+                n_used = 0;
+                if (!speculate(speculated, top_k, top_p, temp, repeat_penalty)) speculated.clear();
+            }
 
-            if (!m_embd.empty()) {
-                if (!m_model.eval(static_cast<std::size_t>(n_past), m_embd, m_logits, m_mem_per_token)) {
-                    return false;
+            auto token_id = token_id_t{};
+            if (n_used < speculated.size()) {
+                token_id = speculated[n_used++];
+                // the last speculated token is pending in `m_embd`, the others are in the memory
+                if (token_id == FastLlama::EOS) {
+                    m_embd.clear();
+                    break;
                 }
+            } else {
+                recycle_embed_if_exceeds_context();
+
+                if (!eval_embd()) return false;
+
+                token_id = sample_top_p_top_k(
+                    *m_model,
+                    m_logits,
+                    m_last_n_tokens,
+                    static_cast<double>(repeat_penalty),
+                    static_cast<int   >(top_k),
+                    static_cast<double>(top_p),
+                    static_cast<double>(temp),
+                    m_rng
+                );
+                if (token_id == FastLlama::EOS) break;
+                m_embd.push_back(token_id);
             }
+            m_last_n_tokens.push_back(token_id);
+            token_buffer.add(token_id);
+            ++n_generated;
+        }
+
+        finish_speculation();
+        token_buffer.flush_buffer();
+
+        return true;
+    }
+
+    bool FastLlama::eval_embd() {
+        // the tokens recycled from a full context can be more than a batch
+        auto const n_batch = static_cast<std::size_t>(std::max(m_state.n_batch, 1));
+        for (auto i = 0ul; i < m_embd.size(); i += n_batch) {
+            auto const block = std::min(n_batch, m_embd.size() - i);
+            if (!m_model->eval(m_state, static_cast<std::size_t>(n_past) + i, Span<token_id_t>(m_embd.data() + i, block), m_logits, m_mem_per_token)) {
+                return false;
+            }
+        }
 
-            n_past += m_embd.size();
-            m_embd.clear();
+        if (m_context_tokens.size() == static_cast<std::size_t>(n_past)) {
+            m_context_tokens.insert(m_context_tokens.end(), m_embd.begin(), m_embd.end());
+        }
+
+        n_past += m_embd.size();
+        m_embd.clear();
+        return true;
+    }
+
+    bool FastLlama::set_draft_model(std::shared_ptr<Model> draft, std::size_t n_draft) {
+        if (!draft || n_draft == 0) {
+            m_draft_model.reset();
+            m_draft_state = ModelState();
+            m_n_draft = 0;
+            m_draft_past = 0;
+            return true;
+        }
+
+        if (!draft->is_valid) {
+            get_logger().log_err(__func__, "tried to use an invalid draft model\n");
+            return false;
+        }
+
+        if (draft->params.n_vocab != m_model->params.n_vocab) {
+            get_logger().log_err(__func__, "vocabulary size of the draft model(='", draft->params.n_vocab, "') does not match the model(='", m_model->params.n_vocab, "')\n");
+            return false;
+        }
+
+        if (draft->params.n_ctx < m_model->params.n_ctx) {
+            get_logger().log_err(__func__, "context size of the draft model(='", draft->params.n_ctx, "') is smaller than the model(='", m_model->params.n_ctx, "')\n");
+            return false;
+        }
 
-            auto token_id = sample_top_p_top_k(
-                m_model,
-                m_logits,
-                m_last_n_tokens,
+        auto state = ModelState();
+        state.set_threads(m_state.threads);
+        state.n_batch = m_state.n_batch;
+        state.n_spin = m_state.n_spin;
+        state.kv_self.memory_type = m_state.kv_self.memory_type;
+        if (!state.init(*draft)) {
+            get_logger().log_err(__func__, "unable to create the state of the draft model\n");
+            return false;
+        }
+
+        m_draft_model = std::move(draft);
+        m_draft_state = std::move(state);
+        m_n_draft = n_draft;
+        m_draft_past = 0;
+        return true;
+    }
+
+    bool FastLlama::speculate(std::vector<token_id_t>& tokens, float top_k, float top_p, float temp, float repeat_penalty) {
+        tokens.clear();
+
+        // the draft needs the tokens in the memory, and the model computes the logits and embeddings of the last
+        // token only, as they would be without speculation
+        auto const n_past_before = static_cast<std::size_t>(n_past);
+        if (m_embd.empty() || m_context_tokens.size() != n_past_before) return false;
+        if (m_state.should_put_all_logits || m_state.embeddings_eval_enable) return false;
+
+        auto const n_pending = m_embd.size();
+        auto const n_batch = static_cast<std::size_t>(m_state.n_batch);
+        auto const n_ctx = static_cast<std::size_t>(m_model->params.n_ctx);
+        if (n_pending >= n_batch || n_past_before + n_pending >= n_ctx) return false;
+
+        auto const n_draft = std::min({ m_n_draft, n_batch - n_pending, n_ctx - n_past_before - n_pending });
+
+        auto const failed = [this] {
+            m_draft_past = std::min(m_draft_past, static_cast<std::size_t>(n_past));
+            return false;
+        };
+
+        // bring the draft up to the memory and the pending tokens of the model
+        {
+            std::vector<token_id_t> input(m_context_tokens.begin() + static_cast<std::ptrdiff_t>(m_draft_past), m_context_tokens.end());
+            input.insert(input.end(), m_embd.begin(), m_embd.end());
+
+            auto const draft_batch = static_cast<std::size_t>(m_draft_state.n_batch);
+            for (auto i = 0ul; i < input.size(); i += draft_batch) {
+                auto const block = std::min(draft_batch, input.size() - i);
+                if (!m_draft_model->eval(m_draft_state, m_draft_past, Span<token_id_t>(input.data() + i, block), m_draft_logits, m_draft_mem_per_token)) {
+                    return failed();
+                }
+                m_draft_past += block;
+            }
+        }
+
+        auto const distribution = [&](Model const& model, Span<float> logits, RingBuffer<token_id_t> const& last_n_tokens) {
+            return sampling_distribution(
+                model,
+                logits,
+                last_n_tokens,
                 static_cast<double>(repeat_penalty),
                 static_cast<int   >(top_k),
                 static_cast<double>(top_p),
-                static_cast<double>(temp),
-                m_rng
+                static_cast<double>(temp)
             );
-            if (token_id == FastLlama::EOS) break;
-            m_last_n_tokens.push_back(token_id);
-            token_buffer.add(token_id);
-            m_embd.push_back(token_id);
+        };
+
+        // the draft samples its tokens one by one
+        auto last_n_tokens = m_last_n_tokens;
+        std::vector<token_id_t> drafted;
+        std::vector<std::vector<std::pair<double, token_id_t>>> draft_probs;
+        for (auto i = 0ul; i < n_draft; ++i) {
+            draft_probs.push_back(distribution(*m_draft_model, m_draft_logits, last_n_tokens));
+            auto const token_id = sample_from_distribution(draft_probs.back(), m_rng);
+            drafted.push_back(token_id);
+            last_n_tokens.push_back(token_id);
+
+            if (token_id == FastLlama::EOS || i + 1 == n_draft) break;
+
+            if (!m_draft_model->eval(m_draft_state, m_draft_past, Span<token_id_t>(&drafted.back(), 1), m_draft_logits, m_draft_mem_per_token)) {
+                return failed();
+            }
+            ++m_draft_past;
         }
 
-        token_buffer.flush_buffer();
+        // the model evaluates the pending and the drafted tokens at once and needs the logits of every position
+        auto input = m_embd;
+        input.insert(input.end(), drafted.begin(), drafted.end());
+
+        std::vector<float> logits;
+        auto const should_put_all_logits = std::exchange(m_state.should_put_all_logits, true);
+        auto const is_evaluated = m_model->eval(m_state, n_past_before, input, logits, m_mem_per_token);
+        m_state.should_put_all_logits = should_put_all_logits;
+        if (!is_evaluated) return failed();
+
+        auto const n_vocab = static_cast<std::size_t>(m_model->params.n_vocab);
+        // logits of the position that predicts the i-th drafted token
+        auto const row = [&](std::size_t i) {
+            return Span<float>(logits.data() + (n_pending - 1 + i) * n_vocab, n_vocab);
+        };
+
+        // probabilities indexed by token id, so the verification looks up p and q in constant time
+        auto const dense = [n_vocab](std::vector<std::pair<double, token_id_t>> const& probs) {
+            std::vector<double> res(n_vocab, 0.0);
+            for (auto const& [p, id] : probs) res[static_cast<std::size_t>(id)] = p;
+            return res;
+        };
+
+        // A drafted token is accepted with probability min(1, p / q), where p and q are the probabilities the
+        // model and the draft give it; the first rejected token is replaced by a sample of max(0, p - q). This
+        // keeps the output distributed as if the model sampled every token itself.
+        last_n_tokens = m_last_n_tokens;
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        auto n_accepted = std::size_t{};
+        auto is_rejected = false;
+        while (n_accepted < drafted.size()) {
+            auto const token_id = drafted[n_accepted];
+            auto const probs = distribution(*m_model, row(n_accepted), last_n_tokens);
+            auto const p = dense(probs);
+            auto const q = dense(draft_probs[n_accepted]);
+
+            if (uniform(m_rng) * q[static_cast<std::size_t>(token_id)] < p[static_cast<std::size_t>(token_id)]) {
+                tokens.push_back(token_id);
+                last_n_tokens.push_back(token_id);
+                ++n_accepted;
+                if (token_id == FastLlama::EOS) break;
+                continue;
+            }
+
+            std::vector<std::pair<double, token_id_t>> residual;
+            for (auto const& [p_id, id] : probs) {
+                auto const r = p_id - q[static_cast<std::size_t>(id)];
+                if (r > 0.0) residual.emplace_back(r, id);
+            }
+            tokens.push_back(sample_from_distribution(residual.empty() ? probs : residual, m_rng));
+            is_rejected = true;
+            break;
+        }
 
+        // every drafted token is accepted, so the model samples one more from the last position
+        if (!is_rejected && tokens.back() != FastLlama::EOS) {
+            tokens.push_back(sample_from_distribution(distribution(*m_model, row(drafted.size()), last_n_tokens), m_rng));
+        }
+
+        ++m_n_verify_evals;
+        m_n_drafted += drafted.size();
+        m_n_accepted += n_accepted;
+
+        // all the output tokens but the last are in the memory now
+        m_context_tokens.insert(m_context_tokens.end(), m_embd.begin(), m_embd.end());
+        m_context_tokens.insert(m_context_tokens.end(), tokens.begin(), tokens.end() - 1);
+        n_past += static_cast<int>(n_pending + tokens.size() - 1);
+
+        auto const last_logits = row(tokens.size() - 1);
+        m_logits.assign(last_logits.begin(), last_logits.end());
+        m_embd.assign(1, tokens.back());
+        m_draft_past = std::min(m_draft_past, static_cast<std::size_t>(n_past));
         return true;
     }
 
+    void FastLlama::drop_speculated_tokens(std::vector<token_id_t> const& tokens, std::size_t n_unused) {
+        if (n_unused == 0) return;
+
+        // the memory rolls back to the state it would have after the last used token
+        auto const n_used = tokens.size() - n_unused;
+        n_past -= static_cast<int>(n_unused);
+        m_context_tokens.resize(static_cast<std::size_t>(n_past));
+        m_embd.assign(1, tokens[n_used - 1]);
+        m_draft_past = std::min(m_draft_past, static_cast<std::size_t>(n_past));
+    }
+
     static auto softmax(std::vector<float> &prob_out, Span<float> logits) {
         if (logits.empty()) return;
         prob_out.resize(logits.size());
@@ -329,13 +673,13 @@ namespace fastllama {
     }
 
     std::optional<float> FastLlama::perplexity(std::string_view prompt) {
-        auto old_all_logits = m_model.should_put_all_logits;
-        m_model.should_put_all_logits = true;
+        auto old_all_logits = m_state.should_put_all_logits;
+        m_state.should_put_all_logits = true;
 
-        auto const tokens = tokenize(m_model.vocabulary, prompt, true);
+        auto const tokens = tokenize(m_model->vocabulary, prompt, true);
 
         auto count = std::size_t{};
-        auto const block_size = static_cast<std::size_t>(m_model.n_batch);
+        auto const block_size = static_cast<std::size_t>(m_state.n_batch);
         auto const token_len = tokens.size();
         auto const q_blocks = token_len / block_size;
         auto const r_block = token_len % block_size;
@@ -356,8 +700,8 @@ namespace fastllama {
 
             auto const start_time = std::chrono::high_resolution_clock::now();
 
-            if (!m_model.eval(0, embd_input, m_logits, m_mem_per_token)) {
-                m_model.should_put_all_logits = old_all_logits;
+            if (!m_model->eval(m_state, 0, embd_input, m_logits, m_mem_per_token)) {
+                m_state.should_put_all_logits = old_all_logits;
                 return {};
             }
             
@@ -393,7 +737,7 @@ namespace fastllama {
             // process the entire prompt.
 
             auto logits = get_logits();
-            auto const vocab_size = static_cast<std::size_t>(m_model.params.n_vocab);
+            auto const vocab_size = static_cast<std::size_t>(m_model->params.n_vocab);
             
             for(auto j = (block >> 1); j < block - 1; ++j) {
                 auto const start_pos = j * vocab_size;
@@ -417,7 +761,7 @@ namespace fastllama {
             get_logger().log(__func__, std::string_view{ fstring, static_cast<std::size_t>(len) });
         }
 
-        m_model.should_put_all_logits = old_all_logits;
+        m_state.should_put_all_logits = old_all_logits;
         return { res };
     }
 
@@ -465,7 +809,7 @@ namespace fastllama {
 
         get_logger().log(__func__, "saving system prompt\n");
 
-        return m_model.save_state(writer);
+        return m_state.save_state(writer, get_logger());
     }
 
     bool FastLlama::load_state(std::string_view filepath) noexcept {
@@ -521,7 +865,11 @@ namespace fastllama {
 
         get_logger().log(__func__, "loading system prompt\n");
 
-        return m_model.load_state(reader);
+        // the state does not record the tokens in the memory, so the draft model sits out until the next reset
+        m_context_tokens.clear();
+        m_draft_past = 0;
+
+        return m_state.load_state(reader, get_logger());
     }
 
     bool FastLlama::reset() noexcept {
@@ -531,8 +879,10 @@ namespace fastllama {
         m_logits.clear();
         m_system_prompt.clear();
         m_embd.clear();
+        m_context_tokens.clear();
+        m_draft_past = 0;
         m_rng = std::mt19937(static_cast<std::size_t>(m_seed));
-        auto const res = m_model.reset();
+        auto const res = m_state.reset();
         get_logger().log(__func__, "reset completed.\n");
         return res;
     }
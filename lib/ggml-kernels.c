@@ -0,0 +1,1723 @@
+// Kernels that ggml selects at runtime. This file is compiled once per instruction set; every build defines the
+// table named by GGML_KERNEL_VARIANT, and ggml_init picks the best table the CPU supports (see ggml_select_kernels).
+#include "ggml-impl.h"
+
+#if !defined(GGML_KERNEL_VARIANT)
+#define GGML_KERNEL_VARIANT base
+#endif
+
+#define GGML_KERNEL_CONCAT_(a, b) a ## b
+#define GGML_KERNEL_CONCAT(a, b)  GGML_KERNEL_CONCAT_(a, b)
+#define GGML_KERNEL_STRING_(a)    #a
+#define GGML_KERNEL_STRING(a)     GGML_KERNEL_STRING_(a)
+
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__) && defined(__AVX512VNNI__)
+#define GGML_AVX512_VNNI
+#endif
+
+//
+// quantization
+//
+
+static void quantize_row_q8_0(const float * restrict x, void * restrict vy, int k) {
+    assert(k % QK8_0 == 0);
+    const int nb = k / QK8_0;
+
+    block_q8_0 * restrict y = vy;
+
+#if defined(__ARM_NEON)
+    for (int i = 0; i < nb; i++) {
+        float32x4_t srcv [8];
+        float32x4_t asrcv[8];
+        float32x4_t amaxv[8];
+
+        for (int l = 0; l < 8; l++) srcv[l]  = vld1q_f32(x + i*32 + 4*l);
+        for (int l = 0; l < 8; l++) asrcv[l] = vabsq_f32(srcv[l]);
+
+        for (int l = 0; l < 4; l++) amaxv[2*l] = vmaxq_f32(asrcv[2*l], asrcv[2*l+1]);
+        for (int l = 0; l < 2; l++) amaxv[4*l] = vmaxq_f32(amaxv[4*l], amaxv[4*l+2]);
+        for (int l = 0; l < 1; l++) amaxv[8*l] = vmaxq_f32(amaxv[8*l], amaxv[8*l+4]);
+
+        const float amax = vmaxvq_f32(amaxv[0]);
+
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = d;
+
+        int32x4_t accv = vdupq_n_s32(0);
+
+        for (int l = 0; l < 8; l++) {
+            const float32x4_t v  = vmulq_n_f32(srcv[l], id);
+            const int32x4_t   vi = vcvtnq_s32_f32(v);
+
+            y[i].qs[4*l + 0] = vgetq_lane_s32(vi, 0);
+            y[i].qs[4*l + 1] = vgetq_lane_s32(vi, 1);
+            y[i].qs[4*l + 2] = vgetq_lane_s32(vi, 2);
+            y[i].qs[4*l + 3] = vgetq_lane_s32(vi, 3);
+
+            accv = vaddq_s32(accv, vi);
+        }
+        int32_t sum = vaddvq_s32(accv);
+        y[i].s = d * sum;
+    }
+#elif defined(__AVX2__) || defined(__AVX__)
+    for (int i = 0; i < nb; i++) {
+        // Load elements into 4 AVX vectors
+        __m256 v0 = _mm256_loadu_ps( x );
+        __m256 v1 = _mm256_loadu_ps( x + 8 );
+        __m256 v2 = _mm256_loadu_ps( x + 16 );
+        __m256 v3 = _mm256_loadu_ps( x + 24 );
+        x += 32;
+
+        // Compute max(abs(e)) for the block
+        const __m256 signBit = _mm256_set1_ps( -0.0f );
+        __m256 maxAbs = _mm256_andnot_ps( signBit, v0 );
+        maxAbs = _mm256_max_ps( maxAbs, _mm256_andnot_ps( signBit, v1 ) );
+        maxAbs = _mm256_max_ps( maxAbs, _mm256_andnot_ps( signBit, v2 ) );
+        maxAbs = _mm256_max_ps( maxAbs, _mm256_andnot_ps( signBit, v3 ) );
+
+        __m128 max4 = _mm_max_ps( _mm256_extractf128_ps( maxAbs, 1 ), _mm256_castps256_ps128( maxAbs ) );
+        max4 = _mm_max_ps( max4, _mm_movehl_ps( max4, max4 ) );
+        max4 = _mm_max_ss( max4, _mm_movehdup_ps( max4 ) );
+        const float maxScalar = _mm_cvtss_f32( max4 );
+
+        // Quantize these floats
+        const float d = maxScalar / 127.f;
+        y[i].d = d;
+        const float id = ( maxScalar != 0.0f ) ? 127.f / maxScalar : 0.0f;
+        const __m256 mul = _mm256_set1_ps( id );
+
+        // Apply the multiplier
+        v0 = _mm256_mul_ps( v0, mul );
+        v1 = _mm256_mul_ps( v1, mul );
+        v2 = _mm256_mul_ps( v2, mul );
+        v3 = _mm256_mul_ps( v3, mul );
+
+        // Round to nearest integer
+        v0 = _mm256_round_ps( v0, _MM_ROUND_NEAREST );
+        v1 = _mm256_round_ps( v1, _MM_ROUND_NEAREST );
+        v2 = _mm256_round_ps( v2, _MM_ROUND_NEAREST );
+        v3 = _mm256_round_ps( v3, _MM_ROUND_NEAREST );
+
+        // Convert floats to integers
+        __m256i i0 = _mm256_cvtps_epi32( v0 );
+        __m256i i1 = _mm256_cvtps_epi32( v1 );
+        __m256i i2 = _mm256_cvtps_epi32( v2 );
+        __m256i i3 = _mm256_cvtps_epi32( v3 );
+
+#if defined(__AVX2__)
+
+        // Compute the sum of the quants and set y[i].s
+        y[i].s = d * horizontal_sum(_mm256_add_epi32(_mm256_add_epi32(i0, i1), _mm256_add_epi32(i2, i3)));
+
+        // Convert int32 to int16
+        i0 = _mm256_packs_epi32( i0, i1 );	// 0, 1, 2, 3,  8, 9, 10, 11,  4, 5, 6, 7, 12, 13, 14, 15
+        i2 = _mm256_packs_epi32( i2, i3 );	// 16, 17, 18, 19,  24, 25, 26, 27,  20, 21, 22, 23, 28, 29, 30, 31
+                                            // Convert int16 to int8
+        i0 = _mm256_packs_epi16( i0, i2 );	// 0, 1, 2, 3,  8, 9, 10, 11,  16, 17, 18, 19,  24, 25, 26, 27,  4, 5, 6, 7, 12, 13, 14, 15, 20, 21, 22, 23, 28, 29, 30, 31
+
+        // We got our precious signed bytes, but the order is now wrong
+        // These AVX2 pack instructions process 16-byte pieces independently
+        // The following instruction is fixing the order
+        const __m256i perm = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+        i0 = _mm256_permutevar8x32_epi32( i0, perm );
+
+        _mm256_storeu_si256((__m256i *)y[i].qs, i0);
+#else
+        // Since we don't have in AVX some necessary functions,
+        // we split the registers in half and call AVX2 analogs from SSE
+        __m128i ni0 = _mm256_castsi256_si128( i0 );
+        __m128i ni1 = _mm256_extractf128_si256( i0, 1);
+        __m128i ni2 = _mm256_castsi256_si128( i1 );
+        __m128i ni3 = _mm256_extractf128_si256( i1, 1);
+        __m128i ni4 = _mm256_castsi256_si128( i2 );
+        __m128i ni5 = _mm256_extractf128_si256( i2, 1);
+        __m128i ni6 = _mm256_castsi256_si128( i3 );
+        __m128i ni7 = _mm256_extractf128_si256( i3, 1);
+
+        // Convert int32 to int16
+        ni0 = _mm_packs_epi32( ni0, ni1 );
+        ni2 = _mm_packs_epi32( ni2, ni3 );
+        ni4 = _mm_packs_epi32( ni4, ni5 );
+        ni6 = _mm_packs_epi32( ni6, ni7 );
+        // Convert int16 to int8
+        ni0 = _mm_packs_epi16( ni0, ni2 );
+        ni4 = _mm_packs_epi16( ni4, ni6 );
+
+        _mm_storeu_si128((__m128i *)(y[i].qs +  0), ni0);
+        _mm_storeu_si128((__m128i *)(y[i].qs + 16), ni4);
+#endif
+    }
+#else
+    // scalar
+    quantize_row_q8_0_reference(x, y, k);
+#endif
+#if defined __AVX__
+    // TODO: vectorize this
+    for (int i=0; i<nb; ++i) {
+        int sum = 0;
+        for (int l=0; l<QK8_0; ++l) sum += y[i].qs[l];
+        y[i].s = y[i].d * sum;
+    }
+#endif
+}
+
+//
+// dot products
+//
+
+#if defined(GGML_AVX512_VNNI)
+// The AVX-512 kernels evaluate two q8_0 blocks per iteration. The 4-bit quants stay unsigned so vpdpbusd can
+// multiply them with the signed q8_0 quants directly; the offset of the format is applied through the sums of y.
+
+// Unpack 64 4-bit fields into 64 bytes, each one in [ 0 .. 15 ] interval
+static inline __m512i bytes_from_nibbles_64(__m256i packed) {
+    // Expand bytes into uint16_t values
+    const __m512i bytes = _mm512_cvtepu8_epi16(packed);
+
+    // Unpack values into individual bytes
+    const __m512i lowMask = _mm512_set1_epi8(0xF);
+    __m512i high = _mm512_andnot_si512(lowMask, bytes);
+    __m512i low  = _mm512_and_si512(lowMask, bytes);
+    high = _mm512_slli_epi16(high, 4);
+    return _mm512_or_si512(low, high);
+}
+
+// Load the quants of two consecutive q8_0 blocks
+static inline __m512i bytes_from_q8_0_pair(const block_q8_0 * restrict y) {
+    const __m256i y0 = _mm256_loadu_si256((const __m256i *)y[0].qs);
+    const __m256i y1 = _mm256_loadu_si256((const __m256i *)y[1].qs);
+    return _mm512_inserti64x4(_mm512_castsi256_si512(y0), y1, 1);
+}
+
+// Load the quants of four consecutive 16-element blocks (q4_2 / q4_3), 8 bytes each
+static inline __m256i nibbles_from_quarter_blocks(const uint8_t * q0, const uint8_t * q1, const uint8_t * q2, const uint8_t * q3) {
+    const __m128i lo = _mm_unpacklo_epi64(_mm_loadu_si64(q0), _mm_loadu_si64(q1));
+    const __m128i hi = _mm_unpacklo_epi64(_mm_loadu_si64(q2), _mm_loadu_si64(q3));
+    return _mm256_set_m128i(hi, lo);
+}
+
+// Broadcast a, b, c, d to lanes 0-3, 4-7, 8-11 and 12-15
+static inline __m512 spread_quarter_scales(float a, float b, float c, float d) {
+    const __m512i idx = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+    return _mm512_permutexvar_ps(idx, _mm512_castps128_ps512(_mm_set_ps(d, c, b, a)));
+}
+#endif
+
+static void ggml_vec_dot_q4_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nb % 2 == 0);
+
+    const block_q4_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+#if defined(GGML_AVX512_VNNI)
+    __m512 acc = _mm512_setzero_ps();
+    float sum8 = 0.0f;
+
+    // an odd row ends with a single block, which is paired with a zero block
+    block_q4_0 xt[2] = {0};
+    block_q8_0 yt[2] = {0};
+    if (nb % 2) {
+        xt[0] = x[nb - 1];
+        yt[0] = y[nb - 1];
+    }
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_0 * restrict xi = i + 1 < nb ? x + i : xt;
+        const block_q8_0 * restrict yi = i + 1 < nb ? y + i : yt;
+
+        const __m512 d = _mm512_mask_blend_ps(0xFF00, _mm512_set1_ps(xi[0].d*yi[0].d), _mm512_set1_ps(xi[1].d*yi[1].d));
+
+        const __m128i qx0 = _mm_loadu_si128((const __m128i *)xi[0].qs);
+        const __m128i qx1 = _mm_loadu_si128((const __m128i *)xi[1].qs);
+        const __m512i bx = bytes_from_nibbles_64(_mm256_set_m128i(qx1, qx0));
+        const __m512i by = bytes_from_q8_0_pair(yi);
+
+        const __m512i xy_q = _mm512_dpbusd_epi32(_mm512_setzero_si512(), bx, by);
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(xy_q), acc);
+
+        // the quants are offset by 8
+        sum8 += xi[0].d*yi[0].s + xi[1].d*yi[1].s;
+    }
+
+    sumf = _mm512_reduce_add_ps(acc) - 8*sum8;
+#elif defined(__ARM_NEON)
+    float32x4_t sumv0 = vdupq_n_f32(0.0f);
+    float32x4_t sumv1 = vdupq_n_f32(0.0f);
+
+    float sum8 = 0;
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_0 * restrict x0 = &x[i + 0];
+        const block_q4_0 * restrict x1 = &x[i + 1];
+        const block_q8_0 * restrict y0 = &y[i + 0];
+        const block_q8_0 * restrict y1 = &y[i + 1];
+
+        sum8 += x0->d * y0->s + x1->d * y1->s;
+
+        const uint8x16_t m4b   = vdupq_n_u8(0xf);
+
+        const uint8x16_t v0_0 = vld1q_u8(x0->qs);
+        const uint8x16_t v0_1 = vld1q_u8(x1->qs);
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8  (v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8  (v0_1, m4b));
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+        // load y
+        const int8x16_t v1_0l = vld1q_s8(y0->qs);
+        const int8x16_t v1_0h = vld1q_s8(y0->qs + 16);
+        const int8x16_t v1_1l = vld1q_s8(y1->qs);
+        const int8x16_t v1_1h = vld1q_s8(y1->qs + 16);
+
+        // interleave
+        const int8x16_t v1_0ls = vuzp1q_s8(v1_0l, v1_0h);
+        const int8x16_t v1_0hs = vuzp2q_s8(v1_0l, v1_0h);
+        const int8x16_t v1_1ls = vuzp1q_s8(v1_1l, v1_1h);
+        const int8x16_t v1_1hs = vuzp2q_s8(v1_1l, v1_1h);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        // dot product into int32x4_t
+        const int32x4_t p_0 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_0l, v1_0ls), v0_0h, v1_0hs);
+        const int32x4_t p_1 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_1l, v1_1ls), v0_1h, v1_1hs);
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(p_0), x0->d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(p_1), x1->d*y1->d);
+#else
+        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0l), vget_low_s8 (v1_0ls));
+        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0l), vget_high_s8(v1_0ls));
+        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0h), vget_low_s8 (v1_0hs));
+        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0h), vget_high_s8(v1_0hs));
+
+        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1l), vget_low_s8 (v1_1ls));
+        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1l), vget_high_s8(v1_1ls));
+        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1h), vget_low_s8 (v1_1hs));
+        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1h), vget_high_s8(v1_1hs));
+
+        const int32x4_t pl0 = vaddq_s32(vpaddlq_s16(pl0l), vpaddlq_s16(pl0h));
+        const int32x4_t ph0 = vaddq_s32(vpaddlq_s16(ph0l), vpaddlq_s16(ph0h));
+        const int32x4_t pl1 = vaddq_s32(vpaddlq_s16(pl1l), vpaddlq_s16(pl1h));
+        const int32x4_t ph1 = vaddq_s32(vpaddlq_s16(ph1l), vpaddlq_s16(ph1h));
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vaddq_s32(pl0, ph0)), x0->d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vaddq_s32(pl1, ph1)), x1->d*y1->d);
+#endif
+    }
+
+    sumf = vaddvq_f32(sumv0) + vaddvq_f32(sumv1) - 8 * sum8;
+#elif defined(__AVX2__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; ++i) {
+        /* Compute combined scale for the block */
+        const __m256 d = _mm256_mul_ps( _mm256_broadcast_ss( &x[i].d ), _mm256_broadcast_ss( &y[i].d ) );
+
+        __m256i bx = bytes_from_nibbles_32(x[i].qs);
+
+        // Now we have a vector with bytes in [ 0 .. 15 ] interval. Offset them into [ -8 .. +7 ] interval.
+        const __m256i off = _mm256_set1_epi8( 8 );
+        bx = _mm256_sub_epi8( bx, off );
+
+        __m256i by = _mm256_loadu_si256((const __m256i *)y[i].qs);
+
+        // Get absolute values of x vectors
+        const __m256i ax = _mm256_sign_epi8(bx, bx);
+
+        // Sign the values of the y vectors
+        const __m256i sy = _mm256_sign_epi8(by, bx);
+
+        // Perform multiplication and create 16-bit values
+        const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i xy_q = _mm256_madd_epi16(ones, dot);
+
+        /* Convert to vectore of 8 int32_t to 8 floats */
+        __m256 q = _mm256_cvtepi32_ps( xy_q );
+
+        /* Multiply q with scale and accumulate */
+        acc = _mm256_fmadd_ps( d, q, acc );
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res );
+#elif defined(__AVX__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; ++i) {
+        // Compute combined scale for the block
+        const __m256 d = _mm256_mul_ps( _mm256_broadcast_ss( &x[i].d ), _mm256_broadcast_ss( &y[i].d ) );
+
+        __m128i i32[2];
+        for (int j = 0; j < 2; ++j) {
+            // Load 8 bytes, and unpack 4 bit fields into bytes, making 16 bytes
+            __m128i bx = bytes_from_nibbles_16(x[i].qs + 8*j);
+            __m128i by = _mm_loadu_si128((const __m128i *)(y[i].qs + 16*j));
+
+            // Now we have a vector with bytes in [ 0 .. 15 ] interval. Offset them into [ -8 .. +7 ] interval.
+            const __m128i off = _mm_set1_epi8( 8 );
+            bx = _mm_sub_epi8( bx, off );
+
+            // Get absolute values of x vectors
+            const __m128i ax = _mm_sign_epi8(bx, bx);
+
+            // Sign the values of the y vectors
+            const __m128i sy = _mm_sign_epi8(by, bx);
+
+            // Perform multiplication and create 16-bit values
+            const __m128i dot = _mm_maddubs_epi16(ax, sy);
+
+            const __m128i ones = _mm_set1_epi16(1);
+            i32[j] = _mm_madd_epi16(ones, dot);
+        }
+
+        // Convert int32_t to float
+        __m256 p = _mm256_cvtepi32_ps( _mm256_set_m128i( i32[0], i32[1] ));
+        // Apply the scale, and accumulate
+        acc = _mm256_add_ps(_mm256_mul_ps( d, p ), acc);
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res );
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float d0 = x[i].d;
+        const float d1 = y[i].d;
+
+        const uint8_t * restrict p0 = x[i].qs;
+        const  int8_t * restrict p1 = y[i].qs;
+
+        int sumi = 0;
+        for (int j = 0; j < QK8_0/2; j++) {
+            const uint8_t v0 = p0[j];
+
+            const int i0 = (int8_t) (v0 & 0xf) - 8;
+            const int i1 = (int8_t) (v0 >> 4)  - 8;
+
+            const int i2 = p1[2*j + 0];
+            const int i3 = p1[2*j + 1];
+
+            sumi += i0*i2 + i1*i3;
+        }
+        sumf += d0*d1*sumi;
+    }
+#endif
+
+    *s = sumf;
+}
+
+static void ggml_vec_dot_q4_1_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nb % 2 == 0);
+
+    const block_q4_1 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+    // TODO: add AVX / WASM SIMD / etc
+#if defined(GGML_AVX512_VNNI)
+    __m512 acc = _mm512_setzero_ps();
+    float summs = 0.0f;
+
+    // an odd row ends with a single block, which is paired with a zero block
+    block_q4_1 xt[2] = {0};
+    block_q8_0 yt[2] = {0};
+    if (nb % 2) {
+        xt[0] = x[nb - 1];
+        yt[0] = y[nb - 1];
+    }
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_1 * restrict xi = i + 1 < nb ? x + i : xt;
+        const block_q8_0 * restrict yi = i + 1 < nb ? y + i : yt;
+
+        const __m512 d = _mm512_mask_blend_ps(0xFF00, _mm512_set1_ps(xi[0].d*yi[0].d), _mm512_set1_ps(xi[1].d*yi[1].d));
+
+        const __m128i qx0 = _mm_loadu_si128((const __m128i *)xi[0].qs);
+        const __m128i qx1 = _mm_loadu_si128((const __m128i *)xi[1].qs);
+        const __m512i bx = bytes_from_nibbles_64(_mm256_set_m128i(qx1, qx0));
+        const __m512i by = bytes_from_q8_0_pair(yi);
+
+        const __m512i xy_q = _mm512_dpbusd_epi32(_mm512_setzero_si512(), bx, by);
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(xy_q), acc);
+
+        summs += xi[0].m*yi[0].s + xi[1].m*yi[1].s;
+    }
+
+    sumf = _mm512_reduce_add_ps(acc) + summs;
+#elif defined(__ARM_NEON)
+    float32x4_t sumv0 = vdupq_n_f32(0.0f);
+    float32x4_t sumv1 = vdupq_n_f32(0.0f);
+
+    float summs = 0;
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_1 * restrict x0 = &x[i + 0];
+        const block_q4_1 * restrict x1 = &x[i + 1];
+        const block_q8_0 * restrict y0 = &y[i + 0];
+        const block_q8_0 * restrict y1 = &y[i + 1];
+
+        summs += x0->m * y0->s + x1->m * y1->s;
+
+        const uint8x16_t m4b = vdupq_n_u8(0xf);
+
+        const uint8x16_t v0_0 = vld1q_u8(x0->qs);
+        const uint8x16_t v0_1 = vld1q_u8(x1->qs);
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8  (v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8  (v0_1, m4b));
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+        // load y
+        const int8x16_t v1_0l = vld1q_s8(y0->qs);
+        const int8x16_t v1_0h = vld1q_s8(y0->qs + 16);
+        const int8x16_t v1_1l = vld1q_s8(y1->qs);
+        const int8x16_t v1_1h = vld1q_s8(y1->qs + 16);
+
+        // interleave
+        const int8x16_t v1_0ls = vuzp1q_s8(v1_0l, v1_0h);
+        const int8x16_t v1_0hs = vuzp2q_s8(v1_0l, v1_0h);
+        const int8x16_t v1_1ls = vuzp1q_s8(v1_1l, v1_1h);
+        const int8x16_t v1_1hs = vuzp2q_s8(v1_1l, v1_1h);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        // dot product into int32x4_t
+        const int32x4_t p_0 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_0l, v1_0ls), v0_0h, v1_0hs);
+        const int32x4_t p_1 = vdotq_s32(vdotq_s32(vdupq_n_s32(0), v0_1l, v1_1ls), v0_1h, v1_1hs);
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(p_0), x0->d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(p_1), x1->d*y1->d);
+#else
+        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0l), vget_low_s8 (v1_0ls));
+        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0l), vget_high_s8(v1_0ls));
+        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0h), vget_low_s8 (v1_0hs));
+        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0h), vget_high_s8(v1_0hs));
+
+        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1l), vget_low_s8 (v1_1ls));
+        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1l), vget_high_s8(v1_1ls));
+        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1h), vget_low_s8 (v1_1hs));
+        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1h), vget_high_s8(v1_1hs));
+
+        const int32x4_t pl0 = vaddq_s32(vpaddlq_s16(pl0l), vpaddlq_s16(pl0h));
+        const int32x4_t ph0 = vaddq_s32(vpaddlq_s16(ph0l), vpaddlq_s16(ph0h));
+        const int32x4_t pl1 = vaddq_s32(vpaddlq_s16(pl1l), vpaddlq_s16(pl1h));
+        const int32x4_t ph1 = vaddq_s32(vpaddlq_s16(ph1l), vpaddlq_s16(ph1h));
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vaddq_s32(pl0, ph0)), x0->d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vaddq_s32(pl1, ph1)), x1->d*y1->d);
+#endif
+    }
+
+    sumf = vaddvq_f32(sumv0) + vaddvq_f32(sumv1) + summs;
+#elif defined(__AVX2__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    float summs = 0;
+
+    // Main loop
+    for (int i = 0; i < nb; ++i) {
+        const float * d0 = &x[i].d;
+        const float * d1 = &y[i].d;
+        //const float * m0 = &x[i].m;
+
+        summs += x[i].m * y[i].s;
+
+        const __m256 d0v = _mm256_broadcast_ss( d0 );
+        const __m256 d1v = _mm256_broadcast_ss( d1 );
+
+        // Compute combined scales
+        const __m256 d0d1 = _mm256_mul_ps( d0v, d1v );
+
+        // Load 16 bytes, and unpack 4 bit fields into bytes, making 32 bytes
+        const __m256i bx = bytes_from_nibbles_32(x[i].qs);
+        const __m256i by = _mm256_loadu_si256( (const __m256i *)y[i].qs );
+
+        // Get absolute values of x vectors
+        const __m256i ax = _mm256_sign_epi8( bx, bx );
+
+        // Sign the values of the y vectors
+        const __m256i sy = _mm256_sign_epi8( by, bx );
+
+        // Perform multiplication and create 16-bit values
+        const __m256i dot = _mm256_maddubs_epi16( ax, sy );
+        const __m256i ones = _mm256_set1_epi16( 1 );
+        const __m256i xy_q = _mm256_madd_epi16( ones, dot );
+
+        // Convert to vector of 8 int32_t to 8 floats
+        const __m256 xy = _mm256_cvtepi32_ps( xy_q );
+
+        // Accumulate d0*d1*x*y
+        acc = _mm256_fmadd_ps( d0d1, xy, acc );
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res ) + summs;
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const float d0 = x[i].d;
+        const float m0 = x[i].m;
+        const float d1 = y[i].d;
+
+        const uint8_t * restrict p0 = x[i].qs;
+        const  int8_t * restrict p1 = y[i].qs;
+
+        // TODO: this is very slow ..
+        for (int j = 0; j < QK8_0/2; j++) {
+            const uint8_t v0 = p0[j];
+
+            const float f0 = d0*(v0 & 0xf) + m0;
+            const float f1 = d0*(v0 >> 4)  + m0;
+
+            const float f2 = d1*p1[2*j + 0];
+            const float f3 = d1*p1[2*j + 1];
+
+            sumf += f0*f2 + f1*f3;
+        }
+    }
+#endif
+
+    *s = sumf;
+}
+
+static void ggml_vec_dot_q4_2_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nb % 2 == 0);
+    assert(QK8_0 == 2*QK4_2);
+
+    const block_q4_2 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+#if defined(GGML_AVX512_VNNI)
+    __m512 acc = _mm512_setzero_ps();
+
+    // every 16-element block has its own scale, so the offset is removed from the integer sums of its lanes
+    const __m512i off = _mm512_set1_epi8(8);
+
+    // an odd row ends with a single block, which is paired with a zero block
+    block_q4_2 xt[4] = {0};
+    block_q8_0 yt[2] = {0};
+    if (nb % 2) {
+        xt[0] = x[2*(nb - 1) + 0];
+        xt[1] = x[2*(nb - 1) + 1];
+        yt[0] = y[nb - 1];
+    }
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_2 * restrict xi = i + 1 < nb ? x + 2*i : xt;
+        const block_q8_0 * restrict yi = i + 1 < nb ? y + i : yt;
+
+        const __m512 d = spread_quarter_scales(
+            GGML_FP16_TO_FP32(xi[0].d)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[1].d)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[2].d)*yi[1].d,
+            GGML_FP16_TO_FP32(xi[3].d)*yi[1].d);
+
+        const __m512i bx = bytes_from_nibbles_64(nibbles_from_quarter_blocks(xi[0].qs, xi[1].qs, xi[2].qs, xi[3].qs));
+        const __m512i by = bytes_from_q8_0_pair(yi);
+
+        const __m512i xy_q = _mm512_sub_epi32(
+            _mm512_dpbusd_epi32(_mm512_setzero_si512(), bx, by),
+            _mm512_dpbusd_epi32(_mm512_setzero_si512(), off, by));
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(xy_q), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t sumv0 = vdupq_n_f32(0.0f);
+    float32x4_t sumv1 = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_2 * restrict x0_0 = &x[2*(i + 0) + 0];
+        const block_q4_2 * restrict x0_1 = &x[2*(i + 0) + 1];
+        const block_q4_2 * restrict x1_0 = &x[2*(i + 1) + 0];
+        const block_q4_2 * restrict x1_1 = &x[2*(i + 1) + 1];
+
+        const block_q8_0 * restrict y0 = &y[i + 0];
+        const block_q8_0 * restrict y1 = &y[i + 1];
+
+        const uint8x16_t m4b   = vdupq_n_u8(0xf);
+        const int8x16_t  s8b   = vdupq_n_s8(0x8);
+
+        const uint8x16_t v0_0 = vcombine_u8(vld1_u8(x0_0->qs), vld1_u8(x0_1->qs));
+        const uint8x16_t v0_1 = vcombine_u8(vld1_u8(x1_0->qs), vld1_u8(x1_1->qs));
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8  (v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8  (v0_1, m4b));
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+        // sub 8
+        const int8x16_t v0_0ls = vsubq_s8(v0_0l, s8b);
+        const int8x16_t v0_0hs = vsubq_s8(v0_0h, s8b);
+        const int8x16_t v0_1ls = vsubq_s8(v0_1l, s8b);
+        const int8x16_t v0_1hs = vsubq_s8(v0_1h, s8b);
+
+        // interleave
+        const int8x16_t v0_0lz = vzip1q_s8(v0_0ls, v0_0hs);
+        const int8x16_t v0_0hz = vzip2q_s8(v0_0ls, v0_0hs);
+        const int8x16_t v0_1lz = vzip1q_s8(v0_1ls, v0_1hs);
+        const int8x16_t v0_1hz = vzip2q_s8(v0_1ls, v0_1hs);
+
+        // load y
+        const int8x16_t v1_0l = vld1q_s8(y0->qs);
+        const int8x16_t v1_0h = vld1q_s8(y0->qs + 16);
+        const int8x16_t v1_1l = vld1q_s8(y1->qs);
+        const int8x16_t v1_1h = vld1q_s8(y1->qs + 16);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        sumv0 = vmlaq_n_f32(sumv0, vaddq_f32(
+                vmulq_n_f32(vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_0lz, v1_0l)), GGML_FP16_TO_FP32(x0_0->d)),
+                vmulq_n_f32(vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_0hz, v1_0h)), GGML_FP16_TO_FP32(x0_1->d))), y0->d);
+
+        sumv1 = vmlaq_n_f32(sumv1, vaddq_f32(
+                vmulq_n_f32(vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_1lz, v1_1l)), GGML_FP16_TO_FP32(x1_0->d)),
+                vmulq_n_f32(vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_1hz, v1_1h)), GGML_FP16_TO_FP32(x1_1->d))), y1->d);
+#else
+        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0lz), vget_low_s8 (v1_0l));
+        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0lz), vget_high_s8(v1_0l));
+        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0hz), vget_low_s8 (v1_0h));
+        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0hz), vget_high_s8(v1_0h));
+
+        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1lz), vget_low_s8 (v1_1l));
+        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1lz), vget_high_s8(v1_1l));
+        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1hz), vget_low_s8 (v1_1h));
+        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1hz), vget_high_s8(v1_1h));
+
+        const int32x4_t pl0 = vaddq_s32(vpaddlq_s16(pl0l), vpaddlq_s16(pl0h));
+        const int32x4_t ph0 = vaddq_s32(vpaddlq_s16(ph0l), vpaddlq_s16(ph0h));
+        const int32x4_t pl1 = vaddq_s32(vpaddlq_s16(pl1l), vpaddlq_s16(pl1h));
+        const int32x4_t ph1 = vaddq_s32(vpaddlq_s16(ph1l), vpaddlq_s16(ph1h));
+
+        sumv0 = vmlaq_n_f32(sumv0, vaddq_f32(
+                vmulq_n_f32(vcvtq_f32_s32(pl0), GGML_FP16_TO_FP32(x0_0->d)),
+                vmulq_n_f32(vcvtq_f32_s32(ph0), GGML_FP16_TO_FP32(x0_1->d))), y0->d);
+
+        sumv1 = vmlaq_n_f32(sumv1, vaddq_f32(
+                vmulq_n_f32(vcvtq_f32_s32(pl1), GGML_FP16_TO_FP32(x1_0->d)),
+                vmulq_n_f32(vcvtq_f32_s32(ph1), GGML_FP16_TO_FP32(x1_1->d))), y1->d);
+#endif
+    }
+
+    sumf = vaddvq_f32(sumv0) + vaddvq_f32(sumv1);
+#elif defined(__AVX2__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; i++) {
+        /* Compute combined scale for the block */
+        const __m128 d0 = _mm_set1_ps(GGML_FP16_TO_FP32(x[2*i + 0].d));
+        const __m128 d1 = _mm_set1_ps(GGML_FP16_TO_FP32(x[2*i + 1].d));
+        const __m256 d = _mm256_mul_ps(_mm256_set_m128(d1, d0), _mm256_broadcast_ss(&y[i].d));
+
+        __m128i bx0 = bytes_from_nibbles_16(x[2*i + 0].qs);
+        __m128i bx1 = bytes_from_nibbles_16(x[2*i + 1].qs);
+        __m256i bx = _mm256_set_m128i(bx1, bx0);
+
+        // Now we have a vector with bytes in [ 0 .. 15 ] interval. Offset them into [ -8 .. +7 ] interval.
+        const __m256i off = _mm256_set1_epi8(8);
+        bx = _mm256_sub_epi8(bx, off);
+
+        __m256i by = _mm256_loadu_si256((const __m256i *)y[i].qs);
+
+        // Get absolute values of x vectors
+        const __m256i ax = _mm256_sign_epi8(bx, bx);
+        // Sign the values of the y vectors
+        const __m256i sy = _mm256_sign_epi8(by, bx);
+        // Perform multiplication and create 16-bit values
+        const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i xy_q = _mm256_madd_epi16(ones, dot);
+
+        /* Convert to vectore of 8 int32_t to 8 floats */
+        __m256 q = _mm256_cvtepi32_ps(xy_q);
+
+        /* Multiply q with scale and accumulate */
+        acc = _mm256_fmadd_ps(d, q, acc);
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps(acc, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(acc));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+
+    sumf = _mm_cvtss_f32(res);
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict x0 = x[2*i + 0].qs;
+        const uint8_t * restrict x1 = x[2*i + 1].qs;
+        const  int8_t * restrict y0 = y[i].qs;
+
+        const float d0 = GGML_FP16_TO_FP32(x[2*i + 0].d);
+        const float d1 = GGML_FP16_TO_FP32(x[2*i + 1].d);
+
+        int sumi_0 = 0;
+        int sumi_1 = 0;
+
+        for (int j = 0; j < QK8_0/4; j++) {
+            const uint8_t v0 = x0[j];
+            const uint8_t v1 = x1[j];
+
+            const int i0_0 = (int8_t) (v0 & 0xf) - 8;
+            const int i1_0 = (int8_t) (v0 >> 4)  - 8;
+
+            const int i0_1 = (int8_t) (v1 & 0xf) - 8;
+            const int i1_1 = (int8_t) (v1 >> 4)  - 8;
+
+            const int i2_0 = y0[2*j + 0];
+            const int i3_0 = y0[2*j + 1];
+
+            const int i2_1 = y0[2*(j + QK8_0/4) + 0];
+            const int i3_1 = y0[2*(j + QK8_0/4) + 1];
+
+            sumi_0 += i0_0*i2_0 + i1_0*i3_0;
+            sumi_1 += i0_1*i2_1 + i1_1*i3_1;
+        }
+
+        sumf += (d0 * y[i].d) * sumi_0;
+        sumf += (d1 * y[i].d) * sumi_1;
+    }
+#endif
+
+    *s = sumf;
+}
+
+static void ggml_vec_dot_q4_3_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nb % 2 == 0);
+    assert(QK8_0 == 2*QK4_2);
+
+    const block_q4_3 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+#if defined(GGML_AVX512_VNNI)
+    __m512 acc = _mm512_setzero_ps();
+
+    const __m512i ones = _mm512_set1_epi8(1);
+
+    // an odd row ends with a single block, which is paired with a zero block
+    block_q4_3 xt[4] = {0};
+    block_q8_0 yt[2] = {0};
+    if (nb % 2) {
+        xt[0] = x[2*(nb - 1) + 0];
+        xt[1] = x[2*(nb - 1) + 1];
+        yt[0] = y[nb - 1];
+    }
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_3 * restrict xi = i + 1 < nb ? x + 2*i : xt;
+        const block_q8_0 * restrict yi = i + 1 < nb ? y + i : yt;
+
+        const __m512 d = spread_quarter_scales(
+            GGML_FP16_TO_FP32(xi[0].d)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[1].d)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[2].d)*yi[1].d,
+            GGML_FP16_TO_FP32(xi[3].d)*yi[1].d);
+
+        const __m512 m = spread_quarter_scales(
+            GGML_FP16_TO_FP32(xi[0].m)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[1].m)*yi[0].d,
+            GGML_FP16_TO_FP32(xi[2].m)*yi[1].d,
+            GGML_FP16_TO_FP32(xi[3].m)*yi[1].d);
+
+        const __m512i bx = bytes_from_nibbles_64(nibbles_from_quarter_blocks(xi[0].qs, xi[1].qs, xi[2].qs, xi[3].qs));
+        const __m512i by = bytes_from_q8_0_pair(yi);
+
+        const __m512i xy_q = _mm512_dpbusd_epi32(_mm512_setzero_si512(), bx, by);
+        const __m512i sy_q = _mm512_dpbusd_epi32(_mm512_setzero_si512(), ones, by);
+
+        acc = _mm512_fmadd_ps(d, _mm512_cvtepi32_ps(xy_q), acc);
+        acc = _mm512_fmadd_ps(m, _mm512_cvtepi32_ps(sy_q), acc);
+    }
+
+    sumf = _mm512_reduce_add_ps(acc);
+#elif defined(__ARM_NEON)
+    float32x4_t sumv0 = vdupq_n_f32(0.0f);
+    float32x4_t sumv1 = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nb; i += 2) {
+        const block_q4_3 * restrict x0_0 = &x[2*(i + 0) + 0];
+        const block_q4_3 * restrict x0_1 = &x[2*(i + 0) + 1];
+        const block_q4_3 * restrict x1_0 = &x[2*(i + 1) + 0];
+        const block_q4_3 * restrict x1_1 = &x[2*(i + 1) + 1];
+
+        const block_q8_0 * restrict y0 = &y[i + 0];
+        const block_q8_0 * restrict y1 = &y[i + 1];
+
+        const uint8x16_t m4b = vdupq_n_u8(0xf);
+
+        const float x0_0d = GGML_FP16_TO_FP32(x0_0->d);
+        const float x0_1d = GGML_FP16_TO_FP32(x0_1->d);
+        const float x1_0d = GGML_FP16_TO_FP32(x1_0->d);
+        const float x1_1d = GGML_FP16_TO_FP32(x1_1->d);
+
+        const float x0_0m = GGML_FP16_TO_FP32(x0_0->m);
+        const float x0_1m = GGML_FP16_TO_FP32(x0_1->m);
+        const float x1_0m = GGML_FP16_TO_FP32(x1_0->m);
+        const float x1_1m = GGML_FP16_TO_FP32(x1_1->m);
+
+        const uint8x16_t v0_0 = vcombine_u8(vld1_u8(x0_0->qs), vld1_u8(x0_1->qs));
+        const uint8x16_t v0_1 = vcombine_u8(vld1_u8(x1_0->qs), vld1_u8(x1_1->qs));
+
+        // 4-bit -> 8-bit
+        const int8x16_t v0_0l = vreinterpretq_s8_u8(vandq_u8  (v0_0, m4b));
+        const int8x16_t v0_0h = vreinterpretq_s8_u8(vshrq_n_u8(v0_0, 4));
+        const int8x16_t v0_1l = vreinterpretq_s8_u8(vandq_u8  (v0_1, m4b));
+        const int8x16_t v0_1h = vreinterpretq_s8_u8(vshrq_n_u8(v0_1, 4));
+
+        // interleave
+        const int8x16_t v0_0lz = vzip1q_s8(v0_0l, v0_0h);
+        const int8x16_t v0_0hz = vzip2q_s8(v0_0l, v0_0h);
+        const int8x16_t v0_1lz = vzip1q_s8(v0_1l, v0_1h);
+        const int8x16_t v0_1hz = vzip2q_s8(v0_1l, v0_1h);
+
+        // load y
+        const int8x16_t v1_0l = vld1q_s8(y0->qs);
+        const int8x16_t v1_0h = vld1q_s8(y0->qs + 16);
+        const int8x16_t v1_1l = vld1q_s8(y1->qs);
+        const int8x16_t v1_1h = vld1q_s8(y1->qs + 16);
+
+        const int16x8_t sy0_0 = vaddq_s16(vmovl_s8(vget_low_s8(v1_0l)), vmovl_s8(vget_high_s8(v1_0l)));
+        const int16x8_t sy0_1 = vaddq_s16(vmovl_s8(vget_low_s8(v1_0h)), vmovl_s8(vget_high_s8(v1_0h)));
+
+        const int16x8_t sy1_0 = vaddq_s16(vmovl_s8(vget_low_s8(v1_1l)), vmovl_s8(vget_high_s8(v1_1l)));
+        const int16x8_t sy1_1 = vaddq_s16(vmovl_s8(vget_low_s8(v1_1h)), vmovl_s8(vget_high_s8(v1_1h)));
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vaddl_s16(vget_low_s16(sy0_0), vget_high_s16(sy0_0))), x0_0m*y0->d);
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vaddl_s16(vget_low_s16(sy0_1), vget_high_s16(sy0_1))), x0_1m*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vaddl_s16(vget_low_s16(sy1_0), vget_high_s16(sy1_0))), x1_0m*y1->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vaddl_s16(vget_low_s16(sy1_1), vget_high_s16(sy1_1))), x1_1m*y1->d);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_0lz, v1_0l)), x0_0d*y0->d);
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_0hz, v1_0h)), x0_1d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_1lz, v1_1l)), x1_0d*y1->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(vdotq_s32(vdupq_n_s32(0), v0_1hz, v1_1h)), x1_1d*y1->d);
+#else
+        const int16x8_t pl0l = vmull_s8(vget_low_s8 (v0_0lz), vget_low_s8 (v1_0l));
+        const int16x8_t pl0h = vmull_s8(vget_high_s8(v0_0lz), vget_high_s8(v1_0l));
+        const int16x8_t ph0l = vmull_s8(vget_low_s8 (v0_0hz), vget_low_s8 (v1_0h));
+        const int16x8_t ph0h = vmull_s8(vget_high_s8(v0_0hz), vget_high_s8(v1_0h));
+
+        const int16x8_t pl1l = vmull_s8(vget_low_s8 (v0_1lz), vget_low_s8 (v1_1l));
+        const int16x8_t pl1h = vmull_s8(vget_high_s8(v0_1lz), vget_high_s8(v1_1l));
+        const int16x8_t ph1l = vmull_s8(vget_low_s8 (v0_1hz), vget_low_s8 (v1_1h));
+        const int16x8_t ph1h = vmull_s8(vget_high_s8(v0_1hz), vget_high_s8(v1_1h));
+
+        const int32x4_t pl0 = vaddq_s32(vpaddlq_s16(pl0l), vpaddlq_s16(pl0h));
+        const int32x4_t ph0 = vaddq_s32(vpaddlq_s16(ph0l), vpaddlq_s16(ph0h));
+        const int32x4_t pl1 = vaddq_s32(vpaddlq_s16(pl1l), vpaddlq_s16(pl1h));
+        const int32x4_t ph1 = vaddq_s32(vpaddlq_s16(ph1l), vpaddlq_s16(ph1h));
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(pl0), x0_0d*y0->d);
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(ph0), x0_1d*y0->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(pl1), x1_0d*y1->d);
+        sumv1 = vmlaq_n_f32(sumv1, vcvtq_f32_s32(ph1), x1_1d*y1->d);
+#endif
+    }
+
+    sumf = vaddvq_f32(sumv0) + vaddvq_f32(sumv1);
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict x0 = x[2*i + 0].qs;
+        const uint8_t * restrict x1 = x[2*i + 1].qs;
+        const  int8_t * restrict y0 = y[i].qs;
+
+        const float d0 = GGML_FP16_TO_FP32(x[2*i + 0].d);
+        const float m0 = GGML_FP16_TO_FP32(x[2*i + 0].m);
+        const float d1 = GGML_FP16_TO_FP32(x[2*i + 1].d);
+        const float m1 = GGML_FP16_TO_FP32(x[2*i + 1].m);
+
+        int sy_0 = 0;
+        int sy_1 = 0;
+
+        int sxy_0 = 0;
+        int sxy_1 = 0;
+
+        for (int j = 0; j < QK8_0/4; j++) {
+            const uint8_t v0 = x0[j];
+            const uint8_t v1 = x1[j];
+
+            const int x0_0 = v0 & 0xf;
+            const int x1_0 = v0 >> 4;
+
+            const int x0_1 = v1 & 0xf;
+            const int x1_1 = v1 >> 4;
+
+            const int y0_0 = y0[2*j + 0];
+            const int y1_0 = y0[2*j + 1];
+
+            const int y0_1 = y0[2*(j + QK8_0/4) + 0];
+            const int y1_1 = y0[2*(j + QK8_0/4) + 1];
+
+            sy_0 += y0_0 + y1_0;
+            sy_1 += y0_1 + y1_1;
+
+            sxy_0 += x0_0*y0_0 + x1_0*y1_0;
+            sxy_1 += x0_1*y0_1 + x1_1*y1_1;
+        }
+
+        sumf += (d0*sxy_0 + m0*sy_0)*y[i].d;
+        sumf += (d1*sxy_1 + m1*sy_1)*y[i].d;
+    }
+#endif
+
+    *s = sumf;
+}
+
+
+#if defined(__AVX2__)
+// Spread 32 bits into 32 bytes, 0xFF where the bit is set and 0x00 where it is not
+static inline __m256i bytes_from_bits_32(const uint8_t * x) {
+    uint32_t x32;
+    memcpy(&x32, x, sizeof(uint32_t));
+    const __m256i shuf_mask = _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202, 0x0101010101010101, 0x0000000000000000);
+    const __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(x32), shuf_mask);
+    const __m256i bit_mask = _mm256_set1_epi64x(0x7fbfdfeff7fbfdfe);
+    return _mm256_cmpeq_epi8(_mm256_or_si256(bytes, bit_mask), _mm256_set1_epi64x(-1));
+}
+#endif
+
+static void ggml_vec_dot_q5_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(QK8_0 == QK5_0);
+
+    const block_q5_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+#if defined(__AVX2__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; i++) {
+        /* Compute combined scale for the block */
+        const __m256 d = _mm256_mul_ps(_mm256_set1_ps(GGML_FP16_TO_FP32(x[i].d)), _mm256_broadcast_ss(&y[i].d));
+
+        // Unpack the nibbles and subtract 16 from the quants whose 5-th bit is clear, giving values in [ -16 .. 15 ]
+        __m256i bx = bytes_from_nibbles_32(x[i].qs);
+        __m256i bxhi = bytes_from_bits_32(x[i].qh);
+        bxhi = _mm256_andnot_si256(bxhi, _mm256_set1_epi8((char)0xF0));
+        bx = _mm256_or_si256(bx, bxhi);
+
+        const __m256i by = _mm256_loadu_si256((const __m256i *)y[i].qs);
+
+        // Get absolute values of x vectors
+        const __m256i ax = _mm256_sign_epi8(bx, bx);
+
+        // Sign the values of the y vectors
+        const __m256i sy = _mm256_sign_epi8(by, bx);
+
+        // Perform multiplication and create 16-bit values
+        const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+
+        const __m256i ones = _mm256_set1_epi16(1);
+        const __m256i xy_q = _mm256_madd_epi16(ones, dot);
+
+        /* Multiply q with scale and accumulate */
+        acc = _mm256_fmadd_ps(d, _mm256_cvtepi32_ps(xy_q), acc);
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res );
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const uint8_t * restrict x0 = x[i].qs;
+        const  int8_t * restrict y0 = y[i].qs;
+
+        uint32_t qh;
+        memcpy(&qh, x[i].qh, sizeof(qh));
+
+        int sumi = 0;
+        for (int j = 0; j < QK8_0/2; j++) {
+            const uint8_t v0 = x0[j];
+
+            const int xh_0 = ((qh >> (2*j + 0)) & 1) << 4;
+            const int xh_1 = ((qh >> (2*j + 1)) & 1) << 4;
+
+            const int x0_0 = ((v0 & 0x0F) | xh_0) - 16;
+            const int x0_1 = ((v0 >>   4) | xh_1) - 16;
+
+            sumi += x0_0*y0[2*j + 0] + x0_1*y0[2*j + 1];
+        }
+        sumf += GGML_FP16_TO_FP32(x[i].d)*y[i].d*sumi;
+    }
+#endif
+
+    *s = sumf;
+}
+
+static void ggml_vec_dot_q8_0_q8_0(const int n, float * restrict s, const void * restrict vx, const void * restrict vy) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+
+    const block_q8_0 * restrict x = vx;
+    const block_q8_0 * restrict y = vy;
+
+    float sumf = 0.0;
+
+#if defined(__ARM_NEON)
+    float32x4_t sumv0 = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < nb; i++) {
+        const int8x16_t x0_l = vld1q_s8(x[i].qs);
+        const int8x16_t x0_h = vld1q_s8(x[i].qs + 16);
+        const int8x16_t y0_l = vld1q_s8(y[i].qs);
+        const int8x16_t y0_h = vld1q_s8(y[i].qs + 16);
+
+#if defined(__ARM_FEATURE_DOTPROD)
+        const int32x4_t p = vdotq_s32(vdotq_s32(vdupq_n_s32(0), x0_l, y0_l), x0_h, y0_h);
+#else
+        const int16x8_t pll = vmull_s8(vget_low_s8 (x0_l), vget_low_s8 (y0_l));
+        const int16x8_t plh = vmull_s8(vget_high_s8(x0_l), vget_high_s8(y0_l));
+        const int16x8_t phl = vmull_s8(vget_low_s8 (x0_h), vget_low_s8 (y0_h));
+        const int16x8_t phh = vmull_s8(vget_high_s8(x0_h), vget_high_s8(y0_h));
+
+        const int32x4_t pl = vaddq_s32(vpaddlq_s16(pll), vpaddlq_s16(plh));
+        const int32x4_t ph = vaddq_s32(vpaddlq_s16(phl), vpaddlq_s16(phh));
+
+        const int32x4_t p = vaddq_s32(pl, ph);
+#endif
+
+        sumv0 = vmlaq_n_f32(sumv0, vcvtq_f32_s32(p), x[i].d*y[i].d);
+    }
+
+    sumf = vaddvq_f32(sumv0);
+#elif defined(__AVX2__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; ++i) {
+        /* Compute combined scale for the block */
+        const __m256 d = _mm256_mul_ps( _mm256_broadcast_ss( &x[i].d ), _mm256_broadcast_ss( &y[i].d ) );
+
+        const __m256i bx = _mm256_loadu_si256((const __m256i *)x[i].qs);
+        const __m256i by = _mm256_loadu_si256((const __m256i *)y[i].qs);
+
+        // Get absolute values of x vectors
+        const __m256i ax = _mm256_sign_epi8(bx, bx);
+
+        // Sign the values of the y vectors
+        const __m256i sy = _mm256_sign_epi8(by, bx);
+
+        // Perform multiplication and create 16-bit values
+        const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i xy_q = _mm256_madd_epi16(ones, dot);
+
+        /* Convert to vectore of 8 int32_t to 8 floats */
+        __m256 q = _mm256_cvtepi32_ps( xy_q );
+
+        /* Multiply q with scale and accumulate */
+        acc = _mm256_fmadd_ps( d, q, acc );
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res );
+#elif defined(__AVX__)
+    // Initialize accumulator with zeros
+    __m256 acc = _mm256_setzero_ps();
+
+    // Main loop
+    for (int i = 0; i < nb; ++i) {
+        // Compute combined scale for the block
+        const __m256 d = _mm256_mul_ps( _mm256_broadcast_ss( &x[i].d ), _mm256_broadcast_ss( &y[i].d ) );
+
+        __m128i i32[2];
+        for (int j = 0; j < 2; ++j) {
+            const __m128i bx = _mm_loadu_si128((const __m128i *)(x[i].qs + 16*j));
+            const __m128i by = _mm_loadu_si128((const __m128i *)(y[i].qs + 16*j));
+
+            // Get absolute values of x vectors
+            const __m128i ax = _mm_sign_epi8(bx, bx);
+
+            // Sign the values of the y vectors
+            const __m128i sy = _mm_sign_epi8(by, bx);
+
+            // Perform multiplication and create 16-bit values
+            const __m128i dot = _mm_maddubs_epi16(ax, sy);
+
+            const __m128i ones = _mm_set1_epi16(1);
+            i32[j] = _mm_madd_epi16(ones, dot);
+        }
+
+        // Convert int32_t to float
+        __m256 p = _mm256_cvtepi32_ps( _mm256_set_m128i( i32[0], i32[1] ));
+        // Apply the scale, and accumulate
+        acc = _mm256_add_ps(_mm256_mul_ps( d, p ), acc);
+    }
+
+    // Return horizontal sum of the acc vector
+    __m128 res = _mm256_extractf128_ps( acc, 1 );
+    res = _mm_add_ps( res, _mm256_castps256_ps128( acc ) );
+    res = _mm_add_ps( res, _mm_movehl_ps( res, res ) );
+    res = _mm_add_ss( res, _mm_movehdup_ps( res ) );
+
+    sumf = _mm_cvtss_f32( res );
+#else
+    // scalar
+    for (int i = 0; i < nb; i++) {
+        const int8_t * restrict p0 = x[i].qs;
+        const int8_t * restrict p1 = y[i].qs;
+
+        int sumi = 0;
+        for (int j = 0; j < QK8_0; j++) {
+            sumi += p0[j]*p1[j];
+        }
+        sumf += x[i].d*y[i].d*sumi;
+    }
+#endif
+
+    *s = sumf;
+}
+
+//
+// tiled matrix products
+//
+
+#if defined(__AVX2__)
+// The tiles are GGML_GEMM_NR rows of x by GGML_GEMM_NC columns of y. Every block of x is unpacked once and used
+// for all the columns of the tile, every block of y is loaded once and used for all the rows.
+#define GGML_GEMM_NR 2
+#define GGML_GEMM_NC 4
+
+// A block of x as 32 unsigned 4-bit quants; element j is d*q[j] + m with d and m taken from the 32-bit lane j/4
+typedef struct {
+    __m256i q;
+    __m256  d;
+    __m256  m;
+} ggml_gemm_block;
+
+typedef ggml_gemm_block (*ggml_gemm_load_t)(const void * restrict vx, int i);
+
+// Unpack the nibbles of two 16-element blocks, 8 bytes each
+static inline __m256i bytes_from_half_blocks(const uint8_t * q0, const uint8_t * q1) {
+    const __m256i bytes = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) q0), _mm_loadl_epi64((const __m128i *) q1)));
+
+    const __m256i lowMask = _mm256_set1_epi8(0xF);
+    __m256i high = _mm256_andnot_si256(lowMask, bytes);
+    __m256i low  = _mm256_and_si256(lowMask, bytes);
+    high = _mm256_slli_epi16(high, 4);
+    return _mm256_or_si256(low, high);
+}
+
+// Broadcast a to lanes 0-3 and b to lanes 4-7
+static inline __m256 spread_half_scales(float a, float b) {
+    return _mm256_set_m128(_mm_set1_ps(b), _mm_set1_ps(a));
+}
+
+static inline ggml_gemm_block ggml_gemm_load_q4_0(const void * restrict vx, int i) {
+    const block_q4_0 * restrict x = (const block_q4_0 *) vx + i;
+    const __m256 d = _mm256_set1_ps(x->d);
+    return (ggml_gemm_block){ bytes_from_nibbles_32(x->qs), d, _mm256_mul_ps(d, _mm256_set1_ps(-8.0f)) };
+}
+
+static inline ggml_gemm_block ggml_gemm_load_q4_1(const void * restrict vx, int i) {
+    const block_q4_1 * restrict x = (const block_q4_1 *) vx + i;
+    return (ggml_gemm_block){ bytes_from_nibbles_32(x->qs), _mm256_set1_ps(x->d), _mm256_set1_ps(x->m) };
+}
+
+static inline ggml_gemm_block ggml_gemm_load_q4_2(const void * restrict vx, int i) {
+    const block_q4_2 * restrict x = (const block_q4_2 *) vx + 2*i;
+    const __m256 d = spread_half_scales(GGML_FP16_TO_FP32(x[0].d), GGML_FP16_TO_FP32(x[1].d));
+    return (ggml_gemm_block){ bytes_from_half_blocks(x[0].qs, x[1].qs), d, _mm256_mul_ps(d, _mm256_set1_ps(-8.0f)) };
+}
+
+static inline ggml_gemm_block ggml_gemm_load_q4_3(const void * restrict vx, int i) {
+    const block_q4_3 * restrict x = (const block_q4_3 *) vx + 2*i;
+    return (ggml_gemm_block){
+        bytes_from_half_blocks(x[0].qs, x[1].qs),
+        spread_half_scales(GGML_FP16_TO_FP32(x[0].d), GGML_FP16_TO_FP32(x[1].d)),
+        spread_half_scales(GGML_FP16_TO_FP32(x[0].m), GGML_FP16_TO_FP32(x[1].m)),
+    };
+}
+
+// Sums of the products of groups of 4 unsigned and 4 signed bytes
+static inline __m256i dot_u8_i8_quads(__m256i u, __m256i s) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(_mm256_setzero_si256(), u, s);
+#else
+    // the pairs of products fit in int16 since u is at most 15 for the 4-bit formats
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(u, s), _mm256_set1_epi16(1));
+#endif
+}
+
+static inline float hsum_float_8(__m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+// inlined into the kernels of every format so that the loads of the blocks are inlined as well
+static GGML_ALWAYS_INLINE void ggml_gemm_q4_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict vx, const size_t bx, const void * restrict vy, const size_t by, ggml_gemm_load_t load) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+
+    const char * restrict x = vx;
+    const char * restrict y = vy;
+
+    const __m256i ones = _mm256_set1_epi8(1);
+
+    for (int r0 = 0; r0 < nr; r0 += GGML_GEMM_NR) {
+        // the rows and columns past the edges repeat the last one and are not stored
+        const void * xr[GGML_GEMM_NR];
+        for (int r = 0; r < GGML_GEMM_NR; ++r) {
+            xr[r] = x + MIN(r0 + r, nr - 1)*bx;
+        }
+
+        for (int c0 = 0; c0 < nc; c0 += GGML_GEMM_NC) {
+            const block_q8_0 * yc[GGML_GEMM_NC];
+            for (int c = 0; c < GGML_GEMM_NC; ++c) {
+                yc[c] = (const block_q8_0 *) (y + MIN(c0 + c, nc - 1)*by);
+            }
+
+            __m256 acc[GGML_GEMM_NR][GGML_GEMM_NC];
+            for (int r = 0; r < GGML_GEMM_NR; ++r) {
+                for (int c = 0; c < GGML_GEMM_NC; ++c) {
+                    acc[r][c] = _mm256_setzero_ps();
+                }
+            }
+
+            for (int i = 0; i < nb; ++i) {
+                ggml_gemm_block bx[GGML_GEMM_NR];
+                for (int r = 0; r < GGML_GEMM_NR; ++r) {
+                    bx[r] = load(xr[r], i);
+                }
+
+                for (int c = 0; c < GGML_GEMM_NC; ++c) {
+                    const __m256i qy = _mm256_loadu_si256((const __m256i *) yc[c][i].qs);
+                    const __m256  dy = _mm256_set1_ps(yc[c][i].d);
+                    const __m256  sy = _mm256_cvtepi32_ps(dot_u8_i8_quads(ones, qy));
+
+                    for (int r = 0; r < GGML_GEMM_NR; ++r) {
+                        const __m256 xy = _mm256_cvtepi32_ps(dot_u8_i8_quads(bx[r].q, qy));
+                        acc[r][c] = _mm256_fmadd_ps(dy, _mm256_fmadd_ps(bx[r].m, sy, _mm256_mul_ps(bx[r].d, xy)), acc[r][c]);
+                    }
+                }
+            }
+
+            for (int c = 0; c < GGML_GEMM_NC && c0 + c < nc; ++c) {
+                for (int r = 0; r < GGML_GEMM_NR && r0 + r < nr; ++r) {
+                    s[(c0 + c)*bs + r0 + r] = hsum_float_8(acc[r][c]);
+                }
+            }
+        }
+    }
+}
+
+static void ggml_gemm_q4_0_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict x, const size_t bx, const void * restrict y, const size_t by) {
+    ggml_gemm_q4_q8_0(n, nr, nc, s, bs, x, bx, y, by, ggml_gemm_load_q4_0);
+}
+
+static void ggml_gemm_q4_1_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict x, const size_t bx, const void * restrict y, const size_t by) {
+    ggml_gemm_q4_q8_0(n, nr, nc, s, bs, x, bx, y, by, ggml_gemm_load_q4_1);
+}
+
+static void ggml_gemm_q4_2_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict x, const size_t bx, const void * restrict y, const size_t by) {
+    ggml_gemm_q4_q8_0(n, nr, nc, s, bs, x, bx, y, by, ggml_gemm_load_q4_2);
+}
+
+static void ggml_gemm_q4_3_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict x, const size_t bx, const void * restrict y, const size_t by) {
+    ggml_gemm_q4_q8_0(n, nr, nc, s, bs, x, bx, y, by, ggml_gemm_load_q4_3);
+}
+#endif
+
+// q4_0x4 has the 4 rows of a group in each block, so its tiles are 4 rows by GGML_GEMM_X4_NC columns and nr is a
+// multiple of 4
+#if defined(__AVX2__)
+#if defined(__AVX512F__)
+#define GGML_GEMM_X4_NC 4
+#else
+#define GGML_GEMM_X4_NC 2
+#endif
+
+// Sums of the products of groups of 4 unsigned and 4 signed bytes of two pairs of vectors
+static inline __m256i dot_u8_i8_quads_2(__m256i u0, __m256i s0, __m256i u1, __m256i s1) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(_mm256_dpbusd_epi32(_mm256_setzero_si256(), u0, s0), u1, s1);
+#else
+    // the pairs of products are at most 2*15*128 for the 4-bit formats, so two of them fit in int16
+    const __m256i dot = _mm256_add_epi16(_mm256_maddubs_epi16(u0, s0), _mm256_maddubs_epi16(u1, s1));
+    return _mm256_madd_epi16(dot, _mm256_set1_epi16(1));
+#endif
+}
+
+// inlined with a constant nc, so that the accumulators stay in registers
+static GGML_ALWAYS_INLINE void ggml_gemm_q4_0x4_tile(const int nb, float * restrict s, const size_t bs,
+        const block_q4_0x4 * restrict x, const char * restrict y, const size_t by, const int nc) {
+    const __m256i lowMask = _mm256_set1_epi8(0xF);
+
+    // rows 0, 1 in acc[0][c] and rows 2, 3 in acc[1][c], the first row of a pair in lanes 0-3 and the second in 4-7
+    __m256 acc[2][GGML_GEMM_X4_NC];
+    for (int p = 0; p < 2; ++p) {
+        for (int c = 0; c < nc; ++c) {
+            acc[p][c] = _mm256_setzero_ps();
+        }
+    }
+
+    for (int i = 0; i < nb; ++i) {
+        // the quants j of a pair of rows in q[p][0] and the quants j + 16 in q[p][1]
+        __m256i q[2][2];
+        __m256  d[2];
+        for (int p = 0; p < 2; ++p) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *) (x[i].qs + 32*p));
+            q[p][0] = _mm256_and_si256(bytes, lowMask);
+            q[p][1] = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), lowMask);
+            d[p] = spread_half_scales(x[i].d[2*p], x[i].d[2*p + 1]);
+        }
+
+        for (int c = 0; c < nc; ++c) {
+            const block_q8_0 * restrict yb = (const block_q8_0 *) (y + c*by) + i;
+
+            const __m256i y0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) yb->qs));
+            const __m256i y1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (yb->qs + 16)));
+            const __m256  dy = _mm256_set1_ps(yb->d);
+
+            // the quants are stored with their offset of 8, which adds d*8*s to a row, a quarter in each of its lanes
+            const __m256 off = _mm256_set1_ps(-2.0f*yb->s);
+
+            for (int p = 0; p < 2; ++p) {
+                const __m256 xy = _mm256_cvtepi32_ps(dot_u8_i8_quads_2(q[p][0], y0, q[p][1], y1));
+                acc[p][c] = _mm256_fmadd_ps(d[p], _mm256_fmadd_ps(dy, xy, off), acc[p][c]);
+            }
+        }
+    }
+
+    for (int c = 0; c < nc; ++c) {
+        // lanes 0-3 have the sums of rows 0 and 2 and lanes 4-7 those of rows 1 and 3
+        __m256 h = _mm256_hadd_ps(acc[0][c], acc[1][c]);
+        h = _mm256_hadd_ps(h, h);
+        _mm_storeu_ps(s + c*bs, _mm_unpacklo_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1)));
+    }
+}
+
+static void ggml_gemm_q4_0x4_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict vx, const size_t bx, const void * restrict vy, const size_t by) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nr % 4 == 0);
+
+    for (int r0 = 0; r0 < nr; r0 += 4) {
+        const block_q4_0x4 * restrict x = (const block_q4_0x4 *) ((const char *) vx + r0*bx);
+
+        int c0 = 0;
+        for (; c0 + GGML_GEMM_X4_NC <= nc; c0 += GGML_GEMM_X4_NC) {
+            ggml_gemm_q4_0x4_tile(nb, s + c0*bs + r0, bs, x, (const char *) vy + c0*by, by, GGML_GEMM_X4_NC);
+        }
+        for (; c0 < nc; ++c0) {
+            ggml_gemm_q4_0x4_tile(nb, s + c0*bs + r0, bs, x, (const char *) vy + c0*by, by, 1);
+        }
+    }
+}
+#else
+static void ggml_gemm_q4_0x4_q8_0(const int n, const int nr, const int nc, float * restrict s, const size_t bs,
+        const void * restrict vx, const size_t bx, const void * restrict vy, const size_t by) {
+    const int nb = n / QK8_0;
+
+    assert(n % QK8_0 == 0);
+    assert(nr % 4 == 0);
+
+    for (int r0 = 0; r0 < nr; r0 += 4) {
+        const block_q4_0x4 * restrict x = (const block_q4_0x4 *) ((const char *) vx + r0*bx);
+
+        for (int c = 0; c < nc; ++c) {
+            const block_q8_0 * restrict y = (const block_q8_0 *) ((const char *) vy + c*by);
+
+            float sumf[4] = {0};
+            for (int i = 0; i < nb; ++i) {
+                for (int r = 0; r < 4; ++r) {
+                    const uint8_t * restrict p0 = x[i].qs + r*QK4_0/2;
+                    const  int8_t * restrict p1 = y[i].qs;
+
+                    int sumi = 0;
+                    for (int j = 0; j < QK4_0/2; ++j) {
+                        sumi += ((p0[j] & 0xF) - 8)*p1[j] + ((p0[j] >> 4) - 8)*p1[j + QK4_0/2];
+                    }
+                    sumf[r] += x[i].d[r]*y[i].d*sumi;
+                }
+            }
+
+            for (int r = 0; r < 4; ++r) {
+                s[c*bs + r0 + r] = sumf[r];
+            }
+        }
+    }
+}
+#endif
+
+//
+// conversions and activations
+//
+
+static void ggml_fp16_to_fp32_row(const ggml_fp16_t * restrict x, float * restrict y, int n) {
+    int i = 0;
+#if defined(__AVX512F__)
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + i))));
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = GGML_FP16_TO_FP32(x[i]);
+    }
+}
+
+static void ggml_fp32_to_fp16_row(const float * restrict x, ggml_fp16_t * restrict y, int n) {
+    int i = 0;
+#if defined(__AVX512F__)
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_si256((__m256i *)(y + i), _mm512_cvtps_ph(_mm512_loadu_ps(x + i), 0));
+    }
+#endif
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), 0));
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = GGML_FP32_TO_FP16(x[i]);
+    }
+}
+
+// Converts x - offset to the fp16 bit patterns used to index the f16 tables
+inline static void ggml_vec_fp16_index(const int n, uint16_t * restrict t, const float * restrict x, const float offset) {
+    int i = 0;
+#if defined(__F16C__)
+    const __m256 off = _mm256_set1_ps(offset);
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(t + i), _mm256_cvtps_ph(_mm256_sub_ps(_mm256_loadu_ps(x + i), off), 0));
+    }
+#endif
+    for (; i < n; ++i) {
+        ggml_fp16_t h = GGML_FP32_TO_FP16(x[i] - offset);
+        memcpy(&t[i], &h, sizeof(uint16_t));
+    }
+}
+
+#define GGML_TABLE_CHUNK 64
+
+// exp(x) with a degree 6 polynomial after the reduction x = n*ln2 + r, |r| <= ln2/2, accurate to about 2 ulp.
+// Inputs below -87.3 give 0, so the -INFINITY of masked scores needs no special case.
+#if defined(__AVX512F__)
+static inline __m512 ggml_v_expf_16(__m512 x) {
+    const __m512 lo = _mm512_set1_ps(-87.33654f);
+    const __mmask16 keep = _mm512_cmp_ps_mask(x, lo, _CMP_GE_OQ);
+
+    x = _mm512_min_ps(_mm512_max_ps(x, lo), _mm512_set1_ps(88.37626f));
+
+    const __m512 fx = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(fx, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(fx, _mm512_set1_ps(-2.12194440e-4f), r);
+
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+
+    const __m512i e = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(fx), _mm512_set1_epi32(127)), 23);
+    return _mm512_maskz_mul_ps(keep, p, _mm512_castsi512_ps(e));
+}
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__)
+static inline __m256 ggml_v_expf_8(__m256 x) {
+    const __m256 lo = _mm256_set1_ps(-87.33654f);
+    const __m256 keep = _mm256_cmp_ps(x, lo, _CMP_GE_OQ);
+
+    x = _mm256_min_ps(_mm256_max_ps(x, lo), _mm256_set1_ps(88.37626f));
+
+    const __m256 fx = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), r);
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_and_ps(keep, _mm256_mul_ps(p, _mm256_castsi256_ps(e)));
+}
+#endif
+
+// y = exp(x - max), returns the sum of y
+static ggml_float ggml_vec_soft_max_f32(const int n, float * y, const float * x, float max) {
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+    int i = 0;
+    ggml_float sum = 0.0;
+#if defined(__AVX512F__)
+    {
+        const __m512 vmax = _mm512_set1_ps(max);
+        __m512 acc = _mm512_setzero_ps();
+        for (; i + 16 <= n; i += 16) {
+            const __m512 v = ggml_v_expf_16(_mm512_sub_ps(_mm512_loadu_ps(x + i), vmax));
+            _mm512_storeu_ps(y + i, v);
+            acc = _mm512_add_ps(acc, v);
+        }
+        sum += (ggml_float)_mm512_reduce_add_ps(acc);
+    }
+#endif
+    {
+        const __m256 vmax = _mm256_set1_ps(max);
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            const __m256 v = ggml_v_expf_8(_mm256_sub_ps(_mm256_loadu_ps(x + i), vmax));
+            _mm256_storeu_ps(y + i, v);
+            acc = _mm256_add_ps(acc, v);
+        }
+        sum += (ggml_float)hsum_float_8(acc);
+    }
+    for (; i < n; ++i) {
+        const float val = x[i] == -INFINITY ? 0.0f : expf(x[i] - max);
+        sum += (ggml_float)val;
+        y[i] = val;
+    }
+    return sum;
+#else
+    ggml_float sum = 0.0;
+
+    uint16_t t[GGML_TABLE_CHUNK];
+    for (int i0 = 0; i0 < n; i0 += GGML_TABLE_CHUNK) {
+        const int nc = MIN(GGML_TABLE_CHUNK, n - i0);
+        ggml_vec_fp16_index(nc, t, x + i0, max);
+
+        for (int i = 0; i < nc; ++i) {
+            if (x[i0 + i] == -INFINITY) {
+                y[i0 + i] = 0.0f;
+            } else {
+                const float val = GGML_FP16_TO_FP32(ggml_table_exp_f16[t[i]]);
+                sum += (ggml_float)val;
+                y[i0 + i] = val;
+            }
+        }
+    }
+
+    return sum;
+#endif
+}
+
+static void ggml_vec_silu_f32(const int n, float * y, const float * x) {
+    uint16_t t[GGML_TABLE_CHUNK];
+    for (int i0 = 0; i0 < n; i0 += GGML_TABLE_CHUNK) {
+        const int nc = MIN(GGML_TABLE_CHUNK, n - i0);
+        ggml_vec_fp16_index(nc, t, x + i0, 0.0f);
+
+        for (int i = 0; i < nc; ++i) {
+            y[i0 + i] = GGML_FP16_TO_FP32(ggml_table_silu_f16[t[i]]);
+        }
+    }
+}
+
+const struct ggml_kernels GGML_KERNEL_CONCAT(ggml_kernels_, GGML_KERNEL_VARIANT) = {
+    /*.name              =*/ GGML_KERNEL_STRING(GGML_KERNEL_VARIANT),
+    /*.vec_dot_f32       =*/ ggml_vec_dot_f32,
+    /*.vec_dot_f16       =*/ ggml_vec_dot_f16,
+    /*.vec_dot_q         =*/ {
+        [GGML_TYPE_Q4_0] = ggml_vec_dot_q4_0_q8_0,
+        [GGML_TYPE_Q4_1] = ggml_vec_dot_q4_1_q8_0,
+        [GGML_TYPE_Q4_2] = ggml_vec_dot_q4_2_q8_0,
+        [GGML_TYPE_Q4_3] = ggml_vec_dot_q4_3_q8_0,
+        [GGML_TYPE_Q8_0] = ggml_vec_dot_q8_0_q8_0,
+        [GGML_TYPE_Q5_0] = ggml_vec_dot_q5_0_q8_0,
+    },
+    /*.gemm_q            =*/ {
+#if defined(__AVX2__)
+        [GGML_TYPE_Q4_0] = ggml_gemm_q4_0_q8_0,
+        [GGML_TYPE_Q4_1] = ggml_gemm_q4_1_q8_0,
+        [GGML_TYPE_Q4_2] = ggml_gemm_q4_2_q8_0,
+        [GGML_TYPE_Q4_3] = ggml_gemm_q4_3_q8_0,
+#endif
+        [GGML_TYPE_Q4_0X4] = ggml_gemm_q4_0x4_q8_0,
+    },
+    /*.quantize_row_q8_0 =*/ quantize_row_q8_0,
+    /*.fp16_to_fp32_row  =*/ ggml_fp16_to_fp32_row,
+    /*.fp32_to_fp16_row  =*/ ggml_fp32_to_fp16_row,
+    /*.vec_soft_max_f32  =*/ ggml_vec_soft_max_f32,
+    /*.vec_silu_f32      =*/ ggml_vec_silu_f32,
+};
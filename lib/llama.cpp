@@ -11,14 +11,75 @@
 #include <thread>
 #include <mutex>
 #include <optional>
+#include <tuple>
 #include "file_loader.hpp"
 #include "utils.hpp"
 
 namespace fastllama {
 
+    // Bytes taken by `n` consecutive elements of the cache; quantized types are addressed by whole blocks
+    static std::size_t kv_offset(ggml_type type, std::int64_t n) noexcept {
+        return ggml_type_size(type) * static_cast<std::size_t>(n) / static_cast<std::size_t>(ggml_blck_size(type));
+    }
+
     auto Model::unload() -> void {
         is_valid = false;
-        kv_self.deinit();
+    }
+
+    bool ModelState::init(Model const& model) {
+        using namespace ::fastllama::literals;
+
+        auto const& logger = model.logger;
+
+        if (!model.is_valid) {
+            logger.log_err("ModelState::init", "tried to create a session of an invalid model\n");
+            return false;
+        }
+
+        // Initialize cache
+        kv_self.huge_pages = model.huge_pages();
+        if (!kv_self.init(model.params, logger)) return false;
+
+        return init_eval_buffers(model);
+    }
+
+    bool ModelState::init_eval_buffers(Model const& model) {
+        using namespace ::fastllama::literals;
+
+        auto const& logger = model.logger;
+
+        // Spawn the evaluation threads once; every eval reuses them
+        compute_pool = ComputePool(threads, n_spin);
+        if (!compute_pool) {
+            logger.log_err("ModelState::init", "failed to create the compute thread pool\n");
+            return false;
+        }
+
+        // Initialize compute buffers with the sizes measured for the largest evals of this state
+        EvalMemoryPlan plan;
+        if (!model.plan_eval_memory(*this, plan)) return false;
+
+        auto const mem_required_for_eval = plan.compute + allocate_extra_mem;
+        buf_compute.resize(mem_required_for_eval, model.huge_pages());
+
+        auto mem_required_for_scratch = std::size_t{};
+        for (auto i = 0ul; i < plan.scratch.size(); ++i) {
+            buf_scratch[i].resize(plan.scratch[i], model.huge_pages());
+            mem_required_for_scratch += plan.scratch[i];
+        }
+
+        logger.log("ModelState::init", "eval buffers  = ", dyn_humanize_size(mem_required_for_eval + mem_required_for_scratch),
+            " (compute = ", dyn_humanize_size(mem_required_for_eval), ", scratch = ", dyn_humanize_size(mem_required_for_scratch), ")\n");
+        if (model.use_huge_pages) {
+            logger.log("ModelState::init", "eval buffers on ", to_string_view(buf_compute.huge_pages()), "\n");
+        }
+
+        if (model.numa == GGML_NUMA_PARTITION && threads % ggml_numa_n_nodes() != 0) {
+            logger.log_warn("ModelState::init", threads, " threads can not be split evenly over ", ggml_numa_n_nodes(), " NUMA nodes; the threads read the weights of other nodes\n");
+        }
+
+        decode_graph.free();
+        return true;
     }
 
     bool KVCacheBuffer::init(HyperParams const& params, Logger const& logger) {
@@ -28,10 +89,25 @@ namespace fastllama {
         auto const n_embd  = params.n_embd;
         auto const n_layer = params.n_layer;
 
+        if (memory_type != GGML_TYPE_F32 && memory_type != GGML_TYPE_F16 && memory_type != GGML_TYPE_Q8_0) {
+            logger.log_err("KVCacheBuffer::init", "unsupported kv cache type ", static_cast<int>(memory_type), "; expected F32, F16 or Q8_0\n");
+            return false;
+        }
+
+        if ((n_embd / params.n_head) % static_cast<std::uint32_t>(ggml_blck_size(key_type())) != 0) {
+            logger.log_err("KVCacheBuffer::init", "head size ", n_embd / params.n_head, " is not a multiple of the ", ggml_type_name(key_type()), " block size\n");
+            return false;
+        }
+
         std::size_t mem_size = static_cast<std::size_t>(n_layer * n_ctx);
         std::size_t number_of_elements = static_cast<std::size_t>(n_embd) * mem_size;
-        auto const buffer_size = 2 * number_of_elements * static_cast<std::size_t>(ggml_type_size(memory_type)) + 2_MiB;
-        buffer.resize( buffer_size );
+        auto const n_rot = static_cast<std::int64_t>(n_embd / params.n_head);
+        auto const buffer_size =
+            kv_offset(key_type(), static_cast<std::int64_t>(number_of_elements)) +
+            kv_offset(value_type(), static_cast<std::int64_t>(number_of_elements)) +
+            static_cast<std::size_t>(n_rot * n_ctx) * sizeof(float) +
+            2_MiB;
+        buffer.resize( buffer_size, huge_pages );
 
         this->ctx = MemContext(buffer.data(), buffer.size(), false);
 
@@ -40,12 +116,18 @@ namespace fastllama {
             return false;
         }
 
-        this->k = ggml_new_tensor_1d(this->ctx.get(), memory_type, static_cast<std::int64_t>(number_of_elements));
-        this->v = ggml_new_tensor_1d(this->ctx.get(), memory_type, static_cast<std::int64_t>(number_of_elements));
+        this->k = ggml_new_tensor_1d(this->ctx.get(), key_type(), static_cast<std::int64_t>(number_of_elements));
+        this->v = ggml_new_tensor_1d(this->ctx.get(), value_type(), static_cast<std::int64_t>(number_of_elements));
+
+        this->rope = ggml_new_tensor_2d(this->ctx.get(), GGML_TYPE_F32, n_rot, static_cast<std::int64_t>(n_ctx));
+        ggml_rope_table(this->rope);
 
         auto const total_kv_size = ggml_nbytes(this->k) + ggml_nbytes(this->v);
 
         logger.log("KVCacheBuffer::init", "kv self size  = ", dyn_humanize_size(total_kv_size), "\n");
+        if (huge_pages != HugePages::None) {
+            logger.log("KVCacheBuffer::init", "kv cache on ", to_string_view(buffer.huge_pages()), "\n");
+        }
         
         return true;
     }
@@ -62,31 +144,292 @@ namespace fastllama {
         writer.write(k->data, sizeof(char), ggml_nbytes(k));
         
         logger.log(__func__, "saving value cache\n");
-        writer.write(v->data, sizeof(char), ggml_nbytes(k));
+        writer.write(v->data, sizeof(char), ggml_nbytes(v));
         return true;
     }
 
     bool KVCacheBuffer::load_state(BinaryFileReader& reader, Logger const& logger) noexcept {
-        reader.read(&memory_type);
+        ggml_type saved_type{};
+        reader.read(&saved_type);
+
+        if (saved_type != memory_type) {
+            logger.log_err(__func__, "kv cache type of the state '", ggml_type_name(saved_type), "' does not match the context type '", ggml_type_name(memory_type), "'\n");
+            return false;
+        }
 
         logger.log(__func__, "loading key cache\n");
         reader.read(k->data, sizeof(char), ggml_nbytes(k));
         
         logger.log(__func__, "loading value cache\n");
-        reader.read(v->data, sizeof(char), ggml_nbytes(k));
+        reader.read(v->data, sizeof(char), ggml_nbytes(v));
         return true;
     }
 
+    bool KVCacheBuffer::shift(HyperParams const& params, std::size_t n_keep, std::size_t n_discard, std::size_t n_past, int n_threads, Logger const& logger) {
+        auto const n_ctx   = static_cast<std::size_t>(params.n_ctx);
+        auto const n_embd  = static_cast<std::size_t>(params.n_embd);
+        auto const n_head  = static_cast<std::size_t>(params.n_head);
+        auto const n_layer = static_cast<std::size_t>(params.n_layer);
+        auto const n_rot   = n_embd / n_head;
+
+        if (n_keep + n_discard > n_past || n_past > n_ctx) {
+            logger.log_err("KVCacheBuffer::shift", "cannot discard ", n_discard, " tokens after ", n_keep, " tokens from a cache holding ", n_past, " tokens\n");
+            return false;
+        }
+
+        if (n_discard == 0) return true;
+
+        auto const n_move = n_past - n_keep - n_discard;
+        auto const k_type = key_type();
+        auto const v_type = value_type();
+        auto const k_row_size = kv_offset(k_type, static_cast<std::int64_t>(n_embd));
+        auto const quantize_fns = ggml_internal_get_quantize_fn(static_cast<std::size_t>(k_type));
+
+        // The keys are stored after RoPE, so moving a key back by `n_discard` positions is another rotation
+        // of every dimension pair by `-n_discard * theta_i`: the angles of position `n_discard` in the table
+        // with the sign of the sin flipped.
+        auto const* cos_sin = reinterpret_cast<float const*>(static_cast<char const*>(rope->data) + n_discard * rope->nb[1]);
+
+        auto const shift_layer = [&](std::size_t il, std::vector<float>& row) {
+            auto* k_data = static_cast<char*>(k->data) + kv_offset(k_type, static_cast<std::int64_t>(il * n_ctx * n_embd));
+            std::memmove(k_data + n_keep * k_row_size, k_data + (n_keep + n_discard) * k_row_size, n_move * k_row_size);
+
+            for (auto pos = n_keep; pos < n_keep + n_move; ++pos) {
+                auto* k_row = k_data + pos * k_row_size;
+
+                float* x = row.data();
+                switch (k_type) {
+                    case GGML_TYPE_F32: x = reinterpret_cast<float*>(k_row); break;
+                    case GGML_TYPE_F16: {
+                        auto const* src = reinterpret_cast<ggml_fp16_t const*>(k_row);
+                        for (auto i = 0ul; i < n_embd; ++i) x[i] = ggml_fp16_to_fp32(src[i]);
+                        break;
+                    }
+                    default: quantize_fns.dequantize_row_q(k_row, x, static_cast<int>(n_embd)); break;
+                }
+
+                for (auto h = 0ul; h < n_head; ++h) {
+                    auto* head = x + h * n_rot;
+                    for (auto i = 0ul; i < n_rot / 2; ++i) {
+                        auto const cos_theta = cos_sin[2 * i];
+                        auto const sin_theta = -cos_sin[2 * i + 1];
+                        auto const x0 = head[2 * i];
+                        auto const x1 = head[2 * i + 1];
+                        head[2 * i]     = x0 * cos_theta - x1 * sin_theta;
+                        head[2 * i + 1] = x0 * sin_theta + x1 * cos_theta;
+                    }
+                }
+
+                switch (k_type) {
+                    case GGML_TYPE_F32: break;
+                    case GGML_TYPE_F16: {
+                        auto* dst = reinterpret_cast<ggml_fp16_t*>(k_row);
+                        for (auto i = 0ul; i < n_embd; ++i) dst[i] = ggml_fp32_to_fp16(x[i]);
+                        break;
+                    }
+                    default: quantize_fns.quantize_row_q(x, k_row, static_cast<int>(n_embd)); break;
+                }
+            }
+
+            // Values are transposed: every embedding dimension is a row of `n_ctx` positions
+            auto* v_data = static_cast<char*>(v->data) + kv_offset(v_type, static_cast<std::int64_t>(il * n_ctx * n_embd));
+            auto const v_elem_size = kv_offset(v_type, 1);
+            for (auto i = 0ul; i < n_embd; ++i) {
+                auto* v_row = v_data + i * n_ctx * v_elem_size;
+                std::memmove(v_row + n_keep * v_elem_size, v_row + (n_keep + n_discard) * v_elem_size, n_move * v_elem_size);
+            }
+        };
+
+        auto const n_workers = std::max(std::size_t{1}, std::min(n_layer, static_cast<std::size_t>(std::max(1, n_threads))));
+
+        auto const worker = [&](std::size_t ith) {
+            std::vector<float> row(n_embd);
+            for (auto il = ith; il < n_layer; il += n_workers) shift_layer(il, row);
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(n_workers - 1);
+        for (auto ith = 1ul; ith < n_workers; ++ith) workers.emplace_back(worker, ith);
+        worker(0);
+        for (auto& w : workers) w.join();
+
+        return true;
+    }
+
+    std::size_t KVCacheBuffer::prefix_size(HyperParams const& params, std::size_t n_tokens) const noexcept {
+        auto const n_elements = static_cast<std::int64_t>(static_cast<std::size_t>(params.n_layer) * n_tokens * static_cast<std::size_t>(params.n_embd));
+        return kv_offset(key_type(), n_elements) + kv_offset(value_type(), n_elements);
+    }
+
+    void KVCacheBuffer::copy_prefix_to(HyperParams const& params, std::size_t n_tokens, char* dst) const noexcept {
+        auto const n_ctx   = static_cast<std::size_t>(params.n_ctx);
+        auto const n_embd  = static_cast<std::size_t>(params.n_embd);
+        auto const n_layer = static_cast<std::size_t>(params.n_layer);
+        auto const k_row_size = kv_offset(key_type(), static_cast<std::int64_t>(n_embd));
+        auto const v_elem_size = kv_offset(value_type(), 1);
+
+        for (auto il = 0ul; il < n_layer; ++il) {
+            auto const* k_data = static_cast<char const*>(k->data) + il * n_ctx * k_row_size;
+            std::memcpy(dst, k_data, n_tokens * k_row_size);
+            dst += n_tokens * k_row_size;
+        }
+
+        // Values are transposed, so a prefix is the start of every row
+        for (auto il = 0ul; il < n_layer; ++il) {
+            auto const* v_data = static_cast<char const*>(v->data) + il * n_ctx * n_embd * v_elem_size;
+            for (auto i = 0ul; i < n_embd; ++i) {
+                std::memcpy(dst, v_data + i * n_ctx * v_elem_size, n_tokens * v_elem_size);
+                dst += n_tokens * v_elem_size;
+            }
+        }
+    }
+
+    void KVCacheBuffer::copy_prefix_from(HyperParams const& params, std::size_t n_tokens, char const* src, std::size_t src_tokens) noexcept {
+        auto const n_ctx   = static_cast<std::size_t>(params.n_ctx);
+        auto const n_embd  = static_cast<std::size_t>(params.n_embd);
+        auto const n_layer = static_cast<std::size_t>(params.n_layer);
+        auto const k_row_size = kv_offset(key_type(), static_cast<std::int64_t>(n_embd));
+        auto const v_elem_size = kv_offset(value_type(), 1);
+
+        for (auto il = 0ul; il < n_layer; ++il) {
+            auto* k_data = static_cast<char*>(k->data) + il * n_ctx * k_row_size;
+            std::memcpy(k_data, src, n_tokens * k_row_size);
+            src += src_tokens * k_row_size;
+        }
+
+        for (auto il = 0ul; il < n_layer; ++il) {
+            auto* v_data = static_cast<char*>(v->data) + il * n_ctx * n_embd * v_elem_size;
+            for (auto i = 0ul; i < n_embd; ++i) {
+                std::memcpy(v_data + i * n_ctx * v_elem_size, src, n_tokens * v_elem_size);
+                src += src_tokens * v_elem_size;
+            }
+        }
+    }
+
+    std::size_t PrefixCache::restore(HyperParams const& params, Span<token_id_t> tokens, KVCacheBuffer& kv) {
+        auto lock = std::unique_lock(m_mutex);
+
+        Entry* best = nullptr;
+        auto best_len = std::size_t{};
+        for (auto& entry : m_entries) {
+            if (entry.memory_type != kv.memory_type) continue;
+            auto const n = std::min(entry.tokens.size(), tokens.size());
+            auto const len = static_cast<std::size_t>(std::mismatch(tokens.begin(), tokens.begin() + static_cast<std::ptrdiff_t>(n), entry.tokens.begin()).first - tokens.begin());
+            if (len > best_len) {
+                best = &entry;
+                best_len = len;
+            }
+        }
+
+        if (best == nullptr) return 0;
+
+        best->last_used = ++m_clock;
+        kv.copy_prefix_from(params, best_len, best->data.data(), best->tokens.size());
+        return best_len;
+    }
+
+    void PrefixCache::store(HyperParams const& params, Span<token_id_t> tokens, KVCacheBuffer const& kv) {
+        auto lock = std::unique_lock(m_mutex);
+
+        if (tokens.empty() || tokens.size() > m_capacity) return;
+
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->memory_type != kv.memory_type) continue;
+            auto const n = std::min(it->tokens.size(), tokens.size());
+            if (!std::equal(tokens.begin(), tokens.begin() + static_cast<std::ptrdiff_t>(n), it->tokens.begin())) continue;
+
+            // an entry that already covers the tokens is enough; a shorter one is replaced by the longer prefix
+            if (it->tokens.size() >= tokens.size()) {
+                it->last_used = ++m_clock;
+                return;
+            }
+            m_size -= it->tokens.size();
+            m_entries.erase(it);
+            break;
+        }
+
+        evict(tokens.size());
+
+        auto entry = Entry{ std::vector<token_id_t>(tokens.begin(), tokens.end()), kv.memory_type, {}, ++m_clock };
+        entry.data.resize(kv.prefix_size(params, tokens.size()));
+        kv.copy_prefix_to(params, tokens.size(), entry.data.data());
+
+        m_size += tokens.size();
+        m_entries.push_back(std::move(entry));
+    }
+
+    void PrefixCache::evict(std::size_t n_tokens) {
+        // least recently used first
+        while (!m_entries.empty() && m_size + n_tokens > m_capacity) {
+            auto it = std::min_element(m_entries.begin(), m_entries.end(), [](auto const& a, auto const& b) { return a.last_used < b.last_used; });
+            m_size -= it->tokens.size();
+            m_entries.erase(it);
+        }
+    }
+
+    void PrefixCache::clear() {
+        auto lock = std::unique_lock(m_mutex);
+        m_entries.clear();
+        m_size = 0;
+    }
+
+    void PrefixCache::set_capacity(std::size_t n_tokens) {
+        auto lock = std::unique_lock(m_mutex);
+        m_capacity = n_tokens;
+        evict(0);
+    }
+
+    std::size_t PrefixCache::capacity() const {
+        auto lock = std::unique_lock(m_mutex);
+        return m_capacity;
+    }
+
+    LayerPager::LayerPager(MMappedFile const* mapping, std::vector<Layer> layers, std::size_t n_prefetch)
+        : mapping(mapping)
+        , layers(std::move(layers))
+        , n_prefetch(std::max<std::size_t>(1, std::min(n_prefetch, this->layers.size())))
+    {
+        for (auto il = 0ul; il < this->layers.size(); ++il) hints.push_back(Hint{ this, il });
+    }
+
+    void LayerPager::on_layer_start(void* hint) noexcept {
+        auto const& [pager, il] = *static_cast<Hint const*>(hint);
+        auto const n_layer = pager->layers.size();
+
+        pager->page_in((il + pager->n_prefetch) % n_layer);
+
+        // the previous layer is not needed until the next eval, unless all of them fit in the prefetch window
+        if (pager->n_prefetch + 1 < n_layer) pager->page_out((il + n_layer - 1) % n_layer);
+    }
+
+    void LayerPager::page_in(std::size_t il) const noexcept {
+        auto const& l = layers[il];
+        for (auto const* t : { l.attention_norm, l.wq, l.wk, l.wv, l.wo, l.ffn_norm, l.w1, l.w2, l.w3 }) {
+            mapping->advise_will_need(t->data, ggml_nbytes(t));
+        }
+    }
+
+    // the weights a LoRA adapter copied out of the mapping are not in it, so they are left alone
+    void LayerPager::page_out(std::size_t il) const noexcept {
+        auto const& l = layers[il];
+        for (auto const* t : { l.attention_norm, l.wq, l.wk, l.wv, l.wo, l.ffn_norm, l.w1, l.w2, l.w3 }) {
+            mapping->advise_dont_need(t->data, ggml_nbytes(t));
+        }
+    }
+
     // Assumption 1: Layer is not being modified. Therefore, we can skip it
     // Assumption 2: User will only load the state of a correct model
-    bool Model::save_state(BinaryFileWriter& writer) const noexcept {
+    bool ModelState::save_state(BinaryFileWriter& writer, Logger const& logger) const noexcept {
         kv_self.save_state(writer, logger);
         return true;
     }
 
-    bool Model::load_state(BinaryFileReader& reader) noexcept {
-        kv_self.load_state(reader, logger);
-        return true;
+    bool ModelState::load_state(BinaryFileReader& reader, Logger const& logger) noexcept {
+        return kv_self.load_state(reader, logger);
+    }
+
+    bool ModelState::shift_kv_cache(HyperParams const& params, std::size_t n_keep, std::size_t n_discard, std::size_t n_past, Logger const& logger) noexcept {
+        return kv_self.shift(params, n_keep, n_discard, n_past, threads, logger);
     }
 
 
@@ -114,12 +457,44 @@ namespace fastllama {
 
         // Create model loader
 
-        auto model_loader = ModelLoader(filepath, use_mmap, false, &logger);
+        if (use_mmap && repack_weights) {
+            logger.log_warn("Model", "the repacked weights are kept in memory; not using mmap\n");
+        }
+
+        if (use_layer_paging) {
+            if (repack_weights) {
+                logger.log_warn("Model", "the repacked weights are kept in memory; not paging the layers\n");
+            } else if (use_mlock) {
+                logger.log_warn("Model", "the layers are paged in and out; not locking the model in memory\n");
+                use_mlock = false;
+            }
+            use_mmap = use_mmap || !repack_weights;
+        }
+
+        if (numa != GGML_NUMA_DISABLED) {
+            if (!ggml_numa_init(numa)) {
+                logger.log_warn("Model", "NUMA is not supported or there is a single node; not placing the weights\n");
+                numa = GGML_NUMA_DISABLED;
+            } else if (use_layer_paging) {
+                logger.log_warn("Model", "the layers are paged in from the mapping; not placing the weights on the NUMA nodes\n");
+            } else if (use_mmap) {
+                logger.log_warn("Model", "the weights are placed on the NUMA nodes; not using mmap\n");
+                use_mmap = false;
+            }
+        }
+
+        auto model_loader = ModelLoader(filepath, use_mmap && !repack_weights, false, &logger);
 
         if (model_loader.is_load_failed) {
             return false;
         }
 
+        model_loader.repack_weights = repack_weights;
+        model_loader.use_direct_io = use_direct_io;
+        model_loader.page_lazily = use_layer_paging && !repack_weights;
+        model_loader.use_huge_pages = use_huge_pages;
+        model_loader.repack_cache_path = repack_cache_path.empty() ? std::string(filepath) + ".repack" : repack_cache_path;
+
         vocabulary = std::move(model_loader.file_loaders[0].vocab);
         auto n_ctx = params.n_ctx; 
         params = std::move(model_loader.file_loaders[0].hyperparams);
@@ -128,14 +503,14 @@ namespace fastllama {
 
         std::uint32_t n_ff = ((2*(4*params.n_embd)/3 + params.n_mult - 1)/params.n_mult)*params.n_mult;
 
-        // Get model id
+        // Get model id; other layer counts load as well, the id is only logged
         {
             switch(params.n_layer) {
                 case 32: model_id = ModelId::from_str_case_insensitive("7B"); break;
                 case 40: model_id = ModelId::from_str_case_insensitive("13B"); break;
                 case 60: model_id = ModelId::from_str_case_insensitive("30B"); break;
                 case 80: model_id = ModelId::from_str_case_insensitive("65B"); break;
-                default: model_id = ModelId::from_str_case_insensitive("7B"); break;
+                default: model_id = ModelId{}; break;
             }
         }
 
@@ -151,12 +526,9 @@ namespace fastllama {
             logger.log("Model", "ftype      = ", static_cast<std::uint32_t>(params.ftype), " (", to_string_view(params.ftype), ")\n");
             logger.log("Model", "n_ff       = ", n_ff, '\n');
             logger.log("Model", "n_parts    = ", model_loader.file_loaders.size(), '\n');
-            logger.log("Model", "model_id   = ", model_id, '\n');
+            logger.log("Model", "model_id   = ", model_id ? model_id.id : std::string_view("unknown"), '\n');
         }
 
-        // Initialize cache
-        if (!kv_self.init(params, logger)) return false;
-
         std::size_t ctx_size{};
         std::size_t mmapped_size{};
 
@@ -168,34 +540,19 @@ namespace fastllama {
 
         logger.log("Model", "ggml ctx size = ", humanize_size(buff, ctx_size), '\n');
 
-        // Initialize compute buffers
-        {
-            model_id.config.mem_required_for_eval += static_cast<std::size_t>(n_batch) * 20_MiB + allocate_extra_mem; // extra space large batch
-            buf_compute.resize(model_id.config.mem_required_for_eval);
-            if constexpr (use_scratch_buffer) {
-                buf_scratch[0].resize(model_id.config.mem_required_for_scratch_buff_0);
-                buf_scratch[1].resize(model_id.config.mem_required_for_scratch_buff_1);
-            }
-        }
-
-        // Log memory requirements 
+        // Log memory requirements; the kv cache and the eval buffers are allocated by every session
         {
-            std::size_t const scale = kv_self.memory_type == GGML_TYPE_F32 ? 2 : 1;
-            auto const mem_required =
-                ctx_size +
-                mmapped_size +
-                (model_id.config.mem_required_for_scratch_buff_0 * static_cast<std::size_t>(use_scratch_buffer)) +
-                (model_id.config.mem_required_for_scratch_buff_1 * static_cast<std::size_t>(use_scratch_buffer)) +
-                model_id.config.mem_required_for_eval;
+            auto const mem_required = ctx_size + mmapped_size;
 
-            auto const mem_required_state = scale * model_id.config.mem_required_for_kv_self_buff;
-
-            logger.log("Model", "mem required  = ", dyn_humanize_size(mem_required)," (+ ", dyn_humanize_size(mem_required_state) ," per state)\n");
+            logger.log("Model", "mem required  = ", dyn_humanize_size(mem_required)," (+ kv cache and eval buffers per session)\n");
         }
         
         // Set the ggml context
         {
-            buffer.resize(ctx_size);
+            buffer.resize(ctx_size, huge_pages());
+            if (use_huge_pages) {
+                logger.log("Model", "weights buffer on ", to_string_view(buffer.huge_pages()), '\n');
+            }
 
             if (use_mlock) {
                 mlock_buffer.init(buffer.data());
@@ -208,6 +565,8 @@ namespace fastllama {
                 logger.log_err(__func__, "failed to initialize ggml context\n");
                 return false;
             }
+
+            logger.log("Model", "ggml kernels  = ", ggml_cpu_kernels(), '\n');
         }
 
         // prepare memory for the weights
@@ -216,13 +575,12 @@ namespace fastllama {
             auto const n_layer = params.n_layer;
             auto const n_vocab = params.n_vocab;
 
-            model_loader.mem_ctx = ctx;
-
-            model_loader.mem_ctx = ctx;
+            // the loader creates the tensors in the context of the model and gives it back once they are all created
+            model_loader.mem_ctx = std::move(ctx);
 
             tok_embeddings = model_loader.get_tensor("tok_embeddings.weight", {n_embd, n_vocab});
             norm           = model_loader.get_tensor("norm.weight",           {n_embd});
-            output         = model_loader.get_tensor("output.weight",         {n_embd, n_vocab});
+            output         = model_loader.get_tensor("output.weight",         {n_embd, n_vocab}, true);
 
             layers.resize(n_layer);
 
@@ -233,29 +591,43 @@ namespace fastllama {
 
                 layer.attention_norm = model_loader.get_tensor(format_str(buff, "layers.%d.attention_norm.weight", i), {n_embd});
 
-                layer.wq = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wq.weight", i), {n_embd, n_embd});
-                layer.wk = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wk.weight", i), {n_embd, n_embd});
-                layer.wv = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wv.weight", i), {n_embd, n_embd});
-                layer.wo = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wo.weight", i), {n_embd, n_embd});
+                layer.wq = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wq.weight", i), {n_embd, n_embd}, true);
+                layer.wk = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wk.weight", i), {n_embd, n_embd}, true);
+                layer.wv = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wv.weight", i), {n_embd, n_embd}, true);
+                layer.wo = model_loader.get_tensor(format_str(buff, "layers.%d.attention.wo.weight", i), {n_embd, n_embd}, true);
 
                 layer.ffn_norm = model_loader.get_tensor(format_str(buff, "layers.%d.ffn_norm.weight", i), {n_embd});
 
-                layer.w1 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w1.weight", i), {n_embd,   n_ff});
-                layer.w2 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w2.weight", i), {  n_ff,   n_embd});
-                layer.w3 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w3.weight", i), {n_embd,   n_ff});
+                layer.w1 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w1.weight", i), {n_embd,   n_ff}, true);
+                layer.w2 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w2.weight", i), {  n_ff,   n_embd}, true);
+                layer.w3 = model_loader.get_tensor(format_str(buff, "layers.%d.feed_forward.w3.weight", i), {n_embd,   n_ff}, true);
             }
 
         }
 
         if (!model_loader.done_getting_tensors()) return false;
 
+        ctx = std::move(model_loader.mem_ctx);
 
         // populate `tensors_by_name`
         tensor_by_name = model_loader.tensors_map.make_tensors_by_name();
 
+        // bind the weights to their nodes before they are read in, so the pages are allocated there
+        if (numa != GGML_NUMA_DISABLED && !model_loader.use_mmap) {
+            auto is_placed = true;
+            for (auto const& [name, tensor] : tensor_by_name) is_placed = ggml_numa_place(tensor) && is_placed;
+
+            if (is_placed) {
+                logger.log("Model", numa == GGML_NUMA_PARTITION ? "partitioned" : "interleaved", " the weights over ", ggml_numa_n_nodes(), " NUMA nodes\n");
+            } else {
+                logger.log_warn("Model", "failed to bind the weights to the NUMA nodes: ", std::strerror(errno), '\n');
+            }
+        }
+
         auto time = std::chrono::steady_clock::now();
-        if (load_parallel) model_loader.parallel_load_all_data(use_mlock ? &mlock_mmap : nullptr, threads, n_load_parallel_blocks);
-        else               model_loader.load_all_data(use_mlock ? &mlock_mmap : nullptr);
+        if (!model_loader.use_mmap && AsyncFileReader::SUPPORTED) model_loader.async_load_all_data(static_cast<std::size_t>(threads));
+        else if (load_parallel) model_loader.parallel_load_all_data(use_mlock ? &mlock_mmap : nullptr, threads, n_load_parallel_blocks);
+        else                    model_loader.load_all_data(use_mlock ? &mlock_mmap : nullptr);
         auto time2 = std::chrono::steady_clock::now();
         auto diff = time2 - time;
         logger.log("Model", "time to load all data = ", std::chrono::duration<double, std::milli>(diff).count(), " ms\n");
@@ -265,137 +637,195 @@ namespace fastllama {
         mapping = std::move(model_loader.mmapped_file);
         use_mmap = model_loader.use_mmap;
 
+        layer_pager.reset();
+        if (model_loader.page_lazily) {
+            if (mapping) {
+                layer_pager = std::make_unique<LayerPager>(mapping.get(), layers, n_prefetch_layers);
+                for (auto il = 0ul; il < layer_pager->n_prefetch; ++il) layer_pager->page_in(il);
+                logger.log("Model", "paging the layers in ", layer_pager->n_prefetch, " ahead while evaluating\n");
+            } else {
+                logger.log_warn("Model", "the model is not mapped; not paging the layers\n");
+            }
+        }
+
         this->is_valid = true;
         return true;
     }
 
-    auto Model::eval(
-            std::size_t n_past,
-            Span<vocab_id> embd_inp,
-            std::vector<float>& embd_w,
-            std::size_t& mem_per_token
-        ) -> bool
+    auto Model::build_graph(
+            ModelState& state,
+            ggml_context* ctx0,
+            ggml_cgraph& gf,
+            Span<GraphSequence> seqs,
+            ggml_tensor* embd,
+            bool use_scratch,
+            DecodeGraph* decode
+        ) const -> std::pair<ggml_tensor*, ggml_tensor*>
     {
-        if (!is_valid) {
-            logger.log_err(__func__, "model is not valid\n");
-            return false;
-        };
-        auto const N = static_cast<std::int64_t>(embd_inp.size());
+        auto const N = embd->ne[0];
 
         auto const n_embd  = params.n_embd;
-        auto const n_layer = params.n_layer;
         auto const n_ctx   = params.n_ctx;
         auto const n_head  = params.n_head;
-        auto const n_vocab = params.n_vocab;
         auto const n_rot   = params.n_embd / params.n_head;
 
-        ggml_init_params mem_params {};
-        // buf_compute.resize(mem_per_token);
-        mem_params.mem_size   = buf_compute.size();
-        mem_params.mem_buffer = reinterpret_cast<void*>(buf_compute.data());
-
-        ggml_context * ctx0 = ggml_init(mem_params);
-        ggml_cgraph gf{};
-        gf.n_threads = (N >= 32 && (ggml_cpu_has_blas() || ggml_cpu_has_cublas()) ? 1 : threads);
+        auto const select_buf = [&state, ctx0, use_scratch](int i) {
+            if (use_scratch) state.use_buf(ctx0, i);
+        };
 
-        ggml_tensor* embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
-        std::copy_n(embd_inp.begin(), N, static_cast<vocab_id*>(embd->data));
+        // the fused feed-forward does not use BLAS, which multiplies the larger batches faster
+        auto const use_blas = N >= 32 && (ggml_cpu_has_blas() || ggml_cpu_has_cublas());
 
         ggml_tensor* inpL = ggml_get_rows(ctx0, tok_embeddings, embd);
 
-        auto const past_size = static_cast<std::int64_t>(n_past);
-        
         for (auto il = 0ul; il < layers.size(); ++il) {
+            // page in the weights of the layers ahead while this one is computed
+            if (layer_pager) inpL = ggml_callback(ctx0, inpL, &LayerPager::on_layer_start, &layer_pager->hints[il]);
+
             ggml_tensor * inpSA = inpL;
 
             ggml_tensor * cur;
 
-            use_buf(ctx0, 0);
+            select_buf(0);
 
             // norm
             {
-                cur = ggml_rms_norm(ctx0, inpL);
-
-                // cur = attention_norm*cur
-                cur = ggml_mul(ctx0,
-                            ggml_repeat(ctx0, layers[il].attention_norm, cur),
-                            cur);
+                // cur = attention_norm*rms_norm(inpL)
+                cur = ggml_rms_norm_mul(ctx0, inpL, layers[il].attention_norm);
             }
 
             // self-attention
             {
-                // compute Q and K and RoPE them
-                ggml_tensor* Qcur = ggml_rope(ctx0, ggml_reshape_3d(ctx0, ggml_mul_mat(ctx0, layers[il].wq, cur), n_embd/n_head, n_head, N), past_size, n_rot, 0);
-                ggml_tensor* Kcur = ggml_rope(ctx0, ggml_reshape_3d(ctx0, ggml_mul_mat(ctx0, layers[il].wk, cur), n_embd/n_head, n_head, N), past_size, n_rot, 0);
-
-                // store key and value to memory
-                {
-                    // compute the transposed [N, n_embd] V matrix
-                    ggml_tensor* Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, ggml_mul_mat(ctx0, layers[il].wv, cur), n_embd, N));
-
-                    ggml_tensor* k = ggml_view_1d(ctx0, kv_self.k, N*n_embd, (ggml_element_size(kv_self.k)*n_embd)*(il*n_ctx + past_size));
-                    ggml_tensor* v = ggml_view_2d(ctx0, kv_self.v, N, n_embd,
-                            (   n_ctx)*ggml_element_size(kv_self.v),
-                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_embd + past_size*ggml_element_size(kv_self.v));
-
-                    // important: storing RoPE-ed version of K in the KV cache!
-                    ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Kcur, k));
-                    ggml_build_forward_expand(&gf, ggml_cpy(ctx0, Vcur, v));
-                }
+                // the projections are computed for the tokens of every sequence at once
+                ggml_tensor* Qall = ggml_reshape_3d(ctx0, ggml_mul_mat(ctx0, layers[il].wq, cur), n_embd/n_head, n_head, N);
+                ggml_tensor* Kall = ggml_reshape_3d(ctx0, ggml_mul_mat(ctx0, layers[il].wk, cur), n_embd/n_head, n_head, N);
+                ggml_tensor* Vall = ggml_reshape_2d(ctx0, ggml_mul_mat(ctx0, layers[il].wv, cur), n_embd, N);
+
+                // with several sequences, the attention output of each one is copied into its columns
+                ggml_tensor* attn_out = seqs.size() > 1 ? ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N) : nullptr;
+
+                std::int64_t token_offset = 0;
+                for (auto const& seq : seqs) {
+                    auto const& kv_self = *seq.kv;
+                    auto const past_size = seq.n_past;
+                    auto const n_tokens  = seq.n_tokens;
+                    auto const is_whole  = (n_tokens == N);
+
+                    ggml_tensor* Qin = is_whole ? Qall : ggml_view_3d(ctx0, Qall, n_embd/n_head, n_head, n_tokens, Qall->nb[1], Qall->nb[2], static_cast<std::size_t>(token_offset) * Qall->nb[2]);
+                    ggml_tensor* Kin = is_whole ? Kall : ggml_view_3d(ctx0, Kall, n_embd/n_head, n_head, n_tokens, Kall->nb[1], Kall->nb[2], static_cast<std::size_t>(token_offset) * Kall->nb[2]);
+                    ggml_tensor* Vin = is_whole ? Vall : ggml_view_2d(ctx0, Vall, n_embd, n_tokens, Vall->nb[1], static_cast<std::size_t>(token_offset) * Vall->nb[1]);
+
+                    // RoPE Q and K at the positions of the sequence
+                    ggml_tensor* Qcur = ggml_rope_cached(ctx0, Qin, past_size, n_rot, 0, kv_self.rope);
+                    ggml_tensor* Kcur = ggml_rope_cached(ctx0, Kin, past_size, n_rot, 0, kv_self.rope);
+
+                    // store key and value to memory
+                    ggml_tensor* k;
+                    ggml_tensor* v;
+                    ggml_tensor* k_cpy;
+                    ggml_tensor* v_cpy;
+                    {
+                        // compute the transposed [N, n_embd] V matrix
+                        ggml_tensor* Vcur = ggml_transpose(ctx0, Vin);
+
+                        k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_embd, kv_offset(kv_self.k->type, n_embd*(il*n_ctx + past_size)));
+                        v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_embd,
+                                kv_offset(kv_self.v->type, n_ctx),
+                                kv_offset(kv_self.v->type, il*n_ctx*n_embd + past_size));
+
+                        // important: storing RoPE-ed version of K in the KV cache!
+                        k_cpy = ggml_cpy(ctx0, Kcur, k);
+                        v_cpy = ggml_cpy(ctx0, Vcur, v);
+                        ggml_build_forward_expand(&gf, k_cpy);
+                        ggml_build_forward_expand(&gf, v_cpy);
+                    }
 
-                ggml_tensor* Q =
-                    ggml_permute(ctx0,
-                            Qcur,
-                            0, 2, 1, 3);
-
-                ggml_tensor* K =
-                    ggml_permute(ctx0,
-                            ggml_reshape_3d(ctx0,
-                                ggml_view_1d(ctx0, kv_self.k, (past_size + N)*n_embd, il*n_ctx*ggml_element_size(kv_self.k)*n_embd),
-                                n_embd/n_head, n_head, past_size + N),
-                            0, 2, 1, 3);
-
-                // K * Q
-                ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
-
-                // KQ_scaled = KQ / sqrt(n_embd/n_head)
-                ggml_tensor * KQ_scaled =
-                    ggml_scale(ctx0,
-                            KQ,
-                            ggml_new_f32(ctx0, 1.0f/sqrtf(float(n_embd)/n_head)));
-
-                // KQ_masked = mask_past(KQ_scaled)
-                ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctx0, KQ_scaled, past_size);
-
-                // KQ = soft_max(KQ_masked)
-                ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_masked);
-
-                // split cached V into n_head heads
-                ggml_tensor* V =
-                    ggml_view_3d(ctx0, kv_self.v,
-                            past_size + N, n_embd/n_head, n_head,
-                            n_ctx*ggml_element_size(kv_self.v),
-                            n_ctx*ggml_element_size(kv_self.v)*n_embd/n_head,
-                            il*n_ctx*ggml_element_size(kv_self.v)*n_embd);
+                    ggml_tensor* Q =
+                        ggml_permute(ctx0,
+                                Qcur,
+                                0, 2, 1, 3);
+
+                    ggml_tensor* K_view = ggml_view_1d(ctx0, kv_self.k, (past_size + n_tokens)*n_embd, kv_offset(kv_self.k->type, il*n_ctx*n_embd));
+                    ggml_tensor* K_reshape = ggml_reshape_3d(ctx0, K_view, n_embd/n_head, n_head, past_size + n_tokens);
+                    ggml_tensor* K = ggml_permute(ctx0, K_reshape, 0, 2, 1, 3);
+
+                    // split cached V into n_head heads
+                    ggml_tensor* V =
+                        ggml_view_3d(ctx0, kv_self.v,
+                                past_size + n_tokens, n_embd/n_head, n_head,
+                                kv_offset(kv_self.v->type, n_ctx),
+                                kv_offset(kv_self.v->type, n_ctx*n_embd/n_head),
+                                kv_offset(kv_self.v->type, il*n_ctx*n_embd));
+
+                    ggml_tensor* KQV;
+                    if (state.use_flash_attn) {
+                        // soft_max(K*Q/sqrt(n_embd/n_head) with the future masked)*V straight from the cache
+                        KQV = ggml_flash_attn(ctx0, Q, K, V, true);
+
+                        if (decode) {
+                            decode->layers.push_back({
+                                Qcur, Kcur,
+                                k, k_cpy, v, v_cpy,
+                                K_view, K_reshape, K,
+                                nullptr, nullptr, nullptr, nullptr,
+                                V
+                            });
+                        }
+                    } else {
+                        // K * Q
+                        ggml_tensor * KQ = ggml_mul_mat(ctx0, K, Q);
+
+                        // KQ_scaled = KQ / sqrt(n_embd/n_head)
+                        ggml_tensor * KQ_scaled =
+                            ggml_scale(ctx0,
+                                    KQ,
+                                    ggml_new_f32(ctx0, 1.0f/sqrtf(float(n_embd)/n_head)));
+
+                        // KQ_masked = mask_past(KQ_scaled)
+                        ggml_tensor * KQ_masked = ggml_diag_mask_inf(ctx0, KQ_scaled, past_size);
+
+                        // KQ = soft_max(KQ_masked)
+                        ggml_tensor * KQ_soft_max = ggml_soft_max(ctx0, KQ_masked);
+
+                        if (decode) {
+                            decode->layers.push_back({
+                                Qcur, Kcur,
+                                k, k_cpy, v, v_cpy,
+                                K_view, K_reshape, K,
+                                KQ, KQ_scaled, KQ_masked, KQ_soft_max,
+                                V
+                            });
+                        }
 
-                
 #if 1
-                ggml_tensor* KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
+                        KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 #else
-                // make V contiguous in memory to speed up the matmul, however we waste time on the copy
-                // on M1 this is faster for the perplexity computation, but ~5% slower for the single-token generation
-                // is there a better way?
-                ggml_tensor* V_cont = ggml_cpy(ctx0, V, ggml_new_tensor_3d(ctx0, kv_self.v->type, past_size + N, n_embd/n_head, n_head));
-                ggml_tensor* KQV = ggml_mul_mat(ctx0, V_cont, KQ_soft_max);
+                        // make V contiguous in memory to speed up the matmul, however we waste time on the copy
+                        // on M1 this is faster for the perplexity computation, but ~5% slower for the single-token generation
+                        // is there a better way?
+                        ggml_tensor* V_cont = ggml_cpy(ctx0, V, ggml_new_tensor_3d(ctx0, kv_self.v->type, past_size + n_tokens, n_embd/n_head, n_head));
+                        KQV = ggml_mul_mat(ctx0, V_cont, KQ_soft_max);
 #endif
+                    }
+
+                    // KQV_merged = KQV.permute(0, 2, 1, 3)
+                    ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+
+                    if (attn_out) {
+                        // the copies run before the projection below as they are added to the graph first
+                        ggml_tensor* out = ggml_view_2d(ctx0, attn_out, n_embd, n_tokens, attn_out->nb[1], static_cast<std::size_t>(token_offset) * attn_out->nb[1]);
+                        ggml_build_forward_expand(&gf, ggml_cpy(ctx0, KQV_merged, out));
+                    } else {
+                        // cur = KQV_merged.contiguous().view(n_embd, N)
+                        cur = ggml_cpy(ctx0,
+                                KQV_merged,
+                                ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+                    }
 
-                // KQV_merged = KQV.permute(0, 2, 1, 3)
-                ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
+                    token_offset += n_tokens;
+                }
 
-                // cur = KQV_merged.contiguous().view(n_embd, N)
-                cur = ggml_cpy(ctx0,
-                        KQV_merged,
-                        ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, N));
+                if (attn_out) cur = attn_out;
 
                 // projection (no bias)
                 cur = ggml_mul_mat(ctx0,
@@ -403,7 +833,7 @@ namespace fastllama {
                         cur);
             }
 
-            use_buf(ctx0, 1);
+            select_buf(1);
 
             ggml_tensor * inpFF = ggml_add(ctx0, cur, inpSA);
 
@@ -411,26 +841,27 @@ namespace fastllama {
             {
                 // norm
                 {
-                    cur = ggml_rms_norm(ctx0, inpFF);
-
-                    // cur = ffn_norm*cur
-                    cur = ggml_mul(ctx0,
-                            ggml_repeat(ctx0, layers[il].ffn_norm, cur),
-                            cur);
+                    // cur = ffn_norm*rms_norm(inpFF)
+                    cur = ggml_rms_norm_mul(ctx0, inpFF, layers[il].ffn_norm);
                 }
 
-                ggml_tensor * tmp = ggml_mul_mat(ctx0,
-                        layers[il].w3,
-                        cur);
-
-                cur = ggml_mul_mat(ctx0,
-                        layers[il].w1,
-                        cur);
+                // cur = silu(w1*cur) * (w3*cur); the BLAS can not multiply the repacked q4_0 rows
+                if (use_blas && layers[il].w1->type != GGML_TYPE_Q4_0X4) {
+                    ggml_tensor * tmp = ggml_mul_mat(ctx0,
+                            layers[il].w3,
+                            cur);
 
-                // SILU activation
-                cur = ggml_silu(ctx0, cur);
+                    cur = ggml_mul_mat(ctx0,
+                            layers[il].w1,
+                            cur);
 
-                cur = ggml_mul(ctx0, cur, tmp);
+                    cur = ggml_mul(ctx0, ggml_silu(ctx0, cur), tmp);
+                } else {
+                    cur = ggml_mul_mat_swiglu(ctx0,
+                            layers[il].w1,
+                            layers[il].w3,
+                            cur);
+                }
 
                 cur = ggml_mul_mat(ctx0,
                         layers[il].w2,
@@ -443,20 +874,15 @@ namespace fastllama {
             inpL = cur;
         }
 
-        use_buf(ctx0, 0);
+        select_buf(0);
 
         // used at the end to optionally extract the embeddings
         ggml_tensor * embeddings = nullptr;
 
         // norm
         {
-
-            inpL = ggml_rms_norm(ctx0, inpL);
-
-            // inpL = norm*inpL
-            inpL = ggml_mul(ctx0,
-                        ggml_repeat(ctx0, norm, inpL),
-                        inpL);
+            // inpL = norm*rms_norm(inpL)
+            inpL = ggml_rms_norm_mul(ctx0, inpL, norm);
 
             embeddings = inpL;
         }
@@ -464,26 +890,311 @@ namespace fastllama {
         // lm_head
         inpL = ggml_mul_mat(ctx0, output, inpL);
 
-        use_buf(ctx0, -1);
+        select_buf(-1);
 
         // logits -> probs
         //inpL = ggml_soft_max(ctx0, inpL);
 
-        // run the computation
         ggml_build_forward_expand(&gf, inpL);
-        ggml_graph_compute       (ctx0, &gf);
+
+        return { inpL, embeddings };
+    }
+
+    bool Model::plan_eval_memory(ModelState& state, EvalMemoryPlan& plan) const {
+        using namespace ::fastllama::literals;
+
+        auto const n_ctx    = static_cast<std::int64_t>(params.n_ctx);
+        auto const n_embd   = static_cast<std::int64_t>(params.n_embd);
+        auto const n_layer  = static_cast<std::int64_t>(params.n_layer);
+        auto const n_rot    = static_cast<std::int64_t>(params.n_embd / params.n_head);
+        auto const n_tokens = std::clamp(static_cast<std::int64_t>(state.n_batch), std::int64_t{1}, n_ctx);
+        auto const n_seqs   = std::clamp(static_cast<std::int64_t>(state.n_max_sequences), std::int64_t{1}, n_tokens);
+
+        // the measuring contexts only hold the tensor objects and the op parameters
+        auto const mem_size = (layers.size() + 1) * static_cast<std::size_t>(n_seqs) * 64_KiB;
+
+        plan = {};
+
+        // the key/value memory only gives the attention its shapes, so it is not allocated either
+        KVCacheBuffer kv;
+        kv.memory_type = state.kv_self.memory_type;
+
+        ggml_context* kv_ctx = ggml_init_measure(1_MiB);
+        if (kv_ctx == nullptr) {
+            logger.log_err(__func__, "failed to create a context for planning the eval buffers\n");
+            return false;
+        }
+        kv.k = ggml_new_tensor_1d(kv_ctx, kv.key_type(), n_embd * n_ctx * n_layer);
+        kv.v = ggml_new_tensor_1d(kv_ctx, kv.value_type(), n_embd * n_ctx * n_layer);
+        kv.rope = ggml_new_tensor_2d(kv_ctx, GGML_TYPE_F32, n_rot, n_ctx);
+
+        std::fill(std::begin(state.buf_max_size), std::end(state.buf_max_size), std::size_t{});
+        state.is_planning = true;
+
+        auto const measure = [&](std::vector<GraphSequence>& seqs) {
+            ggml_context* ctx0 = ggml_init_measure(mem_size);
+            if (ctx0 == nullptr) return false;
+
+            ggml_cgraph gf{};
+            gf.n_threads = state.threads;
+
+            auto* embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+            build_graph(state, ctx0, gf, Span<GraphSequence>(seqs), embd, use_scratch_buffer);
+            ggml_graph_alloc_work(ctx0, &gf);
+
+            plan.compute = std::max(plan.compute, ggml_used_mem(ctx0));
+            ggml_free(ctx0);
+            return true;
+        };
+
+        // The attention of a sequence grows with its tokens and its position, so the largest graphs are the whole
+        // batch in one sequence at the end of the context, and split over the most sequences at the end of their
+        // contexts, which adds the nodes of every sequence.
+        std::vector<GraphSequence> seqs{ { &kv, n_ctx - n_tokens, n_tokens } };
+        auto is_measured = measure(seqs);
+
+        if (is_measured && n_seqs > 1) {
+            seqs.clear();
+            for (auto i = std::int64_t{}; i < n_seqs; ++i) {
+                auto const n = n_tokens / n_seqs + (i < n_tokens % n_seqs ? 1 : 0);
+                seqs.push_back({ &kv, n_ctx - n, n });
+            }
+            is_measured = measure(seqs);
+        }
+
+        state.is_planning = false;
+        ggml_free(kv_ctx);
+
+        if (!is_measured) {
+            logger.log_err(__func__, "failed to create a context for planning the eval buffers\n");
+            return false;
+        }
+
+        if constexpr (use_scratch_buffer) {
+            // the attention scores of a sequence may be padded differently to the 16 byte alignment of the tensors
+            // when the batch is split in another way
+            auto const padding = static_cast<std::size_t>(n_seqs) * 16;
+
+            auto const n_used = static_cast<std::size_t>(std::distance(
+                std::begin(state.buf_max_size),
+                std::find(std::begin(state.buf_max_size), std::end(state.buf_max_size), std::size_t{})
+            ));
+            plan.scratch.assign(std::begin(state.buf_max_size), std::begin(state.buf_max_size) + static_cast<std::ptrdiff_t>(n_used));
+            for (auto& size : plan.scratch) size += padding;
+        }
+
+        return true;
+    }
+
+    bool Model::init_decode_graph(ModelState& state) const {
+        auto& decode_graph = state.decode_graph;
+        auto const threads = state.threads;
+
+        decode_graph.free();
+
+        auto const n_past_max = static_cast<std::size_t>(params.n_ctx) - 1;
+
+        auto const build = [this, &state, threads, n_past_max](ggml_context* ctx0, ggml_cgraph& gf, DecodeGraph* decode) {
+            gf = {};
+            gf.n_threads = threads;
+
+            auto* embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, 1);
+            GraphSequence const seq{ &state.kv_self, static_cast<std::int64_t>(n_past_max), 1 };
+            auto const [logits, embeddings] = build_graph(state, ctx0, gf, Span<GraphSequence>(&seq, 1), embd, false, decode);
+
+            // reserve the work buffer for the longest attention
+            ggml_graph_alloc_work(ctx0, &gf);
+
+            if (decode) {
+                decode->embd = embd;
+                decode->logits = logits;
+                decode->embeddings = embeddings;
+            }
+        };
+
+        // measure the graph first, so the cached one gets a buffer of the exact size
+        std::size_t mem_size{};
+        {
+            using namespace ::fastllama::literals;
+
+            ggml_context * ctx0 = ggml_init_measure((layers.size() + 1) * 64_KiB);
+            if (ctx0 == nullptr) {
+                logger.log_err(__func__, "failed to create a context for the decode graph\n");
+                return false;
+            }
+
+            ggml_cgraph gf{};
+            build(ctx0, gf, nullptr);
+            mem_size = ggml_used_mem(ctx0);
+            ggml_free(ctx0);
+        }
+
+        decode_graph.buffer.resize(mem_size);
+
+        ggml_init_params mem_params {};
+        mem_params.mem_size   = decode_graph.buffer.size();
+        mem_params.mem_buffer = reinterpret_cast<void*>(decode_graph.buffer.data());
+
+        decode_graph.ctx = ggml_init(mem_params);
+        if (decode_graph.ctx == nullptr) {
+            logger.log_err(__func__, "failed to create a context for the decode graph\n");
+            decode_graph.free();
+            return false;
+        }
+
+        decode_graph.layers.reserve(layers.size());
+        build(decode_graph.ctx, decode_graph.graph, &decode_graph);
+
+        decode_graph.n_threads = threads;
+        decode_graph.is_valid = true;
+        return true;
+    }
+
+    void Model::set_decode_graph_past(ModelState& state, std::size_t n_past) const noexcept {
+        auto const& kv_self = state.kv_self;
+        auto& decode_graph = state.decode_graph;
+
+        auto const n_embd    = static_cast<std::int64_t>(params.n_embd);
+        auto const n_ctx     = static_cast<std::int64_t>(params.n_ctx);
+        auto const past_size = static_cast<std::int64_t>(n_past);
+        auto const n_kv      = past_size + 1;
+
+        auto const k_type = kv_self.k->type;
+        auto const v_type = kv_self.v->type;
+        auto* const k_data = static_cast<char*>(kv_self.k->data);
+        auto* const v_data = static_cast<char*>(kv_self.v->data);
+
+        auto const set_contiguous_strides = [](ggml_tensor* t) {
+            t->nb[1] = t->nb[0] * static_cast<std::size_t>(t->ne[0] / ggml_blck_size(t->type));
+            for (auto i = 2; i < GGML_MAX_DIMS; ++i) t->nb[i] = t->nb[i - 1] * static_cast<std::size_t>(t->ne[i - 1]);
+        };
+
+        for (auto il = 0ul; il < decode_graph.layers.size(); ++il) {
+            auto& nodes = decode_graph.layers[il];
+            auto const layer = static_cast<std::int64_t>(il);
+
+            // position of the token for RoPE
+            static_cast<std::int32_t*>(nodes.q_rope->src1->data)[0] = static_cast<std::int32_t>(past_size);
+            static_cast<std::int32_t*>(nodes.k_rope->src1->data)[0] = static_cast<std::int32_t>(past_size);
+
+            // slots of the new key and value in the cache; the copy nodes are views of them
+            nodes.k_store->data = k_data + kv_offset(k_type, n_embd*(layer*n_ctx + past_size));
+            nodes.v_store->data = v_data + kv_offset(v_type, layer*n_ctx*n_embd + past_size);
+            nodes.k_store_cpy->data = nodes.k_store->data;
+            nodes.v_store_cpy->data = nodes.v_store->data;
+
+            // keys of the layer up to and including the new token
+            nodes.k_view->data = k_data + kv_offset(k_type, layer*n_ctx*n_embd);
+            nodes.k_view->ne[0] = n_kv*n_embd;
+            set_contiguous_strides(nodes.k_view);
+
+            nodes.k_reshape->data = nodes.k_view->data;
+            nodes.k_reshape->ne[2] = n_kv;
+            set_contiguous_strides(nodes.k_reshape);
+
+            nodes.k->data = nodes.k_view->data;
+            nodes.k->ne[1] = n_kv;
+            nodes.k->nb[3] = nodes.k_reshape->nb[3];
+
+            // values of the layer up to and including the new token
+            nodes.v->data = v_data + kv_offset(v_type, layer*n_ctx*n_embd);
+            nodes.v->ne[0] = n_kv;
+
+            // flash attention takes its shapes from K and V
+            if (nodes.kq == nullptr) continue;
+
+            // KQ and the scale, mask and soft_max nodes computed from it are separate nodes, so each one is resized
+            // to the n_kv keys; the mask also gets the new past length
+            for (auto* t : { nodes.kq, nodes.kq_scaled, nodes.kq_masked, nodes.kq_soft_max }) {
+                t->ne[0] = n_kv;
+                set_contiguous_strides(t);
+            }
+            static_cast<std::int32_t*>(nodes.kq_masked->src1->data)[0] = static_cast<std::int32_t>(past_size);
+        }
+    }
+
+    auto Model::eval(
+            ModelState& state,
+            std::size_t n_past,
+            Span<vocab_id> embd_inp,
+            std::vector<float>& embd_w,
+            std::size_t& mem_per_token
+        ) const -> bool
+    {
+        if (!is_valid) {
+            logger.log_err(__func__, "model is not valid\n");
+            return false;
+        };
+        auto const N = static_cast<std::int64_t>(embd_inp.size());
+
+        auto const n_embd  = params.n_embd;
+        auto const n_vocab = params.n_vocab;
+
+        if (n_past + embd_inp.size() > params.n_ctx) {
+            logger.log_err(__func__, "tokens do not fit in the context; n_past = ", n_past, ", N = ", N, ", n_ctx = ", params.n_ctx, "\n");
+            return false;
+        }
+
+        // the eval buffers are planned for batches of up to n_batch tokens
+        if (N > std::max(state.n_batch, 1)) {
+            logger.log_err(__func__, "batch of ", N, " tokens exceeds n_batch = ", state.n_batch, " of the state\n");
+            return false;
+        }
+
+        // single token evals reuse the cached decode graph instead of building a new one
+        auto const use_decode_graph = (N == 1);
+
+        ggml_context * ctx0 = nullptr;
+        ggml_tensor * logits = nullptr;
+        ggml_tensor * embeddings = nullptr;
+
+        auto const& decode_graph = state.decode_graph;
+        auto const threads = state.threads;
+
+        if (use_decode_graph) {
+            if (!decode_graph.is_valid || decode_graph.n_threads != threads) {
+                if (!init_decode_graph(state)) return false;
+            }
+
+            set_decode_graph_past(state, n_past);
+            static_cast<vocab_id*>(decode_graph.embd->data)[0] = embd_inp[0];
+
+            ctx0       = decode_graph.ctx;
+            logits     = decode_graph.logits;
+            embeddings = decode_graph.embeddings;
+
+            state.compute_pool.compute(ctx0, state.decode_graph.graph);
+        } else {
+            ggml_init_params mem_params {};
+            // buf_compute.resize(mem_per_token);
+            mem_params.mem_size   = state.buf_compute.size();
+            mem_params.mem_buffer = reinterpret_cast<void*>(state.buf_compute.data());
+
+            ctx0 = ggml_init(mem_params);
+            ggml_cgraph gf{};
+            gf.n_threads = (N >= 32 && (ggml_cpu_has_blas() || ggml_cpu_has_cublas()) ? 1 : threads);
+
+            ggml_tensor* embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
+            std::copy_n(embd_inp.begin(), N, static_cast<vocab_id*>(embd->data));
+
+            GraphSequence const seq{ &state.kv_self, static_cast<std::int64_t>(n_past), N };
+            std::tie(logits, embeddings) = build_graph(state, ctx0, gf, Span<GraphSequence>(&seq, 1), embd, use_scratch_buffer);
+
+            // run the computation
+            state.compute_pool.compute(ctx0, gf);
+        }
 
         {
             // return result for just the last token
-            auto const embd_w_len = static_cast<std::size_t>(n_vocab) * (should_put_all_logits ? N : 1ul);
-            auto const data_offset = static_cast<std::ptrdiff_t>(n_vocab) * (should_put_all_logits ? 0 : N - 1ul);
+            auto const embd_w_len = static_cast<std::size_t>(n_vocab) * (state.should_put_all_logits ? N : 1ul);
+            auto const data_offset = static_cast<std::ptrdiff_t>(n_vocab) * (state.should_put_all_logits ? 0 : N - 1ul);
             embd_w.resize(embd_w_len);
-            auto const* data_ptr = static_cast<float*>(ggml_get_data(inpL)) + data_offset;
+            auto const* data_ptr = static_cast<float*>(ggml_get_data(logits)) + data_offset;
             std::copy_n(data_ptr, embd_w.size(), embd_w.begin());
         }
 
-        if (embeddings_eval_enable) {
-            auto& embeddings_out = this->embeddings;
+        if (state.embeddings_eval_enable) {
+            auto& embeddings_out = state.embeddings;
             embeddings_out.resize(static_cast<std::size_t>(n_embd));
             auto const* ggml_data_ptr = static_cast<float*>(ggml_get_data(embeddings)) + n_embd * (static_cast<int>(N) - 1);
             std::copy_n(ggml_data_ptr, embeddings_out.size(), embeddings_out.begin());
@@ -493,6 +1204,105 @@ namespace fastllama {
             mem_per_token = ggml_used_mem(ctx0) / N;
         }
 
+        if (!use_decode_graph) ggml_free(ctx0);
+
+        return true;
+    }
+
+    auto Model::eval_batch(
+            ModelState& state,
+            Span<BatchSequence> seqs
+        ) const -> bool
+    {
+        if (!is_valid) {
+            logger.log_err(__func__, "model is not valid\n");
+            return false;
+        };
+
+        if (seqs.empty()) return true;
+
+        auto const n_embd  = params.n_embd;
+        auto const n_vocab = params.n_vocab;
+
+        std::vector<GraphSequence> graph_seqs;
+        graph_seqs.reserve(seqs.size());
+        auto N = std::int64_t{};
+
+        for (auto i = 0ul; i < seqs.size(); ++i) {
+            auto const& seq = seqs[i];
+
+            if (seq.state == nullptr || seq.state->kv_self.k == nullptr || seq.tokens.empty()) {
+                logger.log_err(__func__, "sequence ", i, " has no initialized state or no tokens\n");
+                return false;
+            }
+
+            if (seq.n_past + seq.tokens.size() > params.n_ctx) {
+                logger.log_err(__func__, "tokens of sequence ", i, " do not fit in the context; n_past = ", seq.n_past, ", N = ", seq.tokens.size(), ", n_ctx = ", params.n_ctx, "\n");
+                return false;
+            }
+
+            for (auto j = 0ul; j < i; ++j) {
+                if (seqs[j].state == seq.state) {
+                    logger.log_err(__func__, "sequences ", j, " and ", i, " share the same state\n");
+                    return false;
+                }
+            }
+
+            auto const n_tokens = static_cast<std::int64_t>(seq.tokens.size());
+            graph_seqs.push_back({ &seq.state->kv_self, static_cast<std::int64_t>(seq.n_past), n_tokens });
+            N += n_tokens;
+        }
+
+        if (N > state.n_batch) {
+            logger.log_err(__func__, "batch of ", N, " tokens exceeds n_batch = ", state.n_batch, " of the eval state\n");
+            return false;
+        }
+
+        if (seqs.size() > state.n_max_sequences) {
+            logger.log_err(__func__, "batch of ", seqs.size(), " sequences exceeds n_max_sequences = ", state.n_max_sequences, " of the eval state\n");
+            return false;
+        }
+
+        ggml_init_params mem_params {};
+        mem_params.mem_size   = state.buf_compute.size();
+        mem_params.mem_buffer = reinterpret_cast<void*>(state.buf_compute.data());
+
+        ggml_context * ctx0 = ggml_init(mem_params);
+        ggml_cgraph gf{};
+        gf.n_threads = (N >= 32 && (ggml_cpu_has_blas() || ggml_cpu_has_cublas()) ? 1 : state.threads);
+
+        ggml_tensor* embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, N);
+        {
+            auto* embd_data = static_cast<vocab_id*>(embd->data);
+            for (auto const& seq : seqs) embd_data = std::copy(seq.tokens.begin(), seq.tokens.end(), embd_data);
+        }
+
+        auto const [logits, embeddings] = build_graph(state, ctx0, gf, Span<GraphSequence>(graph_seqs), embd, use_scratch_buffer);
+
+        // run the computation
+        state.compute_pool.compute(ctx0, gf);
+
+        auto const* logits_data     = static_cast<float const*>(ggml_get_data(logits));
+        auto const* embeddings_data = static_cast<float const*>(ggml_get_data(embeddings));
+
+        auto token_offset = std::int64_t{};
+        for (auto const& seq : seqs) {
+            auto const n_tokens = static_cast<std::int64_t>(seq.tokens.size());
+            auto const last     = token_offset + n_tokens - 1;
+
+            if (seq.logits) {
+                // return result for just the last token of the sequence
+                auto const first = seq.state->should_put_all_logits ? token_offset : last;
+                seq.logits->assign(logits_data + first * n_vocab, logits_data + (last + 1) * n_vocab);
+            }
+
+            if (seq.state->embeddings_eval_enable) {
+                seq.state->embeddings.assign(embeddings_data + last * n_embd, embeddings_data + (last + 1) * n_embd);
+            }
+
+            token_offset += n_tokens;
+        }
+
         ggml_free(ctx0);
 
         return true;
@@ -509,6 +1319,8 @@ namespace fastllama {
             case FType::MOSTLY_Q4_1: quantized_type = GGML_TYPE_Q4_1; break;
             case FType::MOSTLY_Q4_2: quantized_type = GGML_TYPE_Q4_2; break;
             case FType::MOSTLY_Q4_3: quantized_type = GGML_TYPE_Q4_3; break;
+            case FType::MOSTLY_Q8_0: quantized_type = GGML_TYPE_Q8_0; break;
+            case FType::MOSTLY_Q5_0: quantized_type = GGML_TYPE_Q5_0; break;
             default: {
                 logger.log_err(__func__, "invalid quantization type ", static_cast<int>(ftype), to_string_view(ftype), '\n');
                 return false;
@@ -814,6 +1626,11 @@ namespace fastllama {
                 return false;
             }
 
+            if (model.tensor_by_name[base_name]->type == GGML_TYPE_Q4_0X4) {
+                logger.log_err(func_name, "lora adapters can not be applied to the repacked '", base_name, "'; load the model without repacking the weights\n");
+                return false;
+            }
+
             if (!use_cache && lora_tl.type != GGML_TYPE_F32) {
                 logger.log_err(func_name, "currently, we support fp16 for uncached matrix.\n");
                 return false;
@@ -904,6 +1721,8 @@ namespace fastllama {
             return false;
         }
         logger.log(__func__, "attaching LoRa model from '", filepath, "'. Please wait ...\n");
+        // the cached prompt memory was computed with the old weights
+        prefix_cache.clear();
         return attach_or_detach_lora_helper(
             filepath,
             *this,
@@ -925,7 +1744,8 @@ namespace fastllama {
         }
 
         logger.log(__func__, "detaching LoRa model from '", attached_lora_path, "'. Please wait ...\n");
-        
+
+        prefix_cache.clear();
         return attach_or_detach_lora_helper(
             attached_lora_path,
             *this,
@@ -943,7 +1763,7 @@ namespace fastllama {
         }, __func__, true);
     }
 
-    bool Model::reset() noexcept {
+    bool ModelState::reset() noexcept {
         embeddings.clear();
         return true;
     }
@@ -0,0 +1,360 @@
+#include "scheduler.hpp"
+#include "bridge.hpp"
+#include "tokenizer.hpp"
+#include <numeric>
+#include <algorithm>
+
+namespace fastllama {
+
+    std::unique_ptr<Scheduler> Scheduler::create(std::shared_ptr<Model> model, Params params) {
+        if (!model || !model->is_valid) {
+            Logger::get_default_logger().log_err("Scheduler::create", "tried to create a scheduler of an invalid model\n");
+            return nullptr;
+        }
+
+        if (params.max_sequences == 0 || params.n_batch < static_cast<int>(params.max_sequences)) {
+            model->logger.log_err("Scheduler::create", "n_batch(='", params.n_batch, "') must be at least max_sequences(='", params.max_sequences, "')\n");
+            return nullptr;
+        }
+
+        auto result = std::unique_ptr<Scheduler>(new Scheduler(std::move(model), params));
+
+        auto& eval_state = result->m_eval_state;
+        eval_state.set_threads(params.n_threads);
+        eval_state.n_batch = params.n_batch;
+        eval_state.n_spin = params.n_spin;
+        eval_state.use_flash_attn = params.use_flash_attn;
+        eval_state.n_max_sequences = params.max_sequences;
+        eval_state.kv_self.memory_type = params.kv_cache_type;
+        // the eval state only provides the buffers and threads; the sequences bring their own key/value memory
+        if (!eval_state.init_eval_buffers(*result->m_model)) return nullptr;
+
+        result->m_worker = std::thread([scheduler = result.get()] { scheduler->run(); });
+        return result;
+    }
+
+    Scheduler::Scheduler(std::shared_ptr<Model> model, Params params)
+        : m_model(std::move(model))
+        , m_params(params)
+    {}
+
+    Scheduler::~Scheduler() {
+        {
+            auto lock = std::unique_lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        if (m_worker.joinable()) m_worker.join();
+    }
+
+    auto Scheduler::submit(Request request) -> request_id_t {
+        auto const seed = static_cast<std::uint32_t>(request.seed);
+        auto seq = std::make_unique<Sequence>(Sequence{
+            0,
+            std::move(request),
+            nullptr,
+            {},
+            0, 0,
+            {},
+            RingBuffer<token_id_t>(m_params.last_n_tokens),
+            std::mt19937(seed),
+            {},
+            nullptr
+        });
+
+        request_id_t id;
+        {
+            auto lock = std::unique_lock(m_mutex);
+            if (m_stop) return -1;
+            id = m_next_id++;
+            seq->id = id;
+            m_waiting.push_back(std::move(seq));
+        }
+        m_cv.notify_one();
+        return id;
+    }
+
+    bool Scheduler::cancel(request_id_t id) {
+        std::unique_ptr<Sequence> cancelled;
+        {
+            auto lock = std::unique_lock(m_mutex);
+            auto it = std::find_if(m_waiting.begin(), m_waiting.end(), [id](auto const& seq) { return seq->id == id; });
+            if (it != m_waiting.end()) {
+                cancelled = std::move(*it);
+                m_waiting.erase(it);
+            } else {
+                if (m_running.count(id) == 0) return false;
+                m_cancelled.insert(id);
+                return true;
+            }
+        }
+
+        if (cancelled->request.on_done) cancelled->request.on_done(Status::Cancelled);
+        return true;
+    }
+
+    void Scheduler::run() {
+        while (true) {
+            std::vector<std::unique_ptr<Sequence>> admitted;
+            std::unordered_set<request_id_t> cancelled;
+            {
+                auto lock = std::unique_lock(m_mutex);
+                m_cv.wait(lock, [this] { return m_stop || !m_waiting.empty() || !m_active.empty(); });
+                if (m_stop) break;
+
+                // every cancelled id is active or admitted below, and `leave` forgets it
+                cancelled = m_cancelled;
+
+                // admit new requests at the token boundary
+                while (!m_is_waiting_for_memory && m_active.size() + admitted.size() < m_params.max_sequences && !m_waiting.empty()) {
+                    m_running.insert(m_waiting.front()->id);
+                    admitted.push_back(std::move(m_waiting.front()));
+                    m_waiting.pop_front();
+                }
+            }
+
+            for (auto& seq : m_active) {
+                if (cancelled.count(seq->id) != 0) finish(*seq, Status::Cancelled);
+            }
+
+            std::vector<std::unique_ptr<Sequence>> deferred;
+            for (auto& seq : admitted) {
+                if (cancelled.count(seq->id) != 0) {
+                    leave(*seq, Status::Cancelled);
+                    continue;
+                }
+
+                switch (activate(*seq)) {
+                    case Admission::Active: m_active.push_back(std::move(seq)); break;
+                    case Admission::Deferred: deferred.push_back(std::move(seq)); break;
+                    case Admission::Left: break;
+                }
+            }
+
+            // the deferred requests wait again at the front of the queue, unless they were cancelled meanwhile
+            if (!deferred.empty()) {
+                std::vector<std::unique_ptr<Sequence>> cancelled_deferred;
+                {
+                    auto lock = std::unique_lock(m_mutex);
+                    for (auto it = deferred.rbegin(); it != deferred.rend(); ++it) {
+                        m_running.erase((*it)->id);
+                        if (m_cancelled.erase((*it)->id) != 0) cancelled_deferred.push_back(std::move(*it));
+                        else m_waiting.push_front(std::move(*it));
+                    }
+                }
+
+                for (auto& seq : cancelled_deferred) {
+                    if (seq->request.on_done) seq->request.on_done(Status::Cancelled);
+                }
+            }
+
+            // retire finished requests; `finish` releases the state of a sequence
+            m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [](auto const& seq) { return seq->state == nullptr; }), m_active.end());
+
+            if (!m_active.empty() && !step()) {
+                for (auto& seq : m_active) finish(*seq, Status::Failed);
+            }
+
+            m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [](auto const& seq) { return seq->state == nullptr; }), m_active.end());
+        }
+
+        std::deque<std::unique_ptr<Sequence>> waiting;
+        {
+            auto lock = std::unique_lock(m_mutex);
+            std::swap(waiting, m_waiting);
+        }
+
+        for (auto& seq : m_active) finish(*seq, Status::Failed);
+        for (auto& seq : waiting) {
+            if (seq->request.on_done) seq->request.on_done(Status::Failed);
+        }
+        m_active.clear();
+    }
+
+    auto Scheduler::activate(Sequence& seq) -> Admission {
+        auto const& logger = get_logger();
+        auto const& vocab = m_model->vocabulary;
+
+        auto prompt = seq.request.prompt;
+        prompt.insert(0, 1, ' ');
+        seq.pending = tokenize(vocab, prompt, true);
+
+        auto const max_input_size = static_cast<std::size_t>(m_model->params.n_ctx) - 4;
+        if (seq.pending.size() > max_input_size) {
+            logger.log_err("Scheduler", "prompt size(='", seq.pending.size(), "') exceeds maximum allowed size('", max_input_size, "')\n");
+            leave(seq, Status::Failed);
+            return Admission::Left;
+        }
+
+        if (!m_free_states.empty()) {
+            seq.state = std::move(m_free_states.back());
+            m_free_states.pop_back();
+        } else {
+            seq.state = std::make_unique<ModelState>();
+            seq.state->kv_self.memory_type = m_params.kv_cache_type;
+            seq.state->kv_self.huge_pages = m_model->huge_pages();
+            if (!seq.state->kv_self.init(m_model->params, logger)) {
+                seq.state.reset();
+                // the memory of an active request is reused once it leaves; without one, it will never fit
+                if (!m_active.empty()) {
+                    m_is_waiting_for_memory = true;
+                    return Admission::Deferred;
+                }
+                leave(seq, Status::OutOfMemory);
+                return Admission::Left;
+            }
+        }
+
+        // a fresh request copies the memory of its longest cached prefix; the last token is always evaluated for the logits
+        seq.n_past = 0;
+        if (m_model->prefix_cache.enabled()) {
+            seq.prompt = seq.pending;
+            auto const n_reused = m_model->prefix_cache.restore(m_model->params, Span<token_id_t>(seq.pending.data(), seq.pending.size() - 1), seq.state->kv_self);
+            seq.pending.erase(seq.pending.begin(), seq.pending.begin() + static_cast<std::ptrdiff_t>(n_reused));
+            seq.n_past = n_reused;
+        }
+
+        auto const max_token_buffer_size = std::accumulate(
+            seq.request.stop_words.begin(),
+            seq.request.stop_words.end(),
+            std::size_t{},
+            [&vocab](auto const& max_el, auto const& el) {
+                return std::max(max_el, tokenize(vocab, el, false).size());
+            }
+        );
+
+        seq.token_buffer = std::make_unique<Sequence::token_buffer_t>(vocab, max_token_buffer_size, [&on_token = seq.request.on_token](std::string s) {
+            if (on_token) on_token(s);
+        });
+
+        return Admission::Active;
+    }
+
+    bool Scheduler::make_room(Sequence& seq, std::size_t n_tokens) {
+        auto const n_ctx = static_cast<std::size_t>(m_model->params.n_ctx);
+        if (seq.n_past + n_tokens <= n_ctx) return true;
+
+        // same policy as `FastLlama`: discard the older half of the tokens after the kept prefix
+        auto const n_keep = std::min(static_cast<std::size_t>(std::max(0, m_params.n_keep)), seq.n_past);
+        auto const n_left = seq.n_past - n_keep;
+        auto const n_discard = std::max(n_left >> 1, seq.n_past + n_tokens - n_ctx);
+
+        if (n_discard > n_left) return false;
+        if (!seq.state->shift_kv_cache(m_model->params, n_keep, n_discard, seq.n_past, get_logger())) return false;
+
+        seq.n_past -= n_discard;
+        return true;
+    }
+
+    bool Scheduler::step() {
+        std::vector<Model::BatchSequence> batch;
+        std::vector<Sequence*> batch_seqs;
+        batch.reserve(m_active.size());
+        batch_seqs.reserve(m_active.size());
+
+        auto budget = static_cast<std::size_t>(m_params.n_batch);
+
+        auto const add = [&](Sequence& seq, std::size_t n_tokens) {
+            // the context of the request is all it has, so a request that does not fit now never will
+            if (!make_room(seq, n_tokens)) {
+                finish(seq, Status::OutOfMemory);
+                return;
+            }
+            batch.push_back({ seq.state.get(), seq.n_past, Span<token_id_t>(seq.pending.data(), n_tokens), &seq.logits });
+            batch_seqs.push_back(&seq);
+            budget -= n_tokens;
+        };
+
+        // generating requests take one token each so their latency does not depend on the prompts being ingested
+        for (auto& seq : m_active) {
+            if (seq->state && seq->n_generated > 0) add(*seq, 1);
+        }
+
+        for (auto& seq : m_active) {
+            if (budget == 0) break;
+            if (seq->state && seq->n_generated == 0) add(*seq, std::min(budget, seq->pending.size()));
+        }
+
+        if (batch.empty()) return true;
+
+        if (!m_model->eval_batch(m_eval_state, Span<Model::BatchSequence>(batch))) return false;
+
+        for (auto i = 0ul; i < batch.size(); ++i) {
+            auto& seq = *batch_seqs[i];
+            auto const n_tokens = batch[i].tokens.size();
+
+            seq.n_past += n_tokens;
+            seq.pending.erase(seq.pending.begin(), seq.pending.begin() + static_cast<std::ptrdiff_t>(n_tokens));
+
+            // the rest of the prompt is ingested in the next steps
+            if (!seq.pending.empty()) continue;
+
+            if (seq.n_generated == 0 && seq.n_past == seq.prompt.size()) {
+                m_model->prefix_cache.store(m_model->params, seq.prompt, seq.state->kv_self);
+            }
+
+            if (seq.n_generated >= seq.request.num_tokens) {
+                finish(seq, Status::Done);
+                continue;
+            }
+
+            auto const token_id = sample_top_p_top_k(
+                *m_model,
+                seq.logits,
+                seq.last_n_tokens,
+                static_cast<double>(seq.request.repeat_penalty),
+                static_cast<int   >(seq.request.top_k),
+                static_cast<double>(seq.request.top_p),
+                static_cast<double>(seq.request.temp),
+                seq.rng
+            );
+
+            if (token_id == EOS) {
+                finish(seq, Status::Done);
+                continue;
+            }
+
+            ++seq.n_generated;
+            seq.last_n_tokens.push_back(token_id);
+            seq.token_buffer->add(token_id);
+            seq.pending.push_back(token_id);
+
+            auto const [is_stop_token_present, to_be_flush_substr, left_out_string] = seq.token_buffer->are_tokens_present_in_buffer(seq.request.stop_words);
+            if (is_stop_token_present) {
+                if (seq.request.on_token) seq.request.on_token(std::string(to_be_flush_substr));
+                seq.token_buffer->clear();
+                finish(seq, Status::Done);
+                continue;
+            }
+
+            if (seq.n_generated >= seq.request.num_tokens) finish(seq, Status::Done);
+        }
+
+        return true;
+    }
+
+    void Scheduler::finish(Sequence& seq, Status status) {
+        if (!seq.state) return;
+
+        if (status == Status::Done && seq.token_buffer) {
+            while (!seq.token_buffer->empty()) seq.token_buffer->flush_buffer();
+        }
+        seq.token_buffer.reset();
+
+        m_free_states.push_back(std::move(seq.state));
+        m_is_waiting_for_memory = false;
+
+        leave(seq, status);
+    }
+
+    void Scheduler::leave(Sequence& seq, Status status) {
+        {
+            auto lock = std::unique_lock(m_mutex);
+            m_running.erase(seq.id);
+            m_cancelled.erase(seq.id);
+        }
+
+        if (seq.request.on_done) seq.request.on_done(status);
+    }
+
+} // namespace fastllama
@@ -0,0 +1,102 @@
+#include "llama.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+// Measures the prompt ingestion and decode speed of a model with the attention built from separate
+// matrix products and soft_max, and with the fused flash attention op, and prints how far apart the
+// logits of the two are.
+//
+// usage:
+//  ./bench_attention <model> [threads] [prompt tokens] [generated tokens] [kv type: f32, f16 or q8_0]
+//
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model> [threads] [prompt tokens] [generated tokens] [kv type: f32, f16 or q8_0]\n", argv[0]);
+        return 1;
+    }
+
+    int const n_threads = argc > 2 ? std::atoi(argv[2]) : 8;
+    int const n_prompt  = argc > 3 ? std::atoi(argv[3]) : 1024;
+    int const n_gen     = argc > 4 ? std::atoi(argv[4]) : 64;
+    auto const kv_name  = std::string_view(argc > 5 ? argv[5] : "f32");
+    int const n_batch   = 64;
+
+    auto kv_type = GGML_TYPE_F32;
+    if (kv_name == "f16") kv_type = GGML_TYPE_F16;
+    else if (kv_name == "q8_0") kv_type = GGML_TYPE_Q8_0;
+    else if (kv_name != "f32") {
+        fprintf(stderr, "unknown kv type '%s'\n", argv[5]);
+        return 1;
+    }
+
+    using vocab_id = fastllama::Model::vocab_id;
+
+    ggml_time_init();
+
+    fastllama::Model model;
+    model.params.n_ctx = static_cast<std::uint32_t>(n_prompt + n_gen);
+    model.set_threads(n_threads);
+    if (!model.load(argv[1])) return 1;
+
+    auto const n_vocab = static_cast<int>(model.params.n_vocab);
+    auto const token_at = [n_vocab](int i) { return static_cast<vocab_id>(1 + (i * 31) % (n_vocab - 1)); };
+
+    printf("threads = %d, prompt = %d, generated = %d, kv = %s\n", n_threads, n_prompt, n_gen, kv_name.data());
+
+    auto const run = [&](char const* name, bool use_flash_attn, std::vector<float>& all_logits) {
+        fastllama::ModelState state;
+        state.set_threads(n_threads);
+        state.n_batch = n_batch;
+        state.use_flash_attn = use_flash_attn;
+        state.kv_self.memory_type = kv_type;
+        if (!state.init(model)) return false;
+
+        std::vector<vocab_id> tokens(static_cast<std::size_t>(n_prompt));
+        for (auto i = 0; i < n_prompt; ++i) tokens[static_cast<std::size_t>(i)] = token_at(i);
+
+        std::vector<float> logits;
+        std::size_t mem_per_token = 0;
+
+        auto const t_prompt_us = ggml_time_us();
+        for (auto i = 0; i < n_prompt; i += n_batch) {
+            auto const n = static_cast<std::size_t>(std::min(n_batch, n_prompt - i));
+            if (!model.eval(state, static_cast<std::size_t>(i), fastllama::Span<vocab_id>(tokens.data() + i, n), logits, mem_per_token)) {
+                fprintf(stderr, "%s: eval failed\n", name);
+                return false;
+            }
+        }
+        auto const prompt_secs = static_cast<double>(ggml_time_us() - t_prompt_us) / 1e6;
+        all_logits = logits;
+
+        auto const t_gen_us = ggml_time_us();
+        for (auto i = 0; i < n_gen; ++i) {
+            auto token = token_at(n_prompt + i);
+            if (!model.eval(state, static_cast<std::size_t>(n_prompt + i), fastllama::Span<vocab_id>(&token, 1), logits, mem_per_token)) {
+                fprintf(stderr, "%s: eval failed\n", name);
+                return false;
+            }
+            all_logits.insert(all_logits.end(), logits.begin(), logits.end());
+        }
+        auto const gen_secs = static_cast<double>(ggml_time_us() - t_gen_us) / 1e6;
+
+        printf("%-16s: prompt %8.2f tokens/s, decode %8.3f ms per token\n", name, n_prompt / prompt_secs, gen_secs * 1000.0 / std::max(n_gen, 1));
+        return true;
+    };
+
+    std::vector<float> logits_ref;
+    std::vector<float> logits_flash;
+    if (!run("separate ops", false, logits_ref)) return 1;
+    if (!run("flash attention", true, logits_flash)) return 1;
+
+    auto max_diff = 0.0f;
+    for (auto i = 0ul; i < std::min(logits_ref.size(), logits_flash.size()); ++i) {
+        max_diff = std::max(max_diff, std::fabs(logits_ref[i] - logits_flash[i]));
+    }
+    printf("max logit difference = %g\n", static_cast<double>(max_diff));
+
+    return 0;
+}
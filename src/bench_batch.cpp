@@ -0,0 +1,86 @@
+#include "llama.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Measures the decode throughput of several concurrent sequences of one model when every sequence is
+// evaluated on its own versus when the next token of all of them is evaluated in a single batch.
+//
+// usage:
+//  ./bench_batch <model> [threads] [sequences] [tokens] [n_ctx]
+//
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model> [threads] [sequences] [tokens] [n_ctx]\n", argv[0]);
+        return 1;
+    }
+
+    int const n_threads = argc > 2 ? std::atoi(argv[2]) : 8;
+    int const n_seqs    = argc > 3 ? std::atoi(argv[3]) : 8;
+    int const n_tokens  = argc > 4 ? std::atoi(argv[4]) : 32;
+    int const n_ctx     = argc > 5 ? std::atoi(argv[5]) : 512;
+
+    using vocab_id = fastllama::Model::vocab_id;
+
+    ggml_time_init();
+
+    fastllama::Model model;
+    model.params.n_ctx = static_cast<std::uint32_t>(n_ctx);
+    model.set_threads(n_threads);
+    if (!model.load(argv[1])) return 1;
+
+    auto const make_state = [&](int n_batch) {
+        fastllama::ModelState state;
+        state.set_threads(n_threads);
+        state.n_batch = n_batch;
+        state.n_max_sequences = static_cast<std::size_t>(n_batch);
+        return state;
+    };
+
+    std::vector<fastllama::ModelState> states;
+    states.reserve(static_cast<std::size_t>(n_seqs));
+    for (auto i = 0; i < n_seqs; ++i) {
+        states.push_back(make_state(1));
+        if (!states.back().init(model)) return 1;
+    }
+
+    auto batch_state = make_state(n_seqs);
+    if (!batch_state.init(model)) return 1;
+
+    std::vector<vocab_id> tokens(static_cast<std::size_t>(n_seqs));
+    std::vector<std::vector<float>> logits(static_cast<std::size_t>(n_seqs));
+
+    auto const run = [&](char const* name, auto&& step) {
+        auto const t_start_us = ggml_time_us();
+        for (auto i = 0; i < n_tokens; ++i) {
+            for (auto s = 0; s < n_seqs; ++s) tokens[static_cast<std::size_t>(s)] = static_cast<vocab_id>(1 + (i * 31 + s * 17) % static_cast<int>(model.params.n_vocab - 1));
+            if (!step(static_cast<std::size_t>(i))) {
+                fprintf(stderr, "%s: eval failed\n", name);
+                return;
+            }
+        }
+        auto const secs = static_cast<double>(ggml_time_us() - t_start_us) / 1e6;
+        auto const total = static_cast<double>(n_tokens) * n_seqs;
+        printf("%-24s: %8.2f tokens/s, %8.3f ms per step\n", name, total / secs, secs * 1000.0 / n_tokens);
+    };
+
+    printf("threads = %d, sequences = %d, tokens = %d\n", n_threads, n_seqs, n_tokens);
+
+    run("one eval per sequence", [&](std::size_t n_past) {
+        std::size_t mem_per_token = 0;
+        for (auto s = 0ul; s < states.size(); ++s) {
+            if (!model.eval(states[s], n_past, fastllama::Span<vocab_id>(&tokens[s], 1), logits[s], mem_per_token)) return false;
+        }
+        return true;
+    });
+
+    run("batched eval", [&](std::size_t n_past) {
+        std::vector<fastllama::Model::BatchSequence> seqs;
+        for (auto s = 0ul; s < states.size(); ++s) {
+            seqs.push_back({ &states[s], n_past, fastllama::Span<vocab_id>(&tokens[s], 1), &logits[s] });
+        }
+        return model.eval_batch(batch_state, fastllama::Span<fastllama::Model::BatchSequence>(seqs));
+    });
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "llama.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Measures the prompt and decode throughput of a model whose weights, key/value cache and eval buffers are
+// allocated as usual versus on huge pages. With transparent huge pages set to `always`, the kernel already
+// backs large allocations with huge pages, so the difference shows with `madvise` or with pages reserved
+// through vm.nr_hugepages.
+//
+// usage:
+//  ./bench_hugepages <model> [threads] [prompt tokens] [tokens] [n_ctx]
+//
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <model> [threads] [prompt tokens] [tokens] [n_ctx]\n", argv[0]);
+        return 1;
+    }
+
+    int const n_threads = argc > 2 ? std::atoi(argv[2]) : 8;
+    int const n_prompt  = argc > 3 ? std::atoi(argv[3]) : 64;
+    int const n_tokens  = argc > 4 ? std::atoi(argv[4]) : 64;
+    int const n_ctx     = argc > 5 ? std::atoi(argv[5]) : 512;
+
+    using vocab_id = fastllama::Model::vocab_id;
+
+    ggml_time_init();
+
+    auto const run = [&](char const* name, bool use_huge_pages) {
+        fastllama::Model model;
+        model.params.n_ctx = static_cast<std::uint32_t>(n_ctx);
+        model.use_huge_pages = use_huge_pages;
+        model.set_threads(n_threads);
+        if (!model.load(argv[1])) return false;
+
+        fastllama::ModelState state;
+        state.set_threads(n_threads);
+        state.n_batch = n_prompt;
+        if (!state.init(model)) return false;
+
+        std::vector<vocab_id> prompt(static_cast<std::size_t>(n_prompt));
+        for (auto i = 0ul; i < prompt.size(); ++i) prompt[i] = static_cast<vocab_id>(1 + (i * 31) % (model.params.n_vocab - 1));
+
+        std::vector<float> logits;
+        std::size_t mem_per_token = 0;
+
+        auto const t_prompt_us = ggml_time_us();
+        if (!model.eval(state, 0, fastllama::Span<vocab_id>(prompt.data(), prompt.size()), logits, mem_per_token)) return false;
+        auto const prompt_secs = static_cast<double>(ggml_time_us() - t_prompt_us) / 1e6;
+
+        auto const t_decode_us = ggml_time_us();
+        for (auto i = 0; i < n_tokens; ++i) {
+            auto token = static_cast<vocab_id>(1 + (i * 17) % static_cast<int>(model.params.n_vocab - 1));
+            auto const n_past = static_cast<std::size_t>(n_prompt + i);
+            if (!model.eval(state, n_past, fastllama::Span<vocab_id>(&token, 1), logits, mem_per_token)) return false;
+        }
+        auto const decode_secs = static_cast<double>(ggml_time_us() - t_decode_us) / 1e6;
+
+        printf("%-12s: prompt %8.2f tokens/s, decode %8.2f tokens/s (weights on %s, kv cache on %s)\n",
+            name, n_prompt / prompt_secs, n_tokens / decode_secs,
+            fastllama::to_string_view(model.buffer.huge_pages()).data(),
+            fastllama::to_string_view(state.kv_self.buffer.huge_pages()).data());
+        return true;
+    };
+
+    printf("threads = %d, prompt tokens = %d, tokens = %d, n_ctx = %d\n", n_threads, n_prompt, n_tokens, n_ctx);
+
+    if (!run("default", false)) return 1;
+    if (!run("huge pages", true)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "ggml.h"
+#include "tensor/compute_pool.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+
+// Measures the attention ops between the matrix products (diag_mask_inf, soft_max, and rope computing its angles
+// or reading them from a table) on their own for an increasing number of threads, with the shapes of a prompt
+// chunk of `tokens` attending to `n_kv` keys.
+//
+// usage:
+//  ./bench_ops [max threads] [n_kv] [tokens] [heads] [evals]
+//
+int main(int argc, char ** argv) {
+    int const max_threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    int const n_kv        = argc > 2 ? std::atoi(argv[2]) : 2048;
+    int const n_tokens    = argc > 3 ? std::atoi(argv[3]) : 64;
+    int const n_head      = argc > 4 ? std::atoi(argv[4]) : 32;
+    int const n_evals     = argc > 5 ? std::atoi(argv[5]) : 32;
+
+    int const n_rot  = 128;
+    int const n_past = std::max(n_kv - n_tokens, 0);
+
+    ggml_time_init();
+
+    auto const scores_size = static_cast<std::size_t>(n_kv) * n_tokens * n_head * sizeof(float);
+    auto const rope_size   = static_cast<std::size_t>(n_rot) * n_head * n_tokens * sizeof(float);
+    auto const table_size  = static_cast<std::size_t>(n_rot) * std::max(n_kv, n_tokens) * sizeof(float);
+
+    ggml_init_params params{};
+    params.mem_size = scores_size + rope_size + table_size + 1024 * 1024;
+    ggml_context * ctx = ggml_init(params);
+
+    ggml_tensor * scores = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_kv, n_tokens, n_head);
+    ggml_tensor * heads  = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_rot, n_head, n_tokens);
+    ggml_tensor * table  = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_rot, std::max(n_kv, n_tokens));
+    ggml_rope_table(table);
+    {
+        std::mt19937 rng(42);
+        std::normal_distribution<float> dist(0.f, 1.f);
+        std::generate_n(static_cast<float*>(scores->data), ggml_nelements(scores), [&] { return dist(rng); });
+        std::generate_n(static_cast<float*>(heads->data), ggml_nelements(heads), [&] { return dist(rng); });
+    }
+
+    // 1, 2, 4, ... and max_threads
+    std::vector<int> thread_counts;
+    for (auto n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+    thread_counts.push_back(std::max(max_threads, 1));
+
+    std::vector<std::uint8_t> buf_compute(16 * 1024 * 1024);
+
+    auto const run = [&](char const* name, auto&& build) {
+        for (auto n_threads : thread_counts) {
+            ggml_init_params compute_params{};
+            compute_params.mem_size   = buf_compute.size();
+            compute_params.mem_buffer = buf_compute.data();
+
+            ggml_context * ctx0 = ggml_init(compute_params);
+            ggml_cgraph gf = ggml_build_forward(build(ctx0));
+            gf.n_threads = n_threads;
+
+            auto pool = fastllama::ComputePool(n_threads, GGML_DEFAULT_N_SPIN);
+            pool.compute(ctx0, gf);
+
+            std::vector<double> samples;
+            samples.reserve(static_cast<std::size_t>(n_evals));
+            for (auto i = 0; i < n_evals; ++i) {
+                auto const t_start_us = ggml_time_us();
+                pool.compute(ctx0, gf);
+                samples.push_back(static_cast<double>(ggml_time_us() - t_start_us) / 1000.0);
+            }
+
+            std::sort(samples.begin(), samples.end());
+            auto const mean = std::accumulate(samples.begin(), samples.end(), 0.0) / static_cast<double>(samples.size());
+            auto const p50  = samples[samples.size() / 2];
+
+            printf("%-14s threads = %3d: mean = %8.3f ms, p50 = %8.3f ms\n", name, n_threads, mean, p50);
+
+            ggml_free(ctx0);
+        }
+    };
+
+    printf("n_kv = %d, tokens = %d, heads = %d, evals = %d\n", n_kv, n_tokens, n_head, n_evals);
+
+    run("diag_mask_inf", [&](ggml_context * ctx0) { return ggml_diag_mask_inf(ctx0, scores, n_past); });
+    run("soft_max",      [&](ggml_context * ctx0) { return ggml_soft_max(ctx0, scores); });
+    run("rope",          [&](ggml_context * ctx0) { return ggml_rope(ctx0, heads, n_past, n_rot, 0); });
+    run("rope (table)",  [&](ggml_context * ctx0) { return ggml_rope_cached(ctx0, heads, n_past, n_rot, 0, table); });
+
+    ggml_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "ggml.h"
+#include "tensor/compute_pool.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+
+// Measures the per-eval latency of a decode-like graph (a stack of Q4_0 matrix x vector products)
+// when the workers are spawned for every graph versus when they are parked in a persistent pool.
+// The pool is measured with the given spin budget of its barriers (negative spins forever, 0 sleeps right away).
+//
+// usage:
+//  ./bench_threadpool [threads] [evals] [layers] [spin]
+//
+int main(int argc, char ** argv) {
+    int const n_threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    int const n_evals   = argc > 2 ? std::atoi(argv[2]) : 256;
+    int const n_layers  = argc > 3 ? std::atoi(argv[3]) : 8;
+    int const n_spin    = argc > 4 ? std::atoi(argv[4]) : GGML_DEFAULT_N_SPIN;
+
+    int const n_embd = 4096;
+
+    ggml_time_init();
+
+    ggml_init_params params{};
+    params.mem_size = static_cast<std::size_t>(n_layers + 1) * n_embd * n_embd + 64 * 1024 * 1024;
+    ggml_context * ctx = ggml_init(params);
+
+    // random weights quantized to Q4_0
+    std::vector<ggml_tensor*> weights(static_cast<std::size_t>(n_layers));
+    {
+        std::mt19937 rng(42);
+        std::normal_distribution<float> dist(0.f, 0.02f);
+        std::vector<float> f32(static_cast<std::size_t>(n_embd) * n_embd);
+        std::vector<std::int64_t> hist(16, 0);
+
+        for (auto& w : weights) {
+            std::generate(f32.begin(), f32.end(), [&] { return dist(rng); });
+            w = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd);
+            ggml_quantize_q4_0(f32.data(), w->data, n_embd * n_embd, n_embd, hist.data());
+        }
+    }
+
+    auto const build_graph = [&](ggml_context * ctx0) {
+        ggml_tensor * cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, n_embd);
+        ggml_set_f32(cur, 1.0f);
+
+        for (auto* w : weights) {
+            cur = ggml_silu(ctx0, ggml_mul_mat(ctx0, w, cur));
+        }
+
+        ggml_cgraph gf = ggml_build_forward(cur);
+        gf.n_threads = n_threads;
+        return gf;
+    };
+
+    std::vector<std::uint8_t> buf_compute(64 * 1024 * 1024);
+
+    auto const run = [&](char const* name, auto&& compute) {
+        std::vector<double> samples;
+        samples.reserve(static_cast<std::size_t>(n_evals));
+
+        for (auto i = 0; i < n_evals; ++i) {
+            ggml_init_params compute_params{};
+            compute_params.mem_size   = buf_compute.size();
+            compute_params.mem_buffer = buf_compute.data();
+
+            ggml_context * ctx0 = ggml_init(compute_params);
+            auto gf = build_graph(ctx0);
+
+            auto const t_start_us = ggml_time_us();
+            compute(ctx0, gf);
+            samples.push_back(static_cast<double>(ggml_time_us() - t_start_us) / 1000.0);
+
+            ggml_free(ctx0);
+        }
+
+        std::sort(samples.begin(), samples.end());
+        auto const mean = std::accumulate(samples.begin(), samples.end(), 0.0) / static_cast<double>(samples.size());
+        auto const p50  = samples[samples.size() / 2];
+        auto const p99  = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+
+        printf("%-24s: mean = %8.3f ms, p50 = %8.3f ms, p99 = %8.3f ms\n", name, mean, p50, p99);
+    };
+
+    printf("threads = %d, evals = %d, layers = %d, spin = %d\n", n_threads, n_evals, n_layers, n_spin);
+
+    run("spawn threads per eval", [](ggml_context * ctx0, ggml_cgraph& gf) {
+        ggml_graph_compute(ctx0, &gf);
+    });
+
+    {
+        auto pool = fastllama::ComputePool(n_threads, n_spin);
+        run("persistent pool", [&pool](ggml_context * ctx0, ggml_cgraph& gf) {
+            pool.compute(ctx0, gf);
+        });
+    }
+
+    ggml_free(ctx);
+
+    return 0;
+}
@@ -10,6 +10,10 @@ int main(int argc, char ** argv) {
         fprintf(stderr, "usage: %s model-f32.bin model-quant.bin type\n", argv[0]);
         fprintf(stderr, "  type = 2 - q4_0\n");
         fprintf(stderr, "  type = 3 - q4_1\n");
+        fprintf(stderr, "  type = 5 - q4_2\n");
+        fprintf(stderr, "  type = 6 - q4_3\n");
+        fprintf(stderr, "  type = 7 - q8_0\n");
+        fprintf(stderr, "  type = 8 - q5_0\n");
         return 1;
     }
 